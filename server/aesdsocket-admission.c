@@ -0,0 +1,305 @@
+/***********************************************************************
+ * @file      		aesdsocket-admission.c
+ * @version   		0.1
+ * @brief		    Per source address admission control and rate limits
+ *
+ * Every accepted connection is looked up by peer address in a hash
+ * table split into ADMISSION_SHARDS independently locked shards, so
+ * accepts and appends from different addresses rarely meet on a lock and
+ * a lookup is a hash, one uncontended mutex and a short chain walk.
+ *
+ * A source counts its open connections and carries two token buckets,
+ * records/s and bytes/s, refilled lazily from the elapsed time whenever
+ * they are charged. A source outlives its last connection until its
+ * buckets are full again, so reconnecting does not reset the limits.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include "aesdsocket-admission.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct admission_shard_t
+ * @brief One lock and the hash chains it protects.
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    size_t sources;             /**< Sources tracked in this shard */
+    size_t reclaim_at;          /**< Look for idle sources once sources reaches this */
+    LIST_HEAD(source_chain, admission_source) buckets[ADMISSION_BUCKETS];
+} admission_shard_t;
+
+/****************   Global Variables     ***************/
+static admission_shard_t shards[ADMISSION_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void shards_init(void)
+{
+    int i;
+
+    for(i = 0; i < ADMISSION_SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].mutex, NULL);
+        shards[i].reclaim_at = ADMISSION_RECLAIM_MIN;
+    }
+}
+
+static bool admission_enabled(void)
+{
+    return (s_config.max_conns_per_ip > 0) || (s_config.records_per_sec > 0) || (s_config.bytes_per_sec > 0);
+}
+
+static admission_shard_t *source_shard(uint32_t hash)
+{
+    return &shards[hash & (ADMISSION_SHARDS - 1)];
+}
+
+/**
+ * @brief FNV-1a over the family and address bytes.
+ */
+static uint32_t source_hash(sa_family_t family, const uint8_t *addr)
+{
+    uint32_t hash = 2166136261u ^ family;
+    int i;
+
+    for(i = 0; i < 16; i++)
+    {
+        hash = (hash ^ addr[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Adds the tokens earned since the last refill, up to one second's worth.
+ *
+ * Called with the shard lock held.
+ */
+static void source_refill(admission_source_t *source, uint64_t now)
+{
+    double elapsed = (now - source->refilled) / 1e9;
+
+    source->refilled = now;
+    if(s_config.records_per_sec > 0)
+    {
+        source->record_tokens += elapsed * s_config.records_per_sec;
+        if(source->record_tokens > s_config.records_per_sec)
+        {
+            source->record_tokens = s_config.records_per_sec;
+        }
+    }
+    if(s_config.bytes_per_sec > 0)
+    {
+        source->byte_tokens += elapsed * s_config.bytes_per_sec;
+        if(source->byte_tokens > s_config.bytes_per_sec)
+        {
+            source->byte_tokens = s_config.bytes_per_sec;
+        }
+    }
+}
+
+/**
+ * @brief Whether a source can be forgotten without loosening its limits.
+ *
+ * Called with the shard lock held.
+ */
+static bool source_idle(admission_source_t *source, uint64_t now)
+{
+    if(source->conns > 0)
+    {
+        return false;
+    }
+    source_refill(source, now);
+    return (source->record_tokens >= s_config.records_per_sec) &&
+           (source->byte_tokens >= s_config.bytes_per_sec);
+}
+
+/**
+ * @brief Logs a refusal with the printable source address.
+ */
+static void source_log(const char *reason, sa_family_t family, const uint8_t *addr)
+{
+    char ip[INET6_ADDRSTRLEN];
+
+    if(inet_ntop(family, addr, ip, sizeof(ip)) == NULL)
+    {
+        strcpy(ip, "?");
+    }
+    log_msg(LOG_INFO, "%s: %s", reason, ip);
+}
+
+static void source_free(admission_shard_t *shard, admission_source_t *source)
+{
+    LIST_REMOVE(source, chain);
+    free(source);
+    shard->sources--;
+}
+
+/**
+ * @brief Drops every idle source of a shard.
+ *
+ * The next sweep waits until the shard has doubled again, so the cost is
+ * spread over the acquires that grew it. Called with the shard lock held.
+ */
+static void shard_reclaim(admission_shard_t *shard, uint64_t now)
+{
+    admission_source_t *source;
+    admission_source_t *next;
+    int i;
+
+    for(i = 0; i < ADMISSION_BUCKETS; i++)
+    {
+        source = LIST_FIRST(&shard->buckets[i]);
+        while(source != NULL)
+        {
+            next = LIST_NEXT(source, chain);
+            if(source_idle(source, now))
+            {
+                source_free(shard, source);
+            }
+            source = next;
+        }
+    }
+
+    shard->reclaim_at = (shard->sources * 2 > ADMISSION_RECLAIM_MIN) ? shard->sources * 2 : ADMISSION_RECLAIM_MIN;
+}
+
+int admission_acquire(const struct sockaddr *addr, admission_source_t **source)
+{
+    admission_shard_t *shard;
+    admission_source_t *entry;
+    uint8_t key[16] = { 0 };
+    uint32_t hash;
+    uint64_t now;
+    int ret_status = SUCCESS;
+
+    *source = NULL;
+    if(!admission_enabled())
+    {
+        return SUCCESS;
+    }
+    pthread_once(&shards_once, shards_init);
+
+    if(addr->sa_family == AF_INET)
+    {
+        memcpy(key, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+    }
+    else
+    {
+        memcpy(key, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+    }
+    hash = source_hash(addr->sa_family, key);
+    shard = source_shard(hash);
+    now = stats_now();
+
+    pthread_mutex_lock(&shard->mutex);
+    LIST_FOREACH(entry, &shard->buckets[(hash / ADMISSION_SHARDS) & (ADMISSION_BUCKETS - 1)], chain)
+    {
+        if((entry->hash == hash) && (entry->family == addr->sa_family) &&
+           (memcmp(entry->addr, key, sizeof(key)) == 0))
+        {
+            break;
+        }
+    }
+
+    if(entry == NULL)
+    {
+        if(shard->sources >= shard->reclaim_at)
+        {
+            shard_reclaim(shard, now);
+        }
+
+        entry = calloc(1, sizeof(admission_source_t));
+        if(entry == NULL)
+        {
+            // Admit untracked rather than turn clients away for our own shortage
+            pthread_mutex_unlock(&shard->mutex);
+            log_msg(LOG_ERR, "Failed to allocate admission entry");
+            return SUCCESS;
+        }
+        entry->family = addr->sa_family;
+        memcpy(entry->addr, key, sizeof(key));
+        entry->hash = hash;
+        entry->record_tokens = s_config.records_per_sec;
+        entry->byte_tokens = s_config.bytes_per_sec;
+        entry->refilled = now;
+        LIST_INSERT_HEAD(&shard->buckets[(hash / ADMISSION_SHARDS) & (ADMISSION_BUCKETS - 1)], entry, chain);
+        shard->sources++;
+    }
+
+    if((s_config.max_conns_per_ip > 0) && (entry->conns >= s_config.max_conns_per_ip))
+    {
+        ret_status = ERROR;
+    }
+    else
+    {
+        entry->conns++;
+        *source = entry;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if(ret_status == ERROR)
+    {
+        source_log("Connection limit reached", addr->sa_family, key);
+        stats_add(STAT_CONN_REJECTED, 1);
+    }
+    return ret_status;
+}
+
+int admission_charge(admission_source_t *source, size_t records, size_t bytes)
+{
+    admission_shard_t *shard;
+    int ret_status = SUCCESS;
+
+    if(source == NULL)
+    {
+        return SUCCESS;
+    }
+    shard = source_shard(source->hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    source_refill(source, stats_now());
+    if(((s_config.records_per_sec > 0) && (records > 0) && (source->record_tokens <= 0)) ||
+       ((s_config.bytes_per_sec > 0) && (source->byte_tokens <= 0)))
+    {
+        ret_status = ERROR;
+    }
+    else
+    {
+        if(s_config.records_per_sec > 0)
+        {
+            source->record_tokens -= records;
+        }
+        if(s_config.bytes_per_sec > 0)
+        {
+            source->byte_tokens -= bytes;
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if(ret_status == ERROR)
+    {
+        source_log("Rate limit exceeded", source->family, source->addr);
+        stats_add(STAT_RECORDS_THROTTLED, 1);
+    }
+    return ret_status;
+}
+
+void admission_release(admission_source_t *source)
+{
+    admission_shard_t *shard;
+
+    if(source == NULL)
+    {
+        return;
+    }
+    shard = source_shard(source->hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    source->conns--;
+    if(source_idle(source, stats_now()))
+    {
+        source_free(shard, source);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
@@ -0,0 +1,76 @@
+/****************************************************************
+ * @file      		aesdsocket-admission.h
+ * @brief		    Per source address admission control and rate limits
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_ADMISSION_H
+#define AESDSOCKET_ADMISSION_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+// Independently locked parts of the source table, a power of two
+#define ADMISSION_SHARDS            (64)
+// Hash chains per shard, a power of two
+#define ADMISSION_BUCKETS           (64)
+// A shard looks for idle sources to drop once it tracks this many
+#define ADMISSION_RECLAIM_MIN       (64)
+
+/**
+ * @struct admission_source
+ * @brief Connections and token buckets of one peer address.
+ *
+ * Every field is protected by the lock of the shard the address hashes to.
+ */
+typedef struct admission_source
+{
+    sa_family_t family;         /**< AF_INET or AF_INET6 */
+    uint8_t addr[16];           /**< Address bytes, IPv4 in the first four */
+    uint32_t hash;              /**< Hash of family and addr */
+    int conns;                  /**< Open connections from this address */
+    double record_tokens;       /**< Records that may still be appended, may go negative */
+    double byte_tokens;         /**< Bytes that may still be appended, may go negative */
+    uint64_t refilled;          /**< stats_now() of the last refill */
+
+    LIST_ENTRY(admission_source) chain;
+} admission_source_t;
+
+/**
+ * @brief Admits a new connection from addr.
+ *
+ * With no per-address limit configured (-c, -r, -B) nothing is tracked
+ * and *source is set to NULL.
+ *
+ * @param addr Peer address returned by accept().
+ * @param[out] source Handle to pass to admission_charge() and
+ *        admission_release().
+ * @return SUCCESS, or ERROR if the address already has the maximum
+ *         number of connections open; the connection must then be closed.
+ */
+int admission_acquire(const struct sockaddr *addr, admission_source_t **source);
+
+/**
+ * @brief Takes records and bytes from the address' token buckets.
+ *
+ * Buckets hold one second of their rate and may go into debt, so a record
+ * larger than the burst still passes once the bucket has refilled.
+ *
+ * @param source Handle from admission_acquire(), NULL when untracked.
+ * @param records Records being appended.
+ * @param bytes Bytes being appended.
+ * @return SUCCESS, or ERROR if the address is over a rate limit and the
+ *         append must be refused.
+ */
+int admission_charge(admission_source_t *source, size_t records, size_t bytes);
+
+/**
+ * @brief Releases a connection admitted by admission_acquire().
+ *
+ * @param source Handle from admission_acquire(), NULL when untracked.
+ */
+void admission_release(admission_source_t *source);
+
+#endif // AESDSOCKET_ADMISSION_H
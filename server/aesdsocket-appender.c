@@ -0,0 +1,504 @@
+/***********************************************************************
+ * @file      		aesdsocket-appender.c
+ * @version   		0.1
+ * @brief		    Group-commit appender thread for the data store
+ *
+ * Every client used to take the global lock and write() its own chunk,
+ * so N concurrent packets meant N lock handoffs and N syscalls, and two
+ * clients' chunks could interleave in the store. Clients now queue their
+ * whole record on a lock-free MPSC queue and sleep. A single appender
+ * thread drains everything that is pending, commits it with one writev()
+ * under one write lock, mirrors it into the history, and then releases
+ * each waiting client.
+ *
+ * Event loops cannot sleep: a sleeping loop stalls every connection it
+ * owns. They queue with appender_submit_async() instead, and the thread
+ * hands each committed request back on the loop's completion list and
+ * signals its eventfd, which the loop waits on next to its sockets.
+ *
+ * Syncs are coalesced the same way. With -D strict the thread runs one
+ * sync for the whole batch before it releases the batch's writers, so
+ * an acknowledged record is durable. With -D interval writers are
+ * released at once and the thread syncs whatever was appended since the
+ * last sync every sync_interval_ms, so at most that much acknowledged
+ * data is lost on power failure.
+ *
+ * The queue is the intrusive MPSC design by Dmitry Vyukov: producers
+ * only do an atomic exchange on the head, the consumer walks from the
+ * tail without any atomic read-modify-write.
+ *
+ * @reference
+ *
+ * 1. https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include "aesdsocket-appender.h"
+#include "aesdsocket-history.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct appender_t
+ * @brief Queue and thread state of the appender.
+ */
+typedef struct
+{
+    _Atomic(append_request_t *) head;   /**< Last queued request, swapped by producers */
+    append_request_t *tail;             /**< Next request to dequeue, consumer only */
+    append_request_t stub;              /**< Placeholder keeping the queue non-empty */
+    sem_t wakeup;                       /**< Posted once per queued request */
+    pthread_t threadId;                 /**< Appender thread */
+    store_backend_t *backend;           /**< Store the records go to */
+    durability_t durability;            /**< When batches are synced */
+    long interval_ms;                   /**< Sync period for DURABILITY_INTERVAL */
+    bool dirty;                         /**< Appended since the last sync, appender thread only */
+    uint64_t last_sync;                 /**< stats_now() of the last sync, appender thread only */
+    atomic_bool running;                /**< Records go through the queue */
+    atomic_bool stopping;               /**< Thread should exit once drained */
+    atomic_int submitters;              /**< appender_submit() calls past their running check */
+} appender_t;
+
+/****************   Global Variables     ***************/
+static appender_t appender;
+
+static void queue_push(append_request_t *req)
+{
+    append_request_t *prev;
+
+    atomic_store_explicit(&req->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&appender.head, req, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, req, memory_order_release);
+}
+
+/**
+ * @brief Dequeues the oldest request.
+ *
+ * @return The request, or NULL if the queue is empty or a producer is
+ *         half way through a push (its wakeup post is still to come).
+ */
+static append_request_t *queue_pop(void)
+{
+    append_request_t *tail = appender.tail;
+    append_request_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if(tail == &appender.stub)
+    {
+        if(next == NULL)
+        {
+            return NULL;
+        }
+        appender.tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if(next != NULL)
+    {
+        appender.tail = next;
+        return tail;
+    }
+
+    if(tail != atomic_load_explicit(&appender.head, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    // tail is the last request; put the stub behind it so it can be taken
+    queue_push(&appender.stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(next != NULL)
+    {
+        appender.tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Syncs everything appended so far with one backend->sync().
+ */
+static void appender_sync(void)
+{
+    uint64_t start = stats_now();
+
+    if(appender.backend->sync() == ERROR)
+    {
+        log_msg(LOG_ERR, "Sync of appended batch failed");
+    }
+    stats_add(STAT_SYNCS, 1);
+    stats_record(STAT_PHASE_SYNC, start);
+    appender.dirty = false;
+    appender.last_sync = stats_now();
+}
+
+/**
+ * @brief Puts a committed asynchronous request on its completion list,
+ *        signalling the list's owner when it was empty.
+ */
+static void appender_complete(append_request_t *req)
+{
+    append_completion_t *completion = req->completion;
+    append_request_t *prev = atomic_load_explicit(&completion->completed, memory_order_relaxed);
+
+    do
+    {
+        req->completed_next = prev;
+    } while(!atomic_compare_exchange_weak_explicit(&completion->completed, &prev, req,
+                                                   memory_order_release, memory_order_relaxed));
+
+    // A non-empty list has been signalled already and not taken yet
+    if((prev == NULL) && (eventfd_write(completion->eventFd, 1) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to signal append completion: %s", strerror(errno));
+    }
+    atomic_fetch_sub(&appender.submitters, 1);
+    atomic_fetch_sub_explicit(&completion->outstanding, 1, memory_order_release);
+}
+
+/**
+ * @brief Appends a batch of records in one call and mirrors them.
+ *
+ * Short appends are resumed where they stopped; the aesdchar driver ends
+ * every write at the first newline, so a record holding several lines
+ * takes several rounds.
+ *
+ * @param batch Requests to commit, in queue order.
+ * @param count Number of requests in batch.
+ */
+static void appender_commit(append_request_t **batch, int count)
+{
+    struct iovec iov[APPENDER_MAX_BATCH];
+    bool mirror_stale = false;
+    size_t first_done = 0;
+    size_t chunk;
+    ssize_t written;
+    int first = 0;
+    int i;
+
+    for(i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)batch[i]->buf;
+        iov[i].iov_len = batch[i]->len;
+        batch[i]->result = 0;
+    }
+
+    pthread_rwlock_wrlock(&lock);
+    while(first < count)
+    {
+        iov[first].iov_base = (void *)(batch[first]->buf + first_done);
+        iov[first].iov_len = batch[first]->len - first_done;
+
+        written = appender.backend->append(&iov[first], count - first);
+        if((written == ERROR) && (errno == EINTR))
+        {
+            continue;
+        }
+        if(written <= 0)
+        {
+            // Every record from first on is incomplete, including one cut off part way
+            log_msg(LOG_ERR, "Unsuccessful file write operation");
+            for(i = first; i < count; i++)
+            {
+                batch[i]->result = ERROR;
+            }
+            break;
+        }
+
+        // Hand the written bytes out to the records they belong to, in order
+        while(written > 0)
+        {
+            chunk = batch[first]->len - first_done;
+            if((size_t)written < chunk)
+            {
+                chunk = written;
+            }
+            if(history_append(batch[first]->buf + first_done, chunk) == ERROR)
+            {
+                mirror_stale = true;
+            }
+            batch[first]->result += chunk;
+            first_done += chunk;
+            written -= chunk;
+            if(first_done == batch[first]->len)
+            {
+                first++;
+                first_done = 0;
+            }
+        }
+    }
+
+    // The store has bytes the mirror missed; resync from the store
+    if(mirror_stale)
+    {
+        history_load(appender.backend);
+    }
+    else if(appender.backend->retention)
+    {
+        history_trim(appender.backend->length());
+    }
+    pthread_rwlock_unlock(&lock);
+
+    appender.dirty = true;
+    if(appender.durability == DURABILITY_STRICT)
+    {
+        appender_sync();
+    }
+
+    // The request lives on its submitter's stack or connection; handing it back is the last access
+    for(i = 0; i < count; i++)
+    {
+        if(batch[i]->completion == NULL)
+        {
+            sem_post(&batch[i]->done);
+        }
+        else
+        {
+            appender_complete(batch[i]);
+        }
+    }
+}
+
+/**
+ * @brief Commits queued requests in batches until none are left.
+ */
+static void appender_drain(void)
+{
+    append_request_t *batch[APPENDER_MAX_BATCH];
+    append_request_t *req;
+    int count;
+
+    do
+    {
+        count = 0;
+        while((count < APPENDER_MAX_BATCH) && ((req = queue_pop()) != NULL))
+        {
+            batch[count++] = req;
+        }
+        if(count > 0)
+        {
+            appender_commit(batch, count);
+        }
+    } while(count == APPENDER_MAX_BATCH);
+}
+
+/**
+ * @brief Appender thread body.
+ */
+static void *appender_loop(void *arg)
+{
+    struct timespec deadline;
+    uint64_t due;
+    uint64_t now;
+    int ret;
+
+    (void)arg;
+
+    while(!atomic_load(&appender.stopping))
+    {
+        if((appender.durability == DURABILITY_INTERVAL) && appender.dirty)
+        {
+            // Sleep no longer than the pending sync is due; a timeout falls through to it
+            due = appender.last_sync + (uint64_t)appender.interval_ms * 1000000ULL;
+            now = stats_now();
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            if(due > now)
+            {
+                deadline.tv_sec += (due - now) / 1000000000ULL;
+                deadline.tv_nsec += (due - now) % 1000000000ULL;
+                if(deadline.tv_nsec >= 1000000000L)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+            }
+            ret = sem_timedwait(&appender.wakeup, &deadline);
+        }
+        else
+        {
+            ret = sem_wait(&appender.wakeup);
+        }
+        if((ret == ERROR) && (errno == EINTR))
+        {
+            continue;
+        }
+        appender_drain();
+
+        if((appender.durability == DURABILITY_INTERVAL) && appender.dirty &&
+           (stats_now() - appender.last_sync >= (uint64_t)appender.interval_ms * 1000000ULL))
+        {
+            appender_sync();
+        }
+    }
+
+    return NULL;
+}
+
+int appender_start(store_backend_t *backend, durability_t durability, long interval_ms)
+{
+    atomic_store(&appender.stub.next, NULL);
+    atomic_store(&appender.head, &appender.stub);
+    appender.tail = &appender.stub;
+    appender.backend = backend;
+    appender.durability = durability;
+    appender.interval_ms = interval_ms;
+    appender.dirty = false;
+    appender.last_sync = stats_now();
+    atomic_store(&appender.stopping, false);
+
+    if(sem_init(&appender.wakeup, 0, 0) == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to create appender semaphore");
+        return ERROR;
+    }
+
+    if(pthread_create(&appender.threadId, NULL, appender_loop, NULL) != 0)
+    {
+        log_msg(LOG_ERR, "Failed to create appender thread");
+        sem_destroy(&appender.wakeup);
+        return ERROR;
+    }
+
+    atomic_store(&appender.running, true);
+    return SUCCESS;
+}
+
+void appender_stop(void)
+{
+    if(!atomic_exchange(&appender.running, false))
+    {
+        return;
+    }
+
+    atomic_store(&appender.stopping, true);
+    sem_post(&appender.wakeup);
+    pthread_join(appender.threadId, NULL);
+
+    // Anything queued while the thread was exiting, including by submitters
+    // that passed their running check just before it was cleared, and the
+    // interval not yet synced
+    appender_drain();
+    while(atomic_load(&appender.submitters) > 0)
+    {
+        sched_yield();
+        appender_drain();
+    }
+    if((appender.durability != DURABILITY_NONE) && appender.dirty)
+    {
+        appender_sync();
+    }
+    sem_destroy(&appender.wakeup);
+}
+
+bool appender_running(void)
+{
+    return atomic_load(&appender.running);
+}
+
+ssize_t appender_submit(const void *buf, size_t len)
+{
+    append_request_t req;
+    int ret;
+
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    // Counted before the check, so appender_stop() either sees this
+    // submitter and waits for its record, or this sees the stop
+    atomic_fetch_add(&appender.submitters, 1);
+    if(!atomic_load(&appender.running))
+    {
+        atomic_fetch_sub(&appender.submitters, 1);
+        return ERROR;
+    }
+
+    req.buf = buf;
+    req.len = len;
+    req.result = ERROR;
+    req.completion = NULL;
+    if(sem_init(&req.done, 0, 0) == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to create append completion");
+        atomic_fetch_sub(&appender.submitters, 1);
+        return ERROR;
+    }
+
+    queue_push(&req);
+    sem_post(&appender.wakeup);
+
+    do
+    {
+        ret = sem_wait(&req.done);
+    } while((ret == ERROR) && (errno == EINTR));
+    sem_destroy(&req.done);
+    atomic_fetch_sub(&appender.submitters, 1);
+
+    return req.result;
+}
+
+int appender_submit_async(append_request_t *req, const void *buf, size_t len)
+{
+    // Counted as in appender_submit(); appender_complete() drops it
+    atomic_fetch_add(&appender.submitters, 1);
+    if(!atomic_load(&appender.running))
+    {
+        atomic_fetch_sub(&appender.submitters, 1);
+        return ERROR;
+    }
+
+    req->buf = buf;
+    req->len = len;
+    req->result = ERROR;
+    atomic_fetch_add(&req->completion->outstanding, 1);
+
+    queue_push(req);
+    sem_post(&appender.wakeup);
+    return SUCCESS;
+}
+
+int appender_completion_init(append_completion_t *completion)
+{
+    atomic_init(&completion->completed, NULL);
+    atomic_init(&completion->outstanding, 0);
+    completion->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(completion->eventFd == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to create append completion event");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+void appender_completion_destroy(append_completion_t *completion)
+{
+    struct pollfd pfd = { .fd = completion->eventFd, .events = POLLIN };
+
+    if(completion->eventFd == ERROR)
+    {
+        return;
+    }
+
+    // The appender may still be writing the eventfd after the last request went on the list
+    while(atomic_load_explicit(&completion->outstanding, memory_order_acquire) > 0)
+    {
+        poll(&pfd, 1, APPENDER_COMPLETION_POLL_MS);
+        appender_completion_take(completion);
+    }
+    appender_completion_take(completion);
+    close(completion->eventFd);
+    completion->eventFd = ERROR;
+}
+
+append_request_t *appender_completion_take(append_completion_t *completion)
+{
+    eventfd_t count;
+
+    // Reset before taking: a request pushed after the exchange signals again
+    eventfd_read(completion->eventFd, &count);
+    return atomic_exchange_explicit(&completion->completed, NULL, memory_order_acquire);
+}
@@ -0,0 +1,131 @@
+/****************************************************************
+ * @file      		aesdsocket-appender.h
+ * @brief		    Group-commit appender thread for the data store
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_APPENDER_H
+#define AESDSOCKET_APPENDER_H
+
+/****************   Includes    ***************/
+#include <stdatomic.h>
+#include <stdint.h>
+#include <semaphore.h>
+#include "aesdsocket.h"
+#include "aesdsocket-backend.h"
+
+/****************   Macros     ***************/
+
+// Records committed by a single writev()
+#define APPENDER_MAX_BATCH      (256)
+
+// How often appender_completion_destroy() looks again for the appender to finish
+#define APPENDER_COMPLETION_POLL_MS  (10)
+
+struct append_completion;
+
+/**
+ * @struct append_request_t
+ * @brief One record waiting to be committed, owned by the submitting thread.
+ */
+typedef struct append_request
+{
+    _Atomic(struct append_request *) next;  /**< MPSC queue link */
+    const char *buf;                        /**< Record bytes */
+    size_t len;                             /**< Record length */
+    ssize_t result;                         /**< Bytes committed, or ERROR */
+    uint64_t start;                         /**< stats_now() at submission */
+    struct append_completion *completion;   /**< Event loop it is handed back to, NULL to post done */
+    struct append_request *completed_next;  /**< Link in the completion's list */
+    sem_t done;                             /**< Posted once the record is visible (or durable) */
+} append_request_t;
+
+/**
+ * @struct append_completion_t
+ * @brief Hands committed requests back to an event loop, which must not
+ *        sleep until its records are in.
+ */
+typedef struct append_completion
+{
+    _Atomic(append_request_t *) completed;  /**< Committed requests, pushed by the appender thread */
+    int eventFd;                            /**< Readable once completed has requests */
+    atomic_int outstanding;                 /**< Submitted requests the appender is not done with */
+} append_completion_t;
+
+/**
+ * @brief Starts the appender thread that commits records to the store.
+ *
+ * @param backend Open store backend.
+ * @param durability When to sync appended batches; anything but
+ *        DURABILITY_NONE needs backend->sync.
+ * @param interval_ms Sync period for DURABILITY_INTERVAL.
+ * @return SUCCESS or ERROR.
+ */
+int appender_start(store_backend_t *backend, durability_t durability, long interval_ms);
+
+/**
+ * @brief Commits whatever is still queued and stops the appender thread.
+ *
+ * A submitter already past its running check is waited for; later ones
+ * are rejected.
+ */
+void appender_stop(void);
+
+/**
+ * @brief Reports whether records are currently routed through the appender.
+ */
+bool appender_running(void);
+
+/**
+ * @brief Queues a record and waits until its batch has been committed.
+ *
+ * The record is written contiguously and mirrored into the history under
+ * the global lock, together with every other record in the same batch.
+ *
+ * @param buf Record bytes.
+ * @param len Record length.
+ * @return Bytes committed, or ERROR if the record did not go in whole
+ *         or the appender has been stopped.
+ */
+ssize_t appender_submit(const void *buf, size_t len);
+
+/**
+ * @brief Queues a record without waiting for it.
+ *
+ * Once the batch holding it has been committed (and synced with -D
+ * strict) the request is put on req->completion and its eventFd is
+ * signalled; appender_completion_take() hands it back.
+ *
+ * @param req Request to queue, with completion set; it and buf must stay
+ *        valid until the request is handed back.
+ * @param buf Record bytes.
+ * @param len Record length, not 0.
+ * @return SUCCESS, or ERROR if the appender has been stopped and nothing
+ *         was queued.
+ */
+int appender_submit_async(append_request_t *req, const void *buf, size_t len);
+
+/**
+ * @brief Sets up a completion list for an event loop.
+ *
+ * @return SUCCESS or ERROR.
+ */
+int appender_completion_init(append_completion_t *completion);
+
+/**
+ * @brief Waits for the appender to be done with every request queued on
+ *        completion, drops them, and closes its eventFd.
+ */
+void appender_completion_destroy(append_completion_t *completion);
+
+/**
+ * @brief Takes every committed request off the list.
+ *
+ * Read completed_next before handing a request back to its owner, which
+ * may queue it again.
+ *
+ * @return The requests linked through completed_next, or NULL.
+ */
+append_request_t *appender_completion_take(append_completion_t *completion);
+
+#endif // AESDSOCKET_APPENDER_H
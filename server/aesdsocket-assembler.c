@@ -0,0 +1,203 @@
+/***********************************************************************
+ * @file      		aesdsocket-assembler.c
+ * @version   		0.1
+ * @brief		    Line assembler and size-class buffer pool
+ *
+ * Connections used to push every received chunk to the store as soon as
+ * it arrived, so a 1 MB packet became a thousand small appends. The
+ * assembler keeps the bytes until the newline shows up and the caller
+ * commits the whole record in one append.
+ *
+ * Buffers come from power-of-two size classes between POOL_MIN_BUFFER and
+ * POOL_MAX_BUFFER. Released buffers are kept on a per-class free list
+ * (the list link lives in the buffer itself) up to POOL_CLASS_CACHE_BYTES
+ * per class, so steady traffic reuses memory instead of calling malloc.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include "aesdsocket-assembler.h"
+#include "aesdsocket-log.h"
+
+/****************   Macros     ***************/
+#define POOL_CLASS_COUNT    (11)    /* 1 KB .. 1 MB */
+
+/**
+ * @struct pool_buffer
+ * @brief Free list link stored at the start of an idle buffer.
+ */
+struct pool_buffer
+{
+    SLIST_ENTRY(pool_buffer) entries;
+};
+
+/**
+ * @struct pool_class_t
+ * @brief Free list of idle buffers of one size.
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    size_t cached;
+    SLIST_HEAD(pool_list, pool_buffer) free_list;
+} pool_class_t;
+
+static pool_class_t pool_classes[POOL_CLASS_COUNT] = {
+    [0 ... POOL_CLASS_COUNT - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER }
+};
+
+/**
+ * @brief Maps a requested size to its size class.
+ *
+ * @return Class index, or POOL_CLASS_COUNT if the size is not pooled.
+ */
+static int pool_class_index(size_t size, size_t *class_size)
+{
+    size_t candidate = POOL_MIN_BUFFER;
+    int index = 0;
+
+    while((candidate < size) && (index < POOL_CLASS_COUNT))
+    {
+        candidate <<= 1;
+        index++;
+    }
+    *class_size = (index < POOL_CLASS_COUNT) ? candidate : size;
+    return index;
+}
+
+char *buffer_pool_get(size_t size, size_t *cap)
+{
+    pool_class_t *pool_class;
+    struct pool_buffer *buffer = NULL;
+    int index = pool_class_index(size, cap);
+
+    if(index < POOL_CLASS_COUNT)
+    {
+        pool_class = &pool_classes[index];
+        pthread_mutex_lock(&pool_class->mutex);
+        buffer = SLIST_FIRST(&pool_class->free_list);
+        if(buffer != NULL)
+        {
+            SLIST_REMOVE_HEAD(&pool_class->free_list, entries);
+            pool_class->cached--;
+        }
+        pthread_mutex_unlock(&pool_class->mutex);
+    }
+
+    if(buffer == NULL)
+    {
+        buffer = malloc(*cap);
+    }
+    return (char *)buffer;
+}
+
+void buffer_pool_put(char *buf, size_t cap)
+{
+    pool_class_t *pool_class;
+    struct pool_buffer *buffer = (struct pool_buffer *)buf;
+    size_t class_size;
+    int index;
+
+    if(buf == NULL)
+    {
+        return;
+    }
+
+    index = pool_class_index(cap, &class_size);
+    if((index < POOL_CLASS_COUNT) && (class_size == cap))
+    {
+        pool_class = &pool_classes[index];
+        pthread_mutex_lock(&pool_class->mutex);
+        if((pool_class->cached == 0) || ((pool_class->cached + 1) * cap <= POOL_CLASS_CACHE_BYTES))
+        {
+            SLIST_INSERT_HEAD(&pool_class->free_list, buffer, entries);
+            pool_class->cached++;
+            buffer = NULL;
+        }
+        pthread_mutex_unlock(&pool_class->mutex);
+    }
+
+    free(buffer);
+}
+
+void assembler_init(line_assembler_t *asmb)
+{
+    memset(asmb, 0, sizeof(*asmb));
+}
+
+int assembler_reserve(line_assembler_t *asmb, size_t min_free)
+{
+    size_t new_cap;
+    char *new_buf;
+
+    if(asmb->cap - asmb->len >= min_free)
+    {
+        return SUCCESS;
+    }
+
+    // Grow geometrically so an N byte record costs O(log N) copies
+    new_cap = (asmb->cap > 0) ? asmb->cap * 2 : POOL_MIN_BUFFER;
+    while(new_cap - asmb->len < min_free)
+    {
+        new_cap *= 2;
+    }
+
+    new_buf = buffer_pool_get(new_cap, &new_cap);
+    if(new_buf == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to grow receive buffer to %zu bytes", new_cap);
+        return ERROR;
+    }
+
+    if(asmb->len > 0)
+    {
+        memcpy(new_buf, asmb->buf, asmb->len);
+    }
+    buffer_pool_put(asmb->buf, asmb->cap);
+    asmb->buf = new_buf;
+    asmb->cap = new_cap;
+    return SUCCESS;
+}
+
+void assembler_commit(line_assembler_t *asmb, size_t count)
+{
+    asmb->len += count;
+}
+
+size_t assembler_record_length(line_assembler_t *asmb)
+{
+    char *newline;
+
+    if(asmb->scanned >= asmb->len)
+    {
+        return 0;
+    }
+
+    newline = memchr(asmb->buf + asmb->scanned, '\n', asmb->len - asmb->scanned);
+    if(newline == NULL)
+    {
+        asmb->scanned = asmb->len;
+        return 0;
+    }
+
+    asmb->scanned = newline - asmb->buf;
+    return asmb->scanned + 1;
+}
+
+void assembler_consume(line_assembler_t *asmb, size_t count)
+{
+    if(count >= asmb->len)
+    {
+        asmb->len = 0;
+    }
+    else
+    {
+        memmove(asmb->buf, asmb->buf + count, asmb->len - count);
+        asmb->len -= count;
+    }
+    asmb->scanned = 0;
+}
+
+void assembler_release(line_assembler_t *asmb)
+{
+    buffer_pool_put(asmb->buf, asmb->cap);
+    assembler_init(asmb);
+}
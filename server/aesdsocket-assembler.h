@@ -0,0 +1,91 @@
+/****************************************************************
+ * @file      		aesdsocket-assembler.h
+ * @brief		    Per-connection record assembly on pooled buffers
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_ASSEMBLER_H
+#define AESDSOCKET_ASSEMBLER_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+// Smallest and largest pooled buffer; larger requests bypass the pool
+#define POOL_MIN_BUFFER         (BUF_LEN)
+#define POOL_MAX_BUFFER         (1024 * 1024)
+// Cached bytes per size class before buffers go back to malloc
+#define POOL_CLASS_CACHE_BYTES  (256 * 1024)
+
+// A record without newline is flushed to the store once it reaches this size
+#define ASSEMBLER_MAX_PENDING   (16 * 1024 * 1024)
+
+/**
+ * @struct line_assembler_t
+ * @brief Growable receive buffer that gathers one newline-terminated record.
+ *
+ * Data is received straight into the free space at the end of buf.
+ * Capacity doubles on demand and every buffer comes from, and returns to,
+ * the shared buffer pool.
+ */
+typedef struct
+{
+    char *buf;              /**< Pooled storage, NULL until first use */
+    size_t len;             /**< Bytes currently buffered */
+    size_t cap;             /**< Capacity of buf */
+    size_t scanned;         /**< Prefix of buf already known to hold no newline */
+} line_assembler_t;
+
+/**
+ * @brief Takes a buffer of at least size bytes from the pool.
+ *
+ * @param size Minimum capacity needed.
+ * @param[out] cap Actual capacity of the returned buffer.
+ * @return Buffer, or NULL on allocation failure.
+ */
+char *buffer_pool_get(size_t size, size_t *cap);
+
+/**
+ * @brief Returns a buffer obtained from buffer_pool_get().
+ *
+ * @param buf Buffer to recycle.
+ * @param cap Capacity reported when it was taken.
+ */
+void buffer_pool_put(char *buf, size_t cap);
+
+/**
+ * @brief Initializes an empty assembler; no memory is taken yet.
+ */
+void assembler_init(line_assembler_t *asmb);
+
+/**
+ * @brief Makes sure at least min_free bytes are free at the end of the buffer.
+ *
+ * @return SUCCESS or ERROR if the buffer could not grow.
+ */
+int assembler_reserve(line_assembler_t *asmb, size_t min_free);
+
+/**
+ * @brief Records that count bytes were written into the free space.
+ */
+void assembler_commit(line_assembler_t *asmb, size_t count);
+
+/**
+ * @brief Finds the first complete record, scanning only bytes not seen before.
+ *
+ * @return Length of the record including its newline, or 0 if none yet.
+ */
+size_t assembler_record_length(line_assembler_t *asmb);
+
+/**
+ * @brief Drops the first count bytes and keeps whatever follows them.
+ */
+void assembler_consume(line_assembler_t *asmb, size_t count);
+
+/**
+ * @brief Returns the buffer to the pool and resets the assembler.
+ */
+void assembler_release(line_assembler_t *asmb);
+
+#endif // AESDSOCKET_ASSEMBLER_H
@@ -0,0 +1,239 @@
+/***********************************************************************
+ * @file      		aesdsocket-backend.c
+ * @version   		0.1
+ * @brief		    Descriptor backed storage: the aesdchar device and a flat file
+ *
+ * Which store the server wrote to used to be fixed at build time by
+ * USE_AESD_CHAR_DEVICE. The store now goes through a store_backend_t
+ * picked with -s, so backends can be compared without rebuilding;
+ * USE_AESD_CHAR_DEVICE only selects the default.
+ *
+ * chardev: CHARDEV_PATH, the aesdchar driver. It keeps the last
+ *          AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED newline-terminated
+ *          writes and resolves seeks with its AESDCHAR_IOCSEEKTO ioctl.
+ * file:    DATA_FILE_PATH, appended forever and deleted on exit. Seeks
+ *          look records up in the INDEX_FILE_PATH sidecar, see
+ *          aesdsocket-index.c.
+ * ring:    in memory, see aesdsocket-ring.c.
+ * segments: mmap'd segment files with retention, see aesdsocket-segment.c.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <errno.h>
+#include <sys/ioctl.h>
+#include "aesdsocket-backend.h"
+#include "aesdsocket-index.h"
+#include "aesdsocket-ring.h"
+#include "aesdsocket-segment.h"
+#include "aesdsocket-log.h"
+
+/****************   Global Variables     ***************/
+// Descriptor of the open chardev or file store
+static int store_fd = ERROR;
+static store_backend_t chardev_backend;
+
+/**
+ * @brief Opens path for appending and reports whether it is the driver.
+ */
+static int fd_open(const char *path, bool *is_chardev)
+{
+    struct stat file_stat;
+
+    store_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                    S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+    if(store_fd == ERROR)
+    {
+        log_msg(LOG_ERR, "Data file open failed: %s", path);
+        return ERROR;
+    }
+
+    if(fstat(store_fd, &file_stat) == ERROR)
+    {
+        log_msg(LOG_ERR, "Data file stat failed");
+        close(store_fd);
+        store_fd = ERROR;
+        return ERROR;
+    }
+    *is_chardev = S_ISCHR(file_stat.st_mode);
+    return SUCCESS;
+}
+
+static void fd_close(void)
+{
+    if(close(store_fd) == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to close data file.");
+    }
+    store_fd = ERROR;
+}
+
+static ssize_t fd_append(const struct iovec *iov, int iovcnt)
+{
+    return writev(store_fd, iov, iovcnt);
+}
+
+static ssize_t fd_read(void *buf, size_t len, off_t offset)
+{
+    return pread(store_fd, buf, len, offset);
+}
+
+static off_t fd_length(void)
+{
+    return lseek(store_fd, 0, SEEK_END);
+}
+
+static int fd_sync(void)
+{
+    return fdatasync(store_fd);
+}
+
+static int chardev_open(size_t capacity, size_t records)
+{
+    bool is_chardev;
+
+    (void)capacity;
+    (void)records;
+    if(fd_open(CHARDEV_PATH, &is_chardev) == ERROR)
+    {
+        return ERROR;
+    }
+    // Without the module loaded this is a plain file that only grows
+    chardev_backend.bounded = is_chardev;
+    return SUCCESS;
+}
+
+static void chardev_close(bool remove)
+{
+    (void)remove;
+    fd_close();
+}
+
+/**
+ * @brief Resolves the seek with the driver's ioctl, which moves the file position.
+ */
+static int chardev_seek(const struct aesd_seekto *seekto, off_t *offset)
+{
+    if(ioctl(store_fd, AESDCHAR_IOCSEEKTO, seekto) != 0)
+    {
+        log_msg(LOG_ERR, "ioctl failed");
+        return ERROR;
+    }
+    *offset = lseek(store_fd, 0, SEEK_CUR);
+    return (*offset == ERROR) ? ERROR : SUCCESS;
+}
+
+/**
+ * @brief fdatasync() means nothing for the driver, which keeps entries in memory.
+ */
+static int chardev_sync(void)
+{
+    return chardev_backend.bounded ? SUCCESS : fd_sync();
+}
+
+static int file_open(size_t capacity, size_t records)
+{
+    bool is_chardev;
+
+    (void)capacity;
+    (void)records;
+    if(fd_open(DATA_FILE_PATH, &is_chardev) == ERROR)
+    {
+        return ERROR;
+    }
+    if(record_index_open(INDEX_FILE_PATH, store_fd) == ERROR)
+    {
+        fd_close();
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+static void file_close(bool remove)
+{
+    record_index_close(remove);
+    fd_close();
+    if(remove && (unlink(DATA_FILE_PATH) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to delete data file.");
+    }
+}
+
+/**
+ * @brief Appends like fd_append() and indexes the records written.
+ */
+static ssize_t file_append(const struct iovec *iov, int iovcnt)
+{
+    ssize_t written = writev(store_fd, iov, iovcnt);
+    off_t end;
+
+    // O_APPEND leaves the file position just past this write, whoever else appends
+    if((written > 0) && ((end = lseek(store_fd, 0, SEEK_CUR)) != ERROR))
+    {
+        record_index_append(iov, written, end);
+    }
+    return written;
+}
+
+/**
+ * @brief Looks the record up in the index, with the driver's bounds: the
+ *        record must be complete and the offset inside it.
+ */
+static int file_seek(const struct aesd_seekto *seekto, off_t *offset)
+{
+    off_t start;
+    off_t end;
+
+    if((record_index_find(seekto->write_cmd, &start, &end) == ERROR) ||
+       (seekto->write_cmd_offset >= end - start))
+    {
+        return ERROR;
+    }
+    *offset = start + seekto->write_cmd_offset;
+    return SUCCESS;
+}
+
+static ssize_t file_record_count(void)
+{
+    return record_index_count();
+}
+
+static store_backend_t chardev_backend = {
+    .name = "chardev",
+    .shared = true,
+    .open = chardev_open,
+    .close = chardev_close,
+    .append = fd_append,
+    .read = fd_read,
+    .seek = chardev_seek,
+    .length = fd_length,
+    .sync = chardev_sync,
+};
+
+static store_backend_t file_backend = {
+    .name = "file",
+    .shared = true,
+    .timestamps = true,
+    .open = file_open,
+    .close = file_close,
+    .append = file_append,
+    .read = fd_read,
+    .seek = file_seek,
+    .length = fd_length,
+    .sync = fd_sync,
+    .record_count = file_record_count,
+};
+
+static store_backend_t *backends[] = { &chardev_backend, &file_backend, &ring_backend, &segment_backend };
+
+store_backend_t *store_backend_find(const char *name)
+{
+    size_t i;
+
+    for(i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if(strcmp(backends[i]->name, name) == 0)
+        {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,101 @@
+/****************************************************************
+ * @file      		aesdsocket-backend.h
+ * @brief		    Storage backends behind the aesdsocket data store
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_BACKEND_H
+#define AESDSOCKET_BACKEND_H
+
+/****************   Includes    ***************/
+#include <sys/uio.h>
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+#define CHARDEV_PATH            "/dev/aesdchar"
+#define DATA_FILE_PATH          "/var/tmp/aesdsocketdata"
+#define INDEX_FILE_PATH         DATA_FILE_PATH ".idx"
+
+/**
+ * @struct store_backend
+ * @brief Operations of one storage backend.
+ *
+ * open and sync are called without the global store lock, record_count
+ * with it held for reading and every other operation with it held for
+ * writing, so a backend needs no locking of its own within the process
+ * as long as record_count only reads.
+ */
+typedef struct store_backend
+{
+    const char *name;           /**< Name selected with -s */
+    bool capacity;              /**< Takes a capacity with -s name:bytes */
+    bool records;               /**< Takes a record retention limit with -n */
+    bool retention;             /**< Drops old bytes by itself; trim the mirror to length() after appends */
+    bool shared;                /**< Other processes may change it; a seek resyncs the mirror if length() moved */
+    bool timestamps;            /**< Receives the periodic timestamp records */
+    bool bounded;               /**< Set by open: keeps only the last entries, like the aesdchar driver */
+
+    /**
+     * @brief Opens the store for the lifetime of the process.
+     * @param capacity Bytes to keep at most, 0 for the backend's own limit.
+     * @param records Records to keep at most, 0 for no limit.
+     * @return SUCCESS or ERROR.
+     */
+    int (*open)(size_t capacity, size_t records);
+
+    /**
+     * @brief Closes the store.
+     * @param remove Delete what it holds; false when a successor takes it over.
+     */
+    void (*close)(bool remove);
+
+    /**
+     * @brief Appends like writev(), possibly short.
+     * @return Bytes accepted or ERROR.
+     */
+    ssize_t (*append)(const struct iovec *iov, int iovcnt);
+
+    /**
+     * @brief Reads visible bytes like pread().
+     * @return Bytes read, 0 at the end, or ERROR.
+     */
+    ssize_t (*read)(void *buf, size_t len, off_t offset);
+
+    /**
+     * @brief Resolves an AESDCHAR_IOCSEEKTO request.
+     * @param[out] offset Byte offset of write_cmd_offset in entry write_cmd.
+     * @return SUCCESS, or ERROR if the request is out of range.
+     */
+    int (*seek)(const struct aesd_seekto *seekto, off_t *offset);
+
+    /**
+     * @brief Bytes currently visible to read.
+     */
+    off_t (*length)(void);
+
+    /**
+     * @brief Makes appended bytes durable; NULL when there is nothing to sync.
+     *
+     * Called by the appender after it released the store lock.
+     * @return SUCCESS or ERROR.
+     */
+    int (*sync)(void);
+
+    /**
+     * @brief Complete records held; NULL when the backend cannot tell cheaply.
+     *
+     * Called with the global store lock held for reading.
+     */
+    ssize_t (*record_count)(void);
+} store_backend_t;
+
+/**
+ * @brief Looks a backend up by name.
+ *
+ * @param name chardev, file, ring or segments.
+ * @return The backend, or NULL if there is none by that name.
+ */
+store_backend_t *store_backend_find(const char *name);
+
+#endif // AESDSOCKET_BACKEND_H
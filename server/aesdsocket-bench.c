@@ -0,0 +1,1076 @@
+/***********************************************************************
+ * @file      		aesdsocket-bench.c
+ * @version   		0.1
+ * @brief		    Load generator for aesdsocket
+ *
+ * Runs a number of concurrent clients against the server for a fixed
+ * time and reports throughput and request latency percentiles as
+ * "key value" lines, the same layout as the statistics report, so runs
+ * against different server modes and stores can be diffed or fed to a
+ * script.
+ *
+ * Each client repeatedly opens a connection and sends records of the
+ * configured size distribution. A single record per connection is sent
+ * with the write side shut down and the reply read to EOF, which works
+ * against every server mode. Several records per connection need the
+ * server to run with -k. The history that answers a record carries no
+ * length, so each record but the last is followed by an
+ * AESDSOCKET_READFROM past the stream end. Its reply is a bare cursor
+ * header line that marks where the history ended, and the record's
+ * unique tag is looked for before it. A bounded store may already have
+ * evicted the record by the time the reply is taken; such replies still
+ * complete the request and are counted as evicted. A share of requests
+ * can be seek commands, sent on their own connection.
+ *
+ * Every read gives up after BENCH_RECV_TIMEOUT_SECS. A timed out request
+ * counts as an error and is reported again as timeouts, so a server that
+ * stops answering shows up instead of hanging the run.
+ *
+ * With -z every connection first asks for LZ4 compressed replies; each
+ * reply is then read frame by frame and decoded, and the report adds the
+ * raw byte count, the compression ratio and the time spent decoding.
+ *
+ * With -b every connection speaks the binary framing instead: records
+ * and seeks go out as length-prefixed frames and each reply is read by
+ * the length in its header, with no tag search and no -k needed. After
+ * the run the server's statistics are fetched and its parse latency is
+ * echoed as server_latency_parse_ns, so text and framed runs against a
+ * freshly started server show the request decoding cost side by side.
+ *
+ * Its sync count and sync latency are echoed the same way, as
+ * server_syncs and server_latency_sync_ns. Next to the request latency
+ * and throughput above them they show what each -D durability mode
+ * costs and how many appends every sync covered.
+ ************************************************************************/
+/****************   Includes    ***************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <endian.h>
+#include "aesdsocket-lz4.h"
+
+/****************   Macros     ***************/
+#define SUCCESS                 (0)
+#define ERROR                   (-1)
+
+#define BENCH_DEFAULT_HOST      "127.0.0.1"
+#define BENCH_DEFAULT_PORT      "9000"
+#define BENCH_MAX_CONNECTIONS   (4096)
+#define BENCH_MAX_RECORD        (1024 * 1024)
+#define BENCH_RECV_BUFFER       (64 * 1024)
+#define BENCH_SEEK_COMMAND      "AESDCHAR_IOCSEEKTO:%u,%u\n"
+#define BENCH_SEEK_ENTRIES      (10)
+#define BENCH_COMPRESS_COMMAND  "AESDSOCKET_COMPRESS:lz4\n"
+#define BENCH_STATS_COMMAND     "AESDSOCKET_STATS\n"
+// Read-from past any stream end: the reply is only the cursor header line
+#define BENCH_READFROM_END      "AESDSOCKET_READFROM:9223372036854775807\n"
+#define BENCH_CURSOR_HEADER     "AESDSOCKET_CURSOR:"
+// A reply that stalls this long fails its request
+#define BENCH_RECV_TIMEOUT_SECS (10)
+// Binary framing, see aesdsocket-frame.h
+#define BENCH_FRAME_MAGIC       (0xAE)
+#define BENCH_FRAME_HEADER      (8)
+#define BENCH_FRAME_REPLY       (0x80)
+#define BENCH_FRAME_APPEND      (1)
+#define BENCH_FRAME_SEEK        (2)
+// Longest record tag, "bench-<pid>-<id>-<seq> "
+#define BENCH_MAX_TAG           (64)
+
+/**
+ * @enum size_dist_t
+ * @brief Shape of the record size distribution.
+ */
+typedef enum
+{
+    SIZE_FIXED,         /**< Every record is size_min bytes */
+    SIZE_UNIFORM,       /**< Uniform between size_min and size_max */
+    SIZE_EXPONENTIAL,   /**< Exponential with mean size_mean */
+} size_dist_t;
+
+/**
+ * @struct bench_config_t
+ * @brief Benchmark parameters taken from the command line.
+ */
+typedef struct
+{
+    const char *host;           /**< Server address */
+    const char *port;           /**< Server port */
+    const char *label;          /**< Free-form run name echoed in the report */
+    int connections;            /**< Concurrent clients */
+    int records_per_conn;       /**< Records sent on each connection */
+    size_dist_t size_dist;      /**< Record size distribution */
+    size_t size_min;            /**< Fixed size, or lower bound */
+    size_t size_max;            /**< Upper bound */
+    double size_mean;           /**< Mean of the exponential distribution */
+    int seek_percent;           /**< Share of requests that are seek commands */
+    double duration_secs;       /**< Run time */
+    bool compress;              /**< Ask for LZ4 compressed replies */
+    bool binary;                /**< Speak length-prefixed frames instead of text lines */
+} bench_config_t;
+
+/**
+ * @struct bench_client_t
+ * @brief State and results of one client thread.
+ */
+typedef struct
+{
+    pthread_t threadId;         /**< Client thread */
+    int id;                     /**< Client number, part of every record tag */
+    unsigned int seed;          /**< rand_r() state */
+    unsigned long sequence;     /**< Records sent so far, part of every record tag */
+    char *record;               /**< Record being sent */
+    char *rx;                   /**< Receive buffer */
+    char *plain;                /**< Decoded frame, after the tail of the previous one */
+    uint64_t *latencies;        /**< Completed request latencies in ns */
+    size_t latency_count;       /**< Entries in latencies */
+    size_t latency_cap;         /**< Capacity of latencies */
+    uint64_t requests;          /**< Completed requests */
+    uint64_t seeks;             /**< Completed seek commands */
+    uint64_t errors;            /**< Failed connections or requests */
+    uint64_t timeouts;          /**< Requests failed by BENCH_RECV_TIMEOUT_SECS, also in errors */
+    uint64_t evicted;           /**< Complete replies that no longer held their record */
+    uint64_t bytes_out;         /**< Bytes sent */
+    uint64_t bytes_in;          /**< Bytes received */
+    uint64_t bytes_raw;         /**< Reply bytes after decoding compressed frames */
+    uint64_t decode_ns;         /**< Time spent decoding compressed frames */
+} bench_client_t;
+
+/****************   Global Variables     ***************/
+static bench_config_t b_config = {
+    .host = BENCH_DEFAULT_HOST,
+    .port = BENCH_DEFAULT_PORT,
+    .label = "",
+    .connections = 8,
+    .records_per_conn = 1,
+    .size_dist = SIZE_FIXED,
+    .size_min = 64,
+    .size_max = 64,
+    .size_mean = 64,
+    .seek_percent = 0,
+    .duration_secs = 10,
+};
+
+static struct addrinfo *server_addr;
+static uint64_t deadline_ns;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * @brief Draws the size of the next record.
+ *
+ * @param tag_len Bytes the tag needs; records are never shorter.
+ */
+static size_t next_record_size(bench_client_t *client, size_t tag_len)
+{
+    double u;
+    size_t size;
+
+    switch(b_config.size_dist)
+    {
+    case SIZE_UNIFORM:
+        size = b_config.size_min + rand_r(&client->seed) % (b_config.size_max - b_config.size_min + 1);
+        break;
+    case SIZE_EXPONENTIAL:
+        u = (rand_r(&client->seed) + 1.0) / ((double)RAND_MAX + 2.0);
+        size = (size_t)(-b_config.size_mean * log(u));
+        break;
+    default:
+        size = b_config.size_min;
+        break;
+    }
+
+    if(size < tag_len + 1)
+    {
+        size = tag_len + 1;
+    }
+    return (size > BENCH_MAX_RECORD) ? BENCH_MAX_RECORD : size;
+}
+
+/**
+ * @brief Fills client->record with the next tagged record.
+ *
+ * @param[out] tag_len Length of the unique tag at the start of the record.
+ * @return Record length including its newline.
+ */
+static size_t build_record(bench_client_t *client, size_t *tag_len)
+{
+    size_t size;
+    int len;
+
+    // The pid keeps tags unique against records left by earlier runs
+    len = snprintf(client->record, BENCH_MAX_RECORD, "bench-%d-%d-%lu ", (int)getpid(), client->id, client->sequence++);
+    *tag_len = len;
+
+    size = next_record_size(client, len);
+    memset(client->record + len, 'x', size - len - 1);
+    client->record[size - 1] = '\n';
+    return size;
+}
+
+static void record_latency(bench_client_t *client, uint64_t start_ns)
+{
+    uint64_t *grown;
+
+    if(client->latency_count == client->latency_cap)
+    {
+        client->latency_cap = (client->latency_cap > 0) ? client->latency_cap * 2 : 4096;
+        grown = realloc(client->latencies, client->latency_cap * sizeof(uint64_t));
+        if(grown == NULL)
+        {
+            client->latency_cap = client->latency_count;
+            return;
+        }
+        client->latencies = grown;
+    }
+    client->latencies[client->latency_count++] = now_ns() - start_ns;
+}
+
+static int connect_server(void)
+{
+    struct timeval timeout = { .tv_sec = BENCH_RECV_TIMEOUT_SECS, .tv_usec = 0 };
+    int fd = socket(server_addr->ai_family, server_addr->ai_socktype, server_addr->ai_protocol);
+
+    if(fd == ERROR)
+    {
+        return ERROR;
+    }
+    if((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == ERROR) ||
+       (connect(fd, server_addr->ai_addr, server_addr->ai_addrlen) == ERROR))
+    {
+        close(fd);
+        return ERROR;
+    }
+    return fd;
+}
+
+static int send_all(bench_client_t *client, int fd, const char *buf, size_t len)
+{
+    ssize_t sent;
+
+    while(len > 0)
+    {
+        sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if((sent == ERROR) && (errno == EINTR))
+        {
+            continue;
+        }
+        if(sent <= 0)
+        {
+            return ERROR;
+        }
+        client->bytes_out += sent;
+        buf += sent;
+        len -= sent;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Receives what is available, up to len bytes.
+ *
+ * @return Bytes received, 0 at EOF, or ERROR, also once the receive
+ *         timeout expired, which is counted in client->timeouts.
+ */
+static ssize_t recv_some(bench_client_t *client, int fd, char *buf, size_t len)
+{
+    ssize_t received;
+
+    // The kernel drops back to delayed ACKs on its own, so ask again every time
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &(int){ 1 }, sizeof(int));
+    do
+    {
+        received = recv(fd, buf, len, 0);
+    } while((received == ERROR) && (errno == EINTR));
+
+    if(received > 0)
+    {
+        client->bytes_in += received;
+    }
+    else if((received == ERROR) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+    {
+        client->timeouts++;
+    }
+    return received;
+}
+
+/**
+ * @brief Reads until the server closes the connection.
+ */
+static int read_to_eof(bench_client_t *client, int fd)
+{
+    ssize_t received;
+
+    while((received = recv_some(client, fd, client->rx, BENCH_RECV_BUFFER)) != 0)
+    {
+        if(received == ERROR)
+        {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Reads exactly len bytes into buf.
+ */
+static int recv_exact(bench_client_t *client, int fd, char *buf, size_t len)
+{
+    ssize_t received;
+
+    while(len > 0)
+    {
+        received = recv_some(client, fd, buf, len);
+        if(received <= 0)
+        {
+            return ERROR;
+        }
+        buf += received;
+        len -= received;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Keeps the last keep bytes of the len buffered ones at the start of rx.
+ *
+ * @return Bytes now buffered.
+ */
+static size_t keep_tail(bench_client_t *client, size_t len, size_t keep)
+{
+    keep = (len < keep) ? len : keep;
+    memmove(client->rx, client->rx + len - keep, keep);
+    return keep;
+}
+
+/**
+ * @brief Reads the reply to a record on a persistent connection, and the
+ *        reply to the BENCH_READFROM_END sent right after it.
+ *
+ * The history reply ends where the cursor header line starts; a reply
+ * without the record's tag before that is counted in client->evicted.
+ * The header's range says how many bytes follow it, none for a cursor
+ * past the end.
+ *
+ * @param tag Unique tag at the start of the record.
+ * @param tag_len Length of tag.
+ */
+static int read_reply(bench_client_t *client, int fd, const char *tag, size_t tag_len)
+{
+    const char *marker = "\n" BENCH_CURSOR_HEADER;
+    size_t marker_len = strlen(marker);
+    // Enough of the tail to match a tag or the marker split across reads
+    size_t carry = ((tag_len > marker_len) ? tag_len : marker_len) - 1;
+    bool found = false;
+    size_t len = 0;
+    size_t after;
+    ssize_t received;
+    long long first;
+    long long next;
+    char *hit;
+    char *eol;
+
+    for(;;)
+    {
+        // One byte stays free to terminate the header line for sscanf()
+        received = recv_some(client, fd, client->rx + len, BENCH_RECV_BUFFER - 1 - len);
+        if(received <= 0)
+        {
+            return ERROR;
+        }
+        len += received;
+
+        hit = memmem(client->rx, len, marker, marker_len);
+        if(!found)
+        {
+            // A tag after the marker belongs to a later record
+            found = (memmem(client->rx, (hit != NULL) ? (size_t)(hit - client->rx) : len, tag, tag_len) != NULL);
+        }
+        if(hit == NULL)
+        {
+            len = keep_tail(client, len, carry);
+            continue;
+        }
+        eol = memchr(hit + 1, '\n', client->rx + len - (hit + 1));
+        if(eol == NULL)
+        {
+            len = keep_tail(client, len, client->rx + len - hit);
+            continue;
+        }
+
+        client->rx[len] = '\0';
+        if((sscanf(hit + marker_len, "%lld,%lld", &first, &next) != 2) || (next < first))
+        {
+            return ERROR;
+        }
+        after = client->rx + len - (eol + 1);
+        if(after > (size_t)(next - first))
+        {
+            return ERROR;
+        }
+        if(!found)
+        {
+            client->evicted++;
+        }
+        for(len = (size_t)(next - first) - after; len > 0; len -= after)
+        {
+            after = (len < BENCH_RECV_BUFFER) ? len : BENCH_RECV_BUFFER;
+            if(recv_exact(client, fd, client->rx, after) == ERROR)
+            {
+                return ERROR;
+            }
+        }
+        return SUCCESS;
+    }
+}
+
+/**
+ * @brief Turns on compressed replies and checks the acknowledgement.
+ */
+static int request_compression(bench_client_t *client, int fd)
+{
+    const char *ack = BENCH_COMPRESS_COMMAND;
+    size_t ack_len = strlen(ack);
+
+    if((send_all(client, fd, ack, ack_len) == ERROR) ||
+       (recv_exact(client, fd, client->rx, ack_len) == ERROR))
+    {
+        return ERROR;
+    }
+    // A server without compression echoes the history instead
+    return (memcmp(client->rx, ack, ack_len) == 0) ? SUCCESS : ERROR;
+}
+
+/**
+ * @brief Sends one request frame: header, then payload.
+ *
+ * The header is corked with MSG_MORE so it leaves in the same segment as
+ * the payload instead of waiting out Nagle and the server's delayed ACK.
+ */
+static int send_frame(bench_client_t *client, int fd, uint8_t opcode, const char *payload, size_t len)
+{
+    char header[BENCH_FRAME_HEADER] = { (char)opcode, 0, 0, 0 };
+    uint32_t be_len = htobe32((uint32_t)len);
+    size_t offset = 0;
+    ssize_t sent;
+
+    memcpy(header + 4, &be_len, sizeof(be_len));
+    while(offset < sizeof(header))
+    {
+        sent = send(fd, header + offset, sizeof(header) - offset, MSG_NOSIGNAL | ((len > 0) ? MSG_MORE : 0));
+        if((sent == ERROR) && (errno == EINTR))
+        {
+            continue;
+        }
+        if(sent <= 0)
+        {
+            return ERROR;
+        }
+        client->bytes_out += sent;
+        offset += sent;
+    }
+    return send_all(client, fd, payload, len);
+}
+
+/**
+ * @brief Reads one reply frame, sized by its header.
+ *
+ * @param opcode Opcode of the request it answers.
+ */
+static int read_frame_reply(bench_client_t *client, int fd, uint8_t opcode)
+{
+    uint32_t be_len;
+    size_t len;
+    size_t chunk;
+
+    if(recv_exact(client, fd, client->rx, BENCH_FRAME_HEADER) == ERROR)
+    {
+        return ERROR;
+    }
+    if((uint8_t)client->rx[0] != (opcode | BENCH_FRAME_REPLY))
+    {
+        return ERROR;
+    }
+    memcpy(&be_len, client->rx + 4, sizeof(be_len));
+
+    for(len = be32toh(be_len); len > 0; len -= chunk)
+    {
+        chunk = (len < BENCH_RECV_BUFFER) ? len : BENCH_RECV_BUFFER;
+        if(recv_exact(client, fd, client->rx, chunk) == ERROR)
+        {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Reads and decodes one compressed reply.
+ *
+ * Frames are read up to the end frame; a reply without the record's tag
+ * is counted in client->evicted.
+ *
+ * @param tag Unique tag at the start of the record.
+ * @param tag_len Length of tag.
+ */
+static int read_compressed_reply(bench_client_t *client, int fd, const char *tag, size_t tag_len)
+{
+    bool found = false;
+    size_t carry = 0;
+    size_t decoded;
+    uint32_t raw_len;
+    uint32_t payload_len;
+    uint64_t start;
+
+    for(;;)
+    {
+        if(recv_exact(client, fd, client->rx, LZ4_FRAME_HEADER) == ERROR)
+        {
+            return ERROR;
+        }
+        lz4_frame_get((const uint8_t *)client->rx, &raw_len, &payload_len);
+        if(raw_len == 0)
+        {
+            if(!found)
+            {
+                client->evicted++;
+            }
+            return SUCCESS;
+        }
+        if((raw_len > LZ4_FRAME_BLOCK) || (payload_len > raw_len) ||
+           (recv_exact(client, fd, client->rx, payload_len) == ERROR))
+        {
+            return ERROR;
+        }
+
+        start = now_ns();
+        if(payload_len == raw_len)
+        {
+            memcpy(client->plain + carry, client->rx, raw_len);
+            decoded = raw_len;
+        }
+        else
+        {
+            decoded = lz4_decompress((const uint8_t *)client->rx, payload_len,
+                                     (uint8_t *)client->plain + carry, raw_len);
+        }
+        client->decode_ns += now_ns() - start;
+        if(decoded != raw_len)
+        {
+            return ERROR;
+        }
+        client->bytes_raw += raw_len;
+
+        if(!found)
+        {
+            decoded += carry;
+            found = (memmem(client->plain, decoded, tag, tag_len) != NULL);
+            // Keep enough of the tail to match a tag split across frames
+            carry = (decoded < tag_len - 1) ? decoded : tag_len - 1;
+            memmove(client->plain, client->plain + decoded - carry, carry);
+        }
+    }
+}
+
+/**
+ * @brief Sends one seek command on its own connection.
+ */
+static int run_seek(bench_client_t *client)
+{
+    char command[64];
+    uint64_t start = now_ns();
+    int len;
+    int fd;
+    int ret = ERROR;
+
+    len = snprintf(command, sizeof(command), BENCH_SEEK_COMMAND,
+                   rand_r(&client->seed) % BENCH_SEEK_ENTRIES, 0u);
+
+    fd = connect_server();
+    if(fd == ERROR)
+    {
+        return ERROR;
+    }
+    if(b_config.binary)
+    {
+        uint32_t seekto[2] = { htobe32(rand_r(&client->seed) % BENCH_SEEK_ENTRIES), 0 };
+
+        command[0] = (char)BENCH_FRAME_MAGIC;
+        ret = ((send_all(client, fd, command, 1) == SUCCESS) &&
+               (send_frame(client, fd, BENCH_FRAME_SEEK, (const char *)seekto, sizeof(seekto)) == SUCCESS) &&
+               (read_frame_reply(client, fd, BENCH_FRAME_SEEK) == SUCCESS)) ? SUCCESS : ERROR;
+    }
+    else if((send_all(client, fd, command, len) == SUCCESS) &&
+            (shutdown(fd, SHUT_WR) == SUCCESS) &&
+            (read_to_eof(client, fd) == SUCCESS))
+    {
+        ret = SUCCESS;
+    }
+    if(ret == SUCCESS)
+    {
+        record_latency(client, start);
+        client->requests++;
+        client->seeks++;
+    }
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Sends records_per_conn records on one connection.
+ *
+ * The latency of the first record includes the connection setup, and
+ * with -z the compression request.
+ */
+static int run_session(bench_client_t *client)
+{
+    uint64_t start = now_ns();
+    size_t record_len;
+    size_t tag_len;
+    int fd;
+    int i;
+    int ret = SUCCESS;
+
+    fd = connect_server();
+    if(fd == ERROR)
+    {
+        return ERROR;
+    }
+    if(b_config.compress && (request_compression(client, fd) == ERROR))
+    {
+        close(fd);
+        return ERROR;
+    }
+    if(b_config.binary)
+    {
+        client->record[0] = (char)BENCH_FRAME_MAGIC;
+        if(send_all(client, fd, client->record, 1) == ERROR)
+        {
+            close(fd);
+            return ERROR;
+        }
+    }
+
+    for(i = 0; (i < b_config.records_per_conn) && (ret == SUCCESS); i++)
+    {
+        if(i > 0)
+        {
+            start = now_ns();
+        }
+        record_len = build_record(client, &tag_len);
+
+        if(b_config.binary)
+        {
+            ret = send_frame(client, fd, BENCH_FRAME_APPEND, client->record, record_len);
+            if(ret == SUCCESS)
+            {
+                ret = read_frame_reply(client, fd, BENCH_FRAME_APPEND);
+            }
+        }
+        else if(!b_config.compress && (i < b_config.records_per_conn - 1))
+        {
+            memcpy(client->record + record_len, BENCH_READFROM_END, strlen(BENCH_READFROM_END));
+            ret = send_all(client, fd, client->record, record_len + strlen(BENCH_READFROM_END));
+        }
+        else
+        {
+            ret = send_all(client, fd, client->record, record_len);
+        }
+        if((ret == SUCCESS) && !b_config.binary)
+        {
+            if(b_config.compress)
+            {
+                ret = read_compressed_reply(client, fd, client->record, tag_len);
+            }
+            // The last record ends the session; its reply runs to EOF
+            else if(i == b_config.records_per_conn - 1)
+            {
+                ret = ((shutdown(fd, SHUT_WR) == SUCCESS) && (read_to_eof(client, fd) == SUCCESS)) ? SUCCESS : ERROR;
+            }
+            else
+            {
+                ret = read_reply(client, fd, client->record, tag_len);
+            }
+        }
+        if(ret == SUCCESS)
+        {
+            record_latency(client, start);
+            client->requests++;
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+static void *client_loop(void *arg)
+{
+    bench_client_t *client = (bench_client_t *)arg;
+    int ret;
+
+    while(now_ns() < deadline_ns)
+    {
+        if((int)(rand_r(&client->seed) % 100) < b_config.seek_percent)
+        {
+            ret = run_seek(client);
+        }
+        else
+        {
+            ret = run_session(client);
+        }
+        if(ret == ERROR)
+        {
+            client->errors++;
+        }
+    }
+
+    return arg;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint64_t lhs = *(const uint64_t *)a;
+    uint64_t rhs = *(const uint64_t *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, double fraction)
+{
+    size_t rank;
+
+    if(count == 0)
+    {
+        return 0;
+    }
+    rank = (size_t)ceil(fraction * count);
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+/**
+ * @brief Merges the client results and prints the report.
+ */
+static int report(bench_client_t *clients, double elapsed_secs)
+{
+    uint64_t requests = 0, seeks = 0, errors = 0, timeouts = 0, evicted = 0, bytes_out = 0, bytes_in = 0;
+    uint64_t bytes_raw = 0, decode_ns = 0;
+    struct rusage usage;
+    uint64_t *all;
+    size_t count = 0;
+    int i;
+
+    for(i = 0; i < b_config.connections; i++)
+    {
+        count += clients[i].latency_count;
+    }
+    all = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+    if(all == NULL)
+    {
+        fprintf(stderr, "Out of memory merging latencies\n");
+        return ERROR;
+    }
+
+    count = 0;
+    for(i = 0; i < b_config.connections; i++)
+    {
+        memcpy(all + count, clients[i].latencies, clients[i].latency_count * sizeof(uint64_t));
+        count += clients[i].latency_count;
+        requests += clients[i].requests;
+        seeks += clients[i].seeks;
+        errors += clients[i].errors;
+        timeouts += clients[i].timeouts;
+        evicted += clients[i].evicted;
+        bytes_out += clients[i].bytes_out;
+        bytes_in += clients[i].bytes_in;
+        bytes_raw += clients[i].bytes_raw;
+        decode_ns += clients[i].decode_ns;
+    }
+    qsort(all, count, sizeof(uint64_t), compare_latency);
+
+    if(b_config.label[0] != '\0')
+    {
+        printf("label %s\n", b_config.label);
+    }
+    printf("connections %d\n", b_config.connections);
+    printf("records_per_connection %d\n", b_config.records_per_conn);
+    printf("seek_percent %d\n", b_config.seek_percent);
+    printf("duration_s %.3f\n", elapsed_secs);
+    printf("requests %llu\n", (unsigned long long)requests);
+    printf("seeks %llu\n", (unsigned long long)seeks);
+    printf("errors %llu\n", (unsigned long long)errors);
+    printf("timeouts %llu\n", (unsigned long long)timeouts);
+    printf("evicted %llu\n", (unsigned long long)evicted);
+    printf("bytes_out %llu\n", (unsigned long long)bytes_out);
+    printf("bytes_in %llu\n", (unsigned long long)bytes_in);
+    printf("requests_per_s %.1f\n", requests / elapsed_secs);
+    printf("bytes_per_s %.1f\n", (bytes_out + bytes_in) / elapsed_secs);
+    if(b_config.compress)
+    {
+        printf("bytes_raw %llu\n", (unsigned long long)bytes_raw);
+        printf("compression_ratio %.3f\n", (bytes_in > 0) ? (double)bytes_raw / bytes_in : 0.0);
+        printf("decode_ns %llu\n", (unsigned long long)decode_ns);
+    }
+    if(getrusage(RUSAGE_SELF, &usage) == SUCCESS)
+    {
+        printf("cpu_s %.3f\n", usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+               (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6);
+    }
+    printf("latency_ns count %zu p50 %llu p90 %llu p99 %llu p999 %llu max %llu\n", count,
+           (unsigned long long)percentile(all, count, 0.50),
+           (unsigned long long)percentile(all, count, 0.90),
+           (unsigned long long)percentile(all, count, 0.99),
+           (unsigned long long)percentile(all, count, 0.999),
+           (unsigned long long)((count > 0) ? all[count - 1] : 0));
+
+    free(all);
+    return SUCCESS;
+}
+
+/**
+ * @brief Echoes the server's parse and sync lines from its statistics report.
+ *
+ * The statistics command is sent as text, which every server mode
+ * answers. Lines the server does not report are left out.
+ */
+static void report_server_stats(void)
+{
+    static const char *const echoed[] = { "latency_parse_ns ", "syncs ", "latency_sync_ns " };
+    size_t i;
+    bench_client_t probe = { 0 };
+    char *line = NULL;
+    size_t line_cap = 0;
+    FILE *in;
+    int fd;
+
+    fd = connect_server();
+    if(fd == ERROR)
+    {
+        return;
+    }
+    if((send_all(&probe, fd, BENCH_STATS_COMMAND, strlen(BENCH_STATS_COMMAND)) == ERROR) ||
+       (shutdown(fd, SHUT_WR) == ERROR) || ((in = fdopen(fd, "r")) == NULL))
+    {
+        close(fd);
+        return;
+    }
+
+    while(getline(&line, &line_cap, in) != ERROR)
+    {
+        for(i = 0; i < sizeof(echoed) / sizeof(echoed[0]); i++)
+        {
+            if(strncmp(line, echoed[i], strlen(echoed[i])) == 0)
+            {
+                printf("server_%s", line);
+            }
+        }
+    }
+    free(line);
+    fclose(in);
+}
+
+/**
+ * @brief Parses a size distribution: "N", "MIN-MAX" or "exp:MEAN".
+ */
+static int parse_sizes(const char *spec)
+{
+    char *end;
+
+    if(strncmp(spec, "exp:", 4) == 0)
+    {
+        b_config.size_dist = SIZE_EXPONENTIAL;
+        b_config.size_mean = strtod(spec + 4, &end);
+        return ((*end == '\0') && (b_config.size_mean >= 1)) ? SUCCESS : ERROR;
+    }
+
+    b_config.size_min = strtoul(spec, &end, 10);
+    b_config.size_max = b_config.size_min;
+    b_config.size_dist = SIZE_FIXED;
+    if(*end == '-')
+    {
+        b_config.size_dist = SIZE_UNIFORM;
+        b_config.size_max = strtoul(end + 1, &end, 10);
+    }
+    return ((*end == '\0') && (b_config.size_min >= 1) && (b_config.size_max >= b_config.size_min) &&
+            (b_config.size_max <= BENCH_MAX_RECORD)) ? SUCCESS : ERROR;
+}
+
+static void print_usage(const char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-r records] [-s sizes] [-x percent] [-T seconds] [-l label] [-z] [-b]\n", prog_name);
+    fprintf(stderr, "  -H host         server address (default %s)\n", BENCH_DEFAULT_HOST);
+    fprintf(stderr, "  -p port         server port (default %s)\n", BENCH_DEFAULT_PORT);
+    fprintf(stderr, "  -c connections  concurrent clients (1-%d, default 8)\n", BENCH_MAX_CONNECTIONS);
+    fprintf(stderr, "  -r records      records per connection (default 1, more needs aesdsocket -k)\n");
+    fprintf(stderr, "  -s sizes        record bytes: N, MIN-MAX (uniform) or exp:MEAN (default 64)\n");
+    fprintf(stderr, "  -x percent      share of requests that are seek commands (0-100, default 0)\n");
+    fprintf(stderr, "  -T seconds      run time (default 10)\n");
+    fprintf(stderr, "  -l label        name echoed in the report\n");
+    fprintf(stderr, "  -z              ask for LZ4 compressed replies (needs aesdsocket -k)\n");
+    fprintf(stderr, "  -b              send length-prefixed binary frames (not with -z or aesdsocket -m uring)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct addrinfo hints;
+    bench_client_t *clients;
+    uint64_t start;
+    int started = 0;
+    int opt;
+    int ret;
+    int i;
+
+    while((opt = getopt(argc, argv, "H:p:c:r:s:x:T:l:zb")) != -1)
+    {
+        switch(opt)
+        {
+        case 'H':
+            b_config.host = optarg;
+            break;
+        case 'p':
+            b_config.port = optarg;
+            break;
+        case 'c':
+            b_config.connections = atoi(optarg);
+            if((b_config.connections < 1) || (b_config.connections > BENCH_MAX_CONNECTIONS))
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            b_config.records_per_conn = atoi(optarg);
+            if(b_config.records_per_conn < 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if(parse_sizes(optarg) == ERROR)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'x':
+            b_config.seek_percent = atoi(optarg);
+            if((b_config.seek_percent < 0) || (b_config.seek_percent > 100))
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'T':
+            b_config.duration_secs = atof(optarg);
+            if(b_config.duration_secs <= 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            b_config.label = optarg;
+            break;
+        case 'z':
+            b_config.compress = true;
+            break;
+        case 'b':
+            b_config.binary = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Compression is negotiated in text; framed replies are always plain
+    if(b_config.compress && b_config.binary)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(b_config.host, b_config.port, &hints, &server_addr);
+    if(ret != 0)
+    {
+        fprintf(stderr, "Cannot resolve %s:%s: %s\n", b_config.host, b_config.port, gai_strerror(ret));
+        return 1;
+    }
+
+    clients = calloc(b_config.connections, sizeof(bench_client_t));
+    if(clients == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        freeaddrinfo(server_addr);
+        return 1;
+    }
+
+    start = now_ns();
+    deadline_ns = start + (uint64_t)(b_config.duration_secs * 1e9);
+
+    for(i = 0; i < b_config.connections; i++)
+    {
+        clients[i].id = i;
+        clients[i].seed = (unsigned int)(start >> 10) + i;
+        // Room for the read-from that follows a record in the same send
+        clients[i].record = malloc(BENCH_MAX_RECORD + sizeof(BENCH_READFROM_END));
+        clients[i].rx = malloc(BENCH_RECV_BUFFER);
+        clients[i].plain = malloc(LZ4_FRAME_BLOCK + BENCH_MAX_TAG);
+        if((clients[i].record == NULL) || (clients[i].rx == NULL) || (clients[i].plain == NULL) ||
+           (pthread_create(&clients[i].threadId, NULL, client_loop, &clients[i]) != 0))
+        {
+            fprintf(stderr, "Failed to start client %d\n", i);
+            free(clients[i].record);
+            free(clients[i].rx);
+            free(clients[i].plain);
+            break;
+        }
+        started++;
+    }
+
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(clients[i].threadId, NULL);
+    }
+
+    ret = (started == b_config.connections) ? SUCCESS : ERROR;
+    if(ret == SUCCESS)
+    {
+        ret = report(clients, (now_ns() - start) / 1e9);
+        report_server_stats();
+    }
+
+    for(i = 0; i < started; i++)
+    {
+        free(clients[i].record);
+        free(clients[i].rx);
+        free(clients[i].plain);
+        free(clients[i].latencies);
+    }
+    free(clients);
+    freeaddrinfo(server_addr);
+
+    return (ret == SUCCESS) ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+/***********************************************************************
+ * @file      		aesdsocket-compress.c
+ * @version   		0.1
+ * @brief		    Opt-in LZ4 compressed replies with a block cache
+ *
+ * Every reply carries the whole history, so reply bandwidth grows with
+ * it. A connection that sends "AESDSOCKET_COMPRESS:lz4" gets its
+ * following history replies as LZ4 block frames instead; text logs
+ * shrink several-fold.
+ *
+ * History bytes never change once visible, and each has a fixed stream
+ * position (see aesdsocket-history.c), so a block that covers one whole
+ * LZ4_FRAME_BLOCK aligned range compresses to the same bytes every
+ * time. Those blocks are kept in a small direct-mapped cache; a repeated
+ * reply only compresses the partial blocks at its edges.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include "aesdsocket-compress.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct compress_slot_t
+ * @brief One cached compressed block.
+ */
+typedef struct
+{
+    off_t index;                /**< Stream block number, position / LZ4_FRAME_BLOCK */
+    size_t len;                 /**< Payload bytes in data */
+    char *data;                 /**< Payload, NULL for an empty slot */
+} compress_slot_t;
+
+/**
+ * @struct compress_cache_t
+ * @brief Cache of compressed full blocks.
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    compress_slot_t slots[COMPRESS_CACHE_SLOTS];
+} compress_cache_t;
+
+/****************   Global Variables     ***************/
+static compress_cache_t cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Copies a cached payload for block index into dst.
+ *
+ * @return Payload length, or 0 on a miss.
+ */
+static size_t cache_get(off_t index, char *dst)
+{
+    compress_slot_t *slot = &cache.slots[index % COMPRESS_CACHE_SLOTS];
+    size_t len = 0;
+
+    pthread_mutex_lock(&cache.mutex);
+    if((slot->data != NULL) && (slot->index == index))
+    {
+        memcpy(dst, slot->data, slot->len);
+        len = slot->len;
+    }
+    pthread_mutex_unlock(&cache.mutex);
+    return len;
+}
+
+static void cache_put(off_t index, const char *payload, size_t len)
+{
+    compress_slot_t *slot = &cache.slots[index % COMPRESS_CACHE_SLOTS];
+    char *copy = malloc(len);
+
+    if(copy == NULL)
+    {
+        return;
+    }
+    memcpy(copy, payload, len);
+
+    pthread_mutex_lock(&cache.mutex);
+    free(slot->data);
+    slot->index = index;
+    slot->len = len;
+    slot->data = copy;
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+/**
+ * @brief Writes one frame for len raw bytes at stream position.
+ *
+ * @return Bytes written to out, header included.
+ */
+static size_t compress_frame(const char *raw, size_t len, off_t position, char *out)
+{
+    char *payload = out + LZ4_FRAME_HEADER;
+    bool full = ((position % LZ4_FRAME_BLOCK) == 0) && (len == LZ4_FRAME_BLOCK);
+    uint64_t start;
+    size_t payload_len = 0;
+
+    if(full)
+    {
+        payload_len = cache_get(position / LZ4_FRAME_BLOCK, payload);
+        if(payload_len > 0)
+        {
+            stats_add(STAT_COMPRESS_CACHE_HITS, 1);
+        }
+    }
+
+    if(payload_len == 0)
+    {
+        start = stats_now();
+        payload_len = lz4_compress((const uint8_t *)raw, len, (uint8_t *)payload, lz4_compress_bound(len));
+        // Incompressible: store the block, flagged by equal lengths
+        if((payload_len == 0) || (payload_len >= len))
+        {
+            memcpy(payload, raw, len);
+            payload_len = len;
+        }
+        stats_record(STAT_PHASE_COMPRESS, start);
+        if(full)
+        {
+            cache_put(position / LZ4_FRAME_BLOCK, payload, payload_len);
+        }
+    }
+
+    lz4_frame_put((uint8_t *)out, len, payload_len);
+    return LZ4_FRAME_HEADER + payload_len;
+}
+
+bool compress_is_command(const char *packet, size_t length, bool *enable)
+{
+    size_t cmd_len = strlen(COMPRESS_COMMAND);
+    size_t alg_len = strlen(COMPRESS_ALGORITHM);
+
+    if((length < cmd_len) || (memcmp(packet, COMPRESS_COMMAND, cmd_len) != 0))
+    {
+        return false;
+    }
+
+    packet += cmd_len;
+    length -= cmd_len;
+    *enable = (length >= alg_len) && (memcmp(packet, COMPRESS_ALGORITHM, alg_len) == 0) &&
+              ((length == alg_len) || (packet[alg_len] == '\n') || (packet[alg_len] == '\r'));
+    return true;
+}
+
+int compress_acquire_ack(history_snapshot_t *snap, bool enabled)
+{
+    char ack[64];
+    int len;
+
+    len = snprintf(ack, sizeof(ack), COMPRESS_COMMAND "%s\n", enabled ? COMPRESS_ALGORITHM : "off");
+    return history_acquire_buffer(snap, ack, len);
+}
+
+int compress_acquire(history_snapshot_t *snap, off_t offset)
+{
+    history_snapshot_t current;
+    history_block_t *block;
+    const char *raw;
+    size_t remaining;
+    size_t chunk;
+    size_t cap = LZ4_FRAME_HEADER;
+    size_t out = 0;
+    off_t position;
+    off_t end;
+
+    history_acquire(&current);
+    if((offset < 0) || ((size_t)offset > current.length))
+    {
+        offset = current.length;
+    }
+    raw = (current.block != NULL) ? current.block->data + current.base + offset : NULL;
+    remaining = current.length - offset;
+    end = current.origin + current.length;
+
+    // Size the reply for the worst case of every frame
+    for(position = current.origin + offset; position < end; position += chunk)
+    {
+        chunk = LZ4_FRAME_BLOCK - (position % LZ4_FRAME_BLOCK);
+        if((off_t)chunk > end - position)
+        {
+            chunk = end - position;
+        }
+        cap += LZ4_FRAME_HEADER + lz4_compress_bound(chunk);
+    }
+
+    block = malloc(sizeof(history_block_t) + cap);
+    if(block == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to allocate compressed reply");
+        history_release(&current);
+        return ERROR;
+    }
+    atomic_init(&block->refcount, 1);
+    block->cap = cap;
+
+    for(position = current.origin + offset; remaining > 0; position += chunk)
+    {
+        chunk = LZ4_FRAME_BLOCK - (position % LZ4_FRAME_BLOCK);
+        if(chunk > remaining)
+        {
+            chunk = remaining;
+        }
+        out += compress_frame(raw, chunk, position, block->data + out);
+        raw += chunk;
+        remaining -= chunk;
+    }
+    lz4_frame_put((uint8_t *)block->data + out, 0, 0);
+    out += LZ4_FRAME_HEADER;
+
+    stats_add(STAT_COMPRESS_RAW_BYTES, current.length - offset);
+    stats_add(STAT_COMPRESS_OUT_BYTES, out);
+    history_release(&current);
+
+    snap->block = block;
+    snap->base = 0;
+    snap->length = out;
+    snap->origin = 0;
+    snap->generation = 0;
+    return SUCCESS;
+}
+
+void compress_cache_clear(void)
+{
+    int i;
+
+    pthread_mutex_lock(&cache.mutex);
+    for(i = 0; i < COMPRESS_CACHE_SLOTS; i++)
+    {
+        free(cache.slots[i].data);
+        cache.slots[i].data = NULL;
+    }
+    pthread_mutex_unlock(&cache.mutex);
+}
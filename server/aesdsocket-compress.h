@@ -0,0 +1,62 @@
+/****************************************************************
+ * @file      		aesdsocket-compress.h
+ * @brief		    Opt-in LZ4 compressed replies with a block cache
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_COMPRESS_H
+#define AESDSOCKET_COMPRESS_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+#include "aesdsocket-history.h"
+#include "aesdsocket-lz4.h"
+
+/****************   Macros     ***************/
+
+// In-band command: "AESDSOCKET_COMPRESS:lz4" turns compression on, anything else off
+#define COMPRESS_COMMAND        "AESDSOCKET_COMPRESS:"
+#define COMPRESS_ALGORITHM      "lz4"
+// Compressed full blocks kept for reuse, direct mapped by stream block number
+#define COMPRESS_CACHE_SLOTS    (256)
+
+/**
+ * @brief Recognizes a compression command.
+ *
+ * @param packet Packet bytes, not necessarily NUL terminated.
+ * @param length Number of bytes in packet.
+ * @param[out] enable Whether the command asks for compressed replies.
+ * @return true for a compression command.
+ */
+bool compress_is_command(const char *packet, size_t length, bool *enable);
+
+/**
+ * @brief Builds the plain-text reply acknowledging a compression command.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ * @param enabled Compression state now in effect on the connection.
+ * @return SUCCESS or ERROR.
+ */
+int compress_acquire_ack(history_snapshot_t *snap, bool enabled);
+
+/**
+ * @brief Snapshots the history from offset and compresses it into frames.
+ *
+ * The reply is a sequence of LZ4_FRAME_HEADER + payload frames, one per
+ * stretch of up to LZ4_FRAME_BLOCK bytes, ending with a frame whose raw
+ * length is 0. Stretches are cut at multiples of LZ4_FRAME_BLOCK in
+ * stream position, so a full block is the same bytes in every reply and
+ * its compressed form is taken from the cache after the first time.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ * @param offset Store offset to start from.
+ * @return SUCCESS or ERROR.
+ */
+int compress_acquire(history_snapshot_t *snap, off_t offset);
+
+/**
+ * @brief Frees every cached block.
+ */
+void compress_cache_clear(void);
+
+#endif // AESDSOCKET_COMPRESS_H
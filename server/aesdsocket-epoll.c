@@ -0,0 +1,906 @@
+/***********************************************************************
+ * @file      		aesdsocket-epoll.c
+ * @version   		0.1
+ * @brief		    Edge-triggered epoll reactor for the socket server
+ *
+ * Every event loop thread owns an epoll instance and the connections it
+ * accepted. The listening socket is registered with EPOLLEXCLUSIVE in
+ * all loops so that only one of them is woken per incoming connection.
+ * In reuseport mode each loop instead listens on its own SO_REUSEPORT
+ * socket and runs pinned to one CPU, so accepts never share a queue.
+ * Each connection walks the receiving -> appending -> replying states.
+ * Socket I/O never blocks the loop; EAGAIN simply parks the connection
+ * until the next edge. Neither does the append: the record is queued
+ * with the appender and the connection waits in CONN_COMMITTING until the
+ * appender hands it back on the loop's completion eventfd, after its
+ * commit and, with -D strict, its sync. The loop serves its other
+ * connections meanwhile.
+ * With keep-alive (-k), or when it speaks binary frames, a connection
+ * loops back to receiving after each reply. The loop wakes once a
+ * second to close idle connections and to evict clients that stopped
+ * taking their reply (-w, -o).
+ * After a hot restart hands the listener over, each loop stops accepting
+ * and exits once its last connection has been answered.
+ *
+ * @reference
+ *
+ * 1. man 7 epoll
+ ************************************************************************/
+/****************   Includes    ***************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "aesdsocket-epoll.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-timestamp.h"
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-log.h"
+
+/****************   Global Variables     ***************/
+// Its address tags the timestamp timer in epoll events; NULL is the listener
+static char timestamp_event;
+// Its address tags the hot restart handoff event
+static char handoff_event;
+// Its address tags the termination signal event
+static char shutdown_event;
+// Its address tags the event stopping every loop when one fails to start
+static char stop_event;
+// Its address tags the loop's append completion event
+static char append_event;
+
+/**
+ * @brief Reads the monotonic clock in whole seconds.
+ */
+static time_t monotonic_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/**
+ * @brief Releases a connection and removes it from its reactor.
+ *
+ * @param reactor Reactor owning the connection.
+ * @param conn Connection to release.
+ */
+static void conn_close(epoll_reactor_t *reactor, epoll_conn_t *conn)
+{
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, conn->clientSocketFd, NULL);
+    close(conn->clientSocketFd);
+    assembler_release(&conn->assembler);
+    history_release(&conn->reply);
+    admission_release(conn->source);
+    log_msg(LOG_INFO, "Terminated connection: %s", conn->ip);
+
+    LIST_REMOVE(conn, conns);
+    free(conn);
+    stats_add(STAT_CONN_CLOSED, 1);
+}
+
+/**
+ * @brief Accepts every pending connection on the listening socket.
+ *
+ * @param reactor Reactor the new connections are attached to.
+ */
+static void reactor_accept(epoll_reactor_t *reactor)
+{
+    struct sockaddr_storage clientInfo;
+    socklen_t clientSize;
+    struct epoll_event event;
+    epoll_conn_t *conn;
+    admission_source_t *source;
+    int fd;
+
+    while(!fatal_error_in_progress)
+    {
+        clientSize = sizeof(clientInfo);
+        fd = accept4(reactor->listenFd, (struct sockaddr *)&clientInfo, &clientSize,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == ERROR)
+        {
+            if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                log_msg(LOG_ERR, "Failed to accept client connection");
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        if(admission_acquire((struct sockaddr *)&clientInfo, &source) == ERROR)
+        {
+            close(fd);
+            continue;
+        }
+
+        conn = calloc(1, sizeof(epoll_conn_t));
+        if(conn == NULL)
+        {
+            log_msg(LOG_ERR, "Failed to allocate memory for new client connection");
+            admission_release(source);
+            close(fd);
+            continue;
+        }
+        conn->clientSocketFd = fd;
+        conn->source = source;
+        assembler_init(&conn->assembler);
+        conn->state = CONN_RECEIVING;
+        conn->append.completion = &reactor->appends;
+        conn->last_active = monotonic_seconds();
+        inet_ntop(clientInfo.ss_family, get_in_addr((struct sockaddr *)&clientInfo),
+                  conn->ip, sizeof(conn->ip));
+
+        // Both directions are armed once; edge triggering reports each transition
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if(epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, fd, &event) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to register client with epoll");
+            admission_release(source);
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        LIST_INSERT_HEAD(&reactor->conn_head, conn, conns);
+        stats_add(STAT_CONN_ACCEPTED, 1);
+        log_msg(LOG_INFO, "New connection established: %s", conn->ip);
+    }
+}
+
+/**
+ * @brief Sends the frame prefix, if any, then the next part of the reply.
+ *
+ * @return Bytes sent, 0 once the whole reply is out, or ERROR with errno set.
+ */
+static ssize_t conn_send(epoll_conn_t *conn)
+{
+    ssize_t count = frame_prefix_send(conn->clientSocketFd, &conn->prefix);
+
+    return (count != 0) ? count : history_send(conn->clientSocketFd, &conn->reply, &conn->reply_off);
+}
+
+/**
+ * @brief Picks the next state once a reply has been sent in full.
+ *
+ * A kept-alive or framed connection goes back to waiting for its next packet unless
+ * the client has already shut down its side.
+ */
+static void conn_reply_done(epoll_conn_t *conn)
+{
+    history_release(&conn->reply);
+    stats_record(STAT_PHASE_REPLY, conn->reply_start);
+    conn->packets_served++;
+    conn->last_active = monotonic_seconds();
+    conn->state = ((s_config.keepalive || conn->binary) && !conn->peer_closed) ? CONN_RECEIVING : CONN_CLOSING;
+}
+
+/**
+ * @brief Takes the reply to a text packet once it has been handled.
+ *
+ * @param conn Connection whose packet was handled.
+ * @param packet_length Assembler bytes the packet took.
+ * @param packet_status Result of handle_packet(), not PACKET_APPENDING.
+ */
+static void conn_packet_done(epoll_conn_t *conn, size_t packet_length, int packet_status)
+{
+    if(packet_status == ERROR)
+    {
+        conn->state = CONN_CLOSING;
+        return;
+    }
+    // The reply streams from the history mirror; recycle the buffer unless more is pipelined
+    assembler_consume(&conn->assembler, packet_length);
+    if(conn->assembler.len == 0)
+    {
+        assembler_release(&conn->assembler);
+    }
+    if(packet_status == PACKET_COMPRESS)
+    {
+        conn->compress = (conn->reply_off != 0);
+    }
+    conn->reply_start = stats_now();
+    conn->reply_progress = conn->reply_start;
+    if(reply_acquire(&conn->reply, packet_status, &conn->reply_off, conn->compress) == ERROR)
+    {
+        conn->state = CONN_CLOSING;
+        return;
+    }
+    conn->state = CONN_REPLYING;
+}
+
+/**
+ * @brief Drops a handled frame from the assembler and starts its reply.
+ */
+static void conn_frame_done(epoll_conn_t *conn)
+{
+    assembler_consume(&conn->assembler, frame_size(&conn->frame));
+    if(conn->assembler.len == 0)
+    {
+        assembler_release(&conn->assembler);
+    }
+    conn->state = CONN_REPLYING;
+}
+
+/**
+ * @brief Drives a connection's state machine until it would block.
+ *
+ * @param reactor Reactor owning the connection.
+ * @param conn Connection that reported an event.
+ */
+static void conn_service(epoll_reactor_t *reactor, epoll_conn_t *conn)
+{
+    size_t packet_length;
+    int packet_status;
+    ssize_t count;
+    int complete;
+
+    while(true)
+    {
+        switch(conn->state)
+        {
+        case CONN_RECEIVING:
+            // A frame's header says how much is still to come; nothing else is looked at
+            complete = conn->binary ? frame_complete(&conn->assembler, &conn->frame) : 0;
+            if(complete == ERROR)
+            {
+                log_msg(LOG_ERR, "Malformed frame: %s", conn->ip);
+                conn->state = CONN_CLOSING;
+                break;
+            }
+            // A pipelined packet may already be waiting behind the last one
+            if((complete == FRAME_COMPLETE) ||
+               (!conn->binary && s_config.keepalive && (assembler_record_length(&conn->assembler) > 0)))
+            {
+                conn->state = CONN_APPENDING;
+                break;
+            }
+            if(assembler_reserve(&conn->assembler, (conn->binary && (conn->assembler.len >= FRAME_HEADER_LEN)) ?
+                                 frame_size(&conn->frame) - conn->assembler.len : BUF_LEN) == ERROR)
+            {
+                conn->state = CONN_CLOSING;
+                break;
+            }
+            count = recv(conn->clientSocketFd, conn->assembler.buf + conn->assembler.len,
+                         conn->assembler.cap - conn->assembler.len, 0);
+            if(count == ERROR)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                {
+                    return;
+                }
+                log_msg(LOG_ERR, "Data reception unsuccessful");
+                conn->state = CONN_CLOSING;
+                break;
+            }
+            // Peer closed without a newline: treat what we have as the packet
+            if(count == 0)
+            {
+                conn->peer_closed = true;
+                // A frame cut short is dropped, never stored in part
+                if(conn->binary || ((conn->packets_served > 0) && (conn->assembler.len == 0)))
+                {
+                    conn->state = CONN_CLOSING;
+                    break;
+                }
+                conn->state = CONN_APPENDING;
+                break;
+            }
+            conn->last_active = monotonic_seconds();
+            stats_add(STAT_BYTES_IN, count);
+            if(conn->receive_start == 0)
+            {
+                conn->receive_start = stats_now();
+            }
+            // The first byte of the connection selects binary framing over text lines
+            if((conn->packets_served == 0) && (conn->assembler.len == 0) &&
+               ((uint8_t)conn->assembler.buf[0] == FRAME_MAGIC))
+            {
+                conn->binary = true;
+                assembler_commit(&conn->assembler, count);
+                assembler_consume(&conn->assembler, 1);
+                break;
+            }
+            assembler_commit(&conn->assembler, count);
+            if(conn->binary)
+            {
+                break;
+            }
+            if(assembler_record_length(&conn->assembler) > 0)
+            {
+                conn->state = CONN_APPENDING;
+            }
+            else if(conn->assembler.len >= ASSEMBLER_MAX_PENDING)
+            {
+                // Bound memory for a packet that never ends
+                if(admission_charge(conn->source, 0, conn->assembler.len) == ERROR)
+                {
+                    conn->state = CONN_CLOSING;
+                    break;
+                }
+                if(store_append_async(&conn->append, conn->assembler.buf, conn->assembler.len))
+                {
+                    conn->append_partial = true;
+                    conn->append_length = conn->assembler.len;
+                    conn->state = CONN_COMMITTING;
+                    break;
+                }
+                if(conn->append.result == ERROR)
+                {
+                    conn->state = CONN_CLOSING;
+                    break;
+                }
+                assembler_consume(&conn->assembler, conn->assembler.len);
+            }
+            break;
+
+        case CONN_APPENDING:
+            if(conn->receive_start != 0)
+            {
+                stats_record(STAT_PHASE_RECEIVE, conn->receive_start);
+                conn->receive_start = 0;
+            }
+            if(conn->binary)
+            {
+                conn->reply_start = stats_now();
+                conn->reply_progress = conn->reply_start;
+                packet_status = frame_request(&conn->frame, conn->assembler.buf + FRAME_HEADER_LEN, conn->source,
+                                              &conn->reply, &conn->reply_off, &conn->prefix, &conn->append);
+                if(packet_status == ERROR)
+                {
+                    conn->state = CONN_CLOSING;
+                    break;
+                }
+                if(packet_status == FRAME_APPENDING)
+                {
+                    conn->state = CONN_COMMITTING;
+                    break;
+                }
+                conn_frame_done(conn);
+                break;
+            }
+            // Persistent connections commit one record at a time; otherwise everything received
+            packet_length = conn->assembler.len;
+            if(s_config.keepalive && (assembler_record_length(&conn->assembler) > 0))
+            {
+                packet_length = assembler_record_length(&conn->assembler);
+            }
+            conn->reply_off = 0;
+            packet_status = (packet_length > 0) ?
+                            handle_packet(conn->assembler.buf, packet_length, &conn->reply_off, conn->source,
+                                          &conn->append) : SUCCESS;
+            if(packet_status == PACKET_APPENDING)
+            {
+                // The record stays in the assembler until the appender hands it back
+                conn->append_length = packet_length;
+                conn->state = CONN_COMMITTING;
+                break;
+            }
+            conn_packet_done(conn, packet_length, packet_status);
+            break;
+
+        case CONN_COMMITTING:
+            // conn_committed() carries on once the appender hands the record back
+            return;
+
+        case CONN_REPLYING:
+            count = conn_send(conn);
+            if(count == ERROR)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                {
+                    return;
+                }
+                log_msg(LOG_ERR, "Data transmission unsuccessful");
+                conn->state = CONN_CLOSING;
+                break;
+            }
+            if(count == 0)
+            {
+                conn_reply_done(conn);
+                break;
+            }
+            conn->reply_progress = stats_now();
+            break;
+
+        case CONN_CLOSING:
+            conn_close(reactor, conn);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Carries on with a connection whose queued record the appender
+ *        handed back.
+ *
+ * @param reactor Reactor owning the connection.
+ * @param conn Connection in CONN_COMMITTING.
+ */
+static void conn_committed(epoll_reactor_t *reactor, epoll_conn_t *conn)
+{
+    if(conn->append_partial)
+    {
+        conn->append_partial = false;
+        conn->state = CONN_CLOSING;
+        if(store_append_finish(&conn->append) != ERROR)
+        {
+            assembler_consume(&conn->assembler, conn->append_length);
+            conn->state = CONN_RECEIVING;
+        }
+    }
+    else if(conn->binary)
+    {
+        conn->state = CONN_CLOSING;
+        if(frame_append_done(&conn->frame, &conn->append, &conn->reply, &conn->reply_off, &conn->prefix) == SUCCESS)
+        {
+            conn_frame_done(conn);
+        }
+    }
+    else
+    {
+        conn_packet_done(conn, conn->append_length,
+                         (store_append_finish(&conn->append) == ERROR) ? ERROR : SUCCESS);
+    }
+    // Edges that arrived meanwhile were left unread; pick up from here
+    conn_service(reactor, conn);
+}
+
+/**
+ * @brief Hands every record the appender committed back to its connection.
+ */
+static void reactor_committed(epoll_reactor_t *reactor)
+{
+    append_request_t *req = appender_completion_take(&reactor->appends);
+    append_request_t *next;
+
+    while(req != NULL)
+    {
+        next = req->completed_next;
+        conn_committed(reactor, (epoll_conn_t *)((char *)req - offsetof(epoll_conn_t, append)));
+        req = next;
+    }
+}
+
+/**
+ * @brief Evicts a replying connection that is past its write limits.
+ *
+ * Edge triggering only reports a socket as writable again once a large
+ * part of its buffer has drained, so a client reading slowly can have
+ * room for more long before the next edge. The reply is pushed once more
+ * and the limits are judged on what is left.
+ *
+ * @param reactor Reactor owning the connection.
+ * @param conn Connection in CONN_REPLYING; it may be released.
+ */
+static void conn_check_stalled(epoll_reactor_t *reactor, epoll_conn_t *conn)
+{
+    ssize_t count;
+
+    if(reply_wait_ms(conn->reply.length - conn->reply_off, conn->reply_start, conn->reply_progress) != 0)
+    {
+        return;
+    }
+
+    count = conn_send(conn);
+    if(count > 0)
+    {
+        conn->reply_progress = stats_now();
+    }
+    if((count == 0) || ((count > 0) &&
+       (reply_wait_ms(conn->reply.length - conn->reply_off, conn->reply_start, conn->reply_progress) != 0)))
+    {
+        conn_service(reactor, conn);
+        return;
+    }
+
+    if((count == ERROR) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+    {
+        log_msg(LOG_ERR, "Data transmission unsuccessful");
+    }
+    else
+    {
+        log_msg(LOG_INFO, "Evicted slow client: %s", conn->ip);
+        stats_add(STAT_CONN_EVICTED, 1);
+    }
+    conn_close(reactor, conn);
+}
+
+/**
+ * @brief Closes idle kept-alive connections and evicts stalled repliers.
+ *
+ * A connection waiting for a packet is idle once it has been quiet for
+ * the idle timeout, or HANDOFF_DRAIN_IDLE_SECS while draining; one being
+ * answered is judged by reply_wait_ms().
+ *
+ * @param reactor Reactor whose connections are checked.
+ */
+static void reactor_sweep(epoll_reactor_t *reactor)
+{
+    epoll_conn_t *conn = LIST_FIRST(&reactor->conn_head);
+    epoll_conn_t *next;
+    time_t now = monotonic_seconds();
+    int idle_secs = reactor->draining ? HANDOFF_DRAIN_IDLE_SECS : s_config.idle_timeout_secs;
+
+    while(conn != NULL)
+    {
+        next = LIST_NEXT(conn, conns);
+        if((s_config.keepalive || conn->binary) && (conn->state == CONN_RECEIVING) &&
+           (now - conn->last_active >= idle_secs))
+        {
+            log_msg(LOG_INFO, "Idle timeout: %s", conn->ip);
+            conn_close(reactor, conn);
+        }
+        else if(conn->state == CONN_REPLYING)
+        {
+            conn_check_stalled(reactor, conn);
+        }
+        conn = next;
+    }
+}
+
+/**
+ * @brief Stops accepting once the listener belongs to a successor.
+ *
+ * A loop's own SO_REUSEPORT listener is emptied and closed; the shared
+ * one just leaves this loop. Connections are left to finish; the sweep
+ * closes kept-alive ones sooner from now on.
+ *
+ * @param reactor Reactor to drain.
+ */
+static void reactor_drain(epoll_reactor_t *reactor)
+{
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, handoff_fd(), NULL);
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, reactor->listenFd, NULL);
+    if(reactor->ownsListener)
+    {
+        reactor_accept(reactor);
+        close(reactor->listenFd);
+        reactor->ownsListener = false;
+    }
+    reactor->draining = true;
+}
+
+/**
+ * @brief Opens another listener in the SO_REUSEPORT group of listen_fd.
+ *
+ * @param listen_fd Bound listener whose address is reused.
+ * @return Non-blocking listening socket, or ERROR.
+ */
+static int reactor_open_listener(int listen_fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    int yes = 1;
+    int fd;
+
+    if(getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to read listening address");
+        return ERROR;
+    }
+
+    fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to create socket");
+        return ERROR;
+    }
+
+    if((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == ERROR) ||
+       (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == ERROR) ||
+       (bind(fd, (struct sockaddr *)&addr, addr_len) == ERROR) ||
+       (listen(fd, s_config.backlog) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to open SO_REUSEPORT listener: %s", strerror(errno));
+        close(fd);
+        return ERROR;
+    }
+    return fd;
+}
+
+/**
+ * @brief Pins an event loop thread to one CPU, wrapping around the online CPUs.
+ */
+static void reactor_pin(epoll_reactor_t *reactor, int index)
+{
+    cpu_set_t cpus;
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&cpus);
+    CPU_SET(index % ((cpu_count > 0) ? cpu_count : 1), &cpus);
+    if(pthread_setaffinity_np(reactor->threadId, sizeof(cpus), &cpus) != 0)
+    {
+        log_msg(LOG_WARNING, "Failed to pin event loop %d to a CPU", index);
+    }
+}
+
+/**
+ * @brief Event loop thread body.
+ *
+ * @param arg Pointer to the epoll_reactor_t this thread runs.
+ * @return The reactor pointer on a clean exit, NULL on failure.
+ */
+static void *reactor_loop(void *arg)
+{
+    epoll_reactor_t *reactor = (epoll_reactor_t *)arg;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    bool committed = false;
+    int ready;
+    int i;
+
+    while(!fatal_error_in_progress && !atomic_load(&reactor->stopping) &&
+          !(reactor->draining && LIST_EMPTY(&reactor->conn_head)))
+    {
+        ready = epoll_wait(reactor->epollFd, events, EPOLL_MAX_EVENTS,
+                           (s_config.keepalive || (s_config.write_timeout_secs > 0)) ? EPOLL_IDLE_SWEEP_MS : -1);
+        if(ready == ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            log_msg(LOG_ERR, "epoll_wait failed");
+            return NULL;
+        }
+
+        for(i = 0; i < ready; i++)
+        {
+            if(events[i].data.ptr == NULL)
+            {
+                // A listener event may still be queued behind the handoff
+                if(!reactor->draining)
+                {
+                    reactor_accept(reactor);
+                }
+            }
+            else if(events[i].data.ptr == &timestamp_event)
+            {
+                timestamp_fire();
+            }
+            else if(events[i].data.ptr == &handoff_event)
+            {
+                reactor_drain(reactor);
+            }
+            else if(events[i].data.ptr == &append_event)
+            {
+                committed = true;
+            }
+            else if((events[i].data.ptr == &shutdown_event) || (events[i].data.ptr == &stop_event))
+            {
+                // Only wakes the loop; its condition sees the flag
+            }
+            else
+            {
+                conn_service(reactor, (epoll_conn_t *)events[i].data.ptr);
+            }
+        }
+
+        // A connection carried on here may close, so none of its events may be left in this batch
+        if(committed)
+        {
+            committed = false;
+            reactor_committed(reactor);
+        }
+
+        // At most once a second, however busy the loop is
+        if((s_config.keepalive || (s_config.write_timeout_secs > 0)) &&
+           (monotonic_seconds() != reactor->lastSweep))
+        {
+            reactor->lastSweep = monotonic_seconds();
+            reactor_sweep(reactor);
+        }
+    }
+
+    return reactor;
+}
+
+int epoll_reactor_run(int listen_fd, int thread_count, bool reuseport)
+{
+    epoll_reactor_t *reactors;
+    struct epoll_event event;
+    void *threadRetVal = NULL;
+    int ret_status = SUCCESS;
+    int started = 0;
+    int stop_fd;
+    int i;
+
+    reactors = calloc(thread_count, sizeof(epoll_reactor_t));
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if((reactors == NULL) || (stop_fd == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to allocate epoll reactors");
+        free(reactors);
+        if(stop_fd != ERROR)
+        {
+            close(stop_fd);
+        }
+        return ERROR;
+    }
+
+    for(i = 0; i < thread_count; i++)
+    {
+        reactors[i].listenFd = listen_fd;
+        atomic_init(&reactors[i].stopping, false);
+        LIST_INIT(&reactors[i].conn_head);
+        if(appender_completion_init(&reactors[i].appends) == ERROR)
+        {
+            ret_status = ERROR;
+            break;
+        }
+
+        // The first loop keeps listen_fd; the others join its SO_REUSEPORT group
+        if(reuseport && (i > 0))
+        {
+            reactors[i].listenFd = reactor_open_listener(listen_fd);
+            if(reactors[i].listenFd == ERROR)
+            {
+                ret_status = ERROR;
+                break;
+            }
+            reactors[i].ownsListener = true;
+        }
+
+        reactors[i].epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if(reactors[i].epollFd == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to create epoll instance");
+            ret_status = ERROR;
+            break;
+        }
+
+        // EPOLLEXCLUSIVE avoids waking every loop for one connection on a shared listener
+        event.events = reuseport ? EPOLLIN : (EPOLLIN | EPOLLEXCLUSIVE);
+        event.data.ptr = NULL;
+        if(epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, reactors[i].listenFd, &event) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to register listening socket with epoll");
+            close(reactors[i].epollFd);
+            ret_status = ERROR;
+            break;
+        }
+
+        // Timestamps are written by the first loop only
+        if((i == 0) && (timestamp_fd() != ERROR))
+        {
+            event.events = EPOLLIN;
+            event.data.ptr = &timestamp_event;
+            if(epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, timestamp_fd(), &event) == ERROR)
+            {
+                log_msg(LOG_ERR, "Failed to register timestamp timer with epoll");
+                close(reactors[i].epollFd);
+                ret_status = ERROR;
+                break;
+            }
+        }
+
+        // Every loop has to let go of its listener on a hot restart
+        if(handoff_fd() != ERROR)
+        {
+            event.events = EPOLLIN;
+            event.data.ptr = &handoff_event;
+            if(epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, handoff_fd(), &event) == ERROR)
+            {
+                log_msg(LOG_ERR, "Failed to register handoff event with epoll");
+                close(reactors[i].epollFd);
+                ret_status = ERROR;
+                break;
+            }
+        }
+
+        // Every loop has to wake up for a termination signal
+        if(shutdown_fd() != ERROR)
+        {
+            event.events = EPOLLIN;
+            event.data.ptr = &shutdown_event;
+            if(epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, shutdown_fd(), &event) == ERROR)
+            {
+                log_msg(LOG_ERR, "Failed to register shutdown event with epoll");
+                close(reactors[i].epollFd);
+                ret_status = ERROR;
+                break;
+            }
+        }
+
+        event.events = EPOLLIN;
+        event.data.ptr = &append_event;
+        if(epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, reactors[i].appends.eventFd, &event) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to register append completions with epoll");
+            close(reactors[i].epollFd);
+            ret_status = ERROR;
+            break;
+        }
+
+        event.events = EPOLLIN;
+        event.data.ptr = &stop_event;
+        if(epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, stop_fd, &event) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to register stop event with epoll");
+            close(reactors[i].epollFd);
+            ret_status = ERROR;
+            break;
+        }
+
+        if(pthread_create(&reactors[i].threadId, NULL, reactor_loop, &reactors[i]) != 0)
+        {
+            log_msg(LOG_ERR, "Failed to create event loop thread");
+            close(reactors[i].epollFd);
+            ret_status = ERROR;
+            break;
+        }
+        if(reuseport)
+        {
+            reactor_pin(&reactors[i], i);
+        }
+        started++;
+    }
+
+    // A loop that failed to start must not keep its listener in the group
+    if((i < thread_count) && reactors[i].ownsListener)
+    {
+        close(reactors[i].listenFd);
+    }
+    if(i < thread_count)
+    {
+        appender_completion_destroy(&reactors[i].appends);
+    }
+
+    if(ret_status == ERROR)
+    {
+        // Do not serve with fewer loops than asked for
+        log_msg(LOG_ERR, "Stopping %d event loop threads after a loop failed to start", started);
+        for(i = 0; i < started; i++)
+        {
+            atomic_store(&reactors[i].stopping, true);
+        }
+        if(eventfd_write(stop_fd, 1) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to wake event loops: %s", strerror(errno));
+        }
+    }
+    else
+    {
+        log_msg(LOG_INFO, "epoll reactor running with %d event loop threads%s", started,
+               reuseport ? ", one SO_REUSEPORT listener each" : "");
+    }
+
+    for(i = 0; i < started; i++)
+    {
+        if((pthread_join(reactors[i].threadId, &threadRetVal) != 0) || (threadRetVal == NULL))
+        {
+            ret_status = ERROR;
+        }
+
+        // Connections still committing own the requests the appender holds
+        appender_completion_destroy(&reactors[i].appends);
+        while(!LIST_EMPTY(&reactors[i].conn_head))
+        {
+            conn_close(&reactors[i], LIST_FIRST(&reactors[i].conn_head));
+        }
+        close(reactors[i].epollFd);
+        if(reactors[i].ownsListener)
+        {
+            close(reactors[i].listenFd);
+        }
+    }
+
+    close(stop_fd);
+    free(reactors);
+    return ret_status;
+}
@@ -0,0 +1,107 @@
+/****************************************************************
+ * @file      		aesdsocket-epoll.h
+ * @brief		    Edge-triggered epoll reactor for aesdsocket
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_EPOLL_H
+#define AESDSOCKET_EPOLL_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+#include "aesdsocket-assembler.h"
+#include "aesdsocket-history.h"
+#include "aesdsocket-admission.h"
+#include "aesdsocket-frame.h"
+#include "aesdsocket-appender.h"
+
+/****************   Macros     ***************/
+
+#define EPOLL_MAX_EVENTS    (64)
+// How often a reactor wakes up to look for idle and stalled connections
+#define EPOLL_IDLE_SWEEP_MS (1000)
+
+/**
+ * @enum conn_state_t
+ * @brief Stages a reactor connection moves through while serving one packet.
+ *
+ * With keep-alive, or on a framed connection, a finished reply goes back to
+ * CONN_RECEIVING, or straight to CONN_APPENDING when the next packet was
+ * already pipelined behind it.
+ */
+typedef enum
+{
+    CONN_RECEIVING,     /**< Gathering the packet until its newline, or whole frame, arrives */
+    CONN_APPENDING,     /**< A whole packet is buffered and must be committed to the store */
+    CONN_COMMITTING,    /**< Waiting for the appender to hand the queued record back */
+    CONN_REPLYING,      /**< Streaming the stored history back to the client */
+    CONN_CLOSING,       /**< Done, or failed; release the connection */
+} conn_state_t;
+
+/**
+ * @struct epoll_conn
+ * @brief Per-connection state machine owned by a single reactor thread.
+ */
+typedef struct epoll_conn
+{
+    int clientSocketFd;                 /**< Non-blocking client socket */
+    conn_state_t state;                 /**< Current stage of the connection */
+    off_t reply_off;                    /**< Next store offset to send */
+    history_snapshot_t reply;           /**< History snapshot the reply is sent from */
+    line_assembler_t assembler;         /**< Packet being received */
+    bool peer_closed;                   /**< Client shut down its sending side */
+    bool compress;                      /**< Client asked for LZ4 compressed history replies */
+    bool binary;                        /**< Connection opened with FRAME_MAGIC and speaks frames */
+    frame_header_t frame;               /**< Header of the frame being received */
+    frame_prefix_t prefix;              /**< Frame header sent ahead of the reply, empty for text */
+    int packets_served;                 /**< Replies completed on this connection */
+    time_t last_active;                 /**< Monotonic seconds of last traffic, for the idle timeout */
+    uint64_t receive_start;             /**< stats_now() at the packet's first byte, 0 if none yet */
+    uint64_t reply_start;               /**< stats_now() when the reply snapshot was taken */
+    uint64_t reply_progress;            /**< stats_now() when the client last took reply bytes */
+    char ip[INET6_ADDRSTRLEN];          /**< Printable peer address */
+    admission_source_t *source;         /**< Admission entry of the peer address, NULL if untracked */
+    append_request_t append;            /**< Record queued with the appender in CONN_COMMITTING */
+    size_t append_length;               /**< Assembler bytes the queued record covers */
+    bool append_partial;                /**< The record is a cut of a packet that never ends */
+
+    LIST_ENTRY(epoll_conn) conns;
+} epoll_conn_t;
+
+/**
+ * @struct epoll_reactor_t
+ * @brief One event loop thread with its own epoll instance.
+ */
+typedef struct epoll_reactor
+{
+    pthread_t threadId;                 /**< Thread running the event loop */
+    int epollFd;                        /**< epoll instance for this loop */
+    int listenFd;                       /**< Non-blocking listening socket, shared or per loop */
+    bool ownsListener;                  /**< listenFd is this loop's own SO_REUSEPORT socket */
+    time_t lastSweep;                   /**< Monotonic second of the last idle/stall sweep */
+    bool draining;                      /**< Listener handed to a successor; exit once conn_head is empty */
+    atomic_bool stopping;               /**< A later loop failed to start; exit right away */
+    append_completion_t appends;        /**< Committed records of this loop's connections */
+
+    LIST_HEAD(conn_list, epoll_conn) conn_head;  /**< Connections owned by this loop */
+} epoll_reactor_t;
+
+/**
+ * @brief Serves clients from a fixed set of epoll event loop threads.
+ *
+ * By default all loops share listen_fd. With reuseport every loop after
+ * the first opens its own SO_REUSEPORT listener on the same address, so
+ * the kernel spreads connections across them without a shared accept
+ * queue, and each loop is pinned to one CPU.
+ *
+ * @param listen_fd Listening socket, already non-blocking.
+ *        For reuseport it must have SO_REUSEPORT set before bind().
+ * @param thread_count Number of event loop threads to run.
+ * @param reuseport Give each loop its own listener and CPU.
+ * @return SUCCESS once all loops exit, ERROR on setup failure; loops
+ *         already running when a later one fails to start are stopped
+ *         and joined first.
+ */
+int epoll_reactor_run(int listen_fd, int thread_count, bool reuseport);
+
+#endif // AESDSOCKET_EPOLL_H
@@ -0,0 +1,227 @@
+/***********************************************************************
+ * @file      		aesdsocket-frame.c
+ * @version   		0.1
+ * @brief		    Length-prefixed binary framing
+ *
+ * The text protocol ends a record at its newline, so every received
+ * chunk is scanned for one, and every packet is compared against each
+ * command prefix and a seek is parsed with sscanf(). A connection whose
+ * first byte is FRAME_MAGIC speaks frames instead: an 8 byte header with
+ * an opcode and the payload length, then exactly that many payload
+ * bytes. The receive buffer is sized from the header and the opcode
+ * selects the request directly.
+ *
+ * Framing only delimits the request; the store still splits records at
+ * newlines. An append payload is therefore one record: it has to end
+ * with its only newline, which is checked with a single memchr() before
+ * it is stored.
+ *
+ * Replies carry the same header, with FRAME_REPLY set in the opcode and
+ * the reply length, so a framed connection always stays open for the
+ * next request and the client never has to search the reply.
+ *
+ * All integers are big-endian.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <endian.h>
+#include "aesdsocket-frame.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-admission.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @brief Fills the reply header for len payload bytes.
+ */
+static void frame_put_header(char *out, uint8_t opcode, uint32_t len)
+{
+    uint32_t be_len = htobe32(len);
+
+    out[0] = (char)opcode;
+    out[1] = out[2] = out[3] = 0;
+    memcpy(out + 4, &be_len, sizeof(be_len));
+}
+
+int frame_complete(const line_assembler_t *asmb, frame_header_t *hdr)
+{
+    const uint8_t *buf = (const uint8_t *)asmb->buf;
+    uint32_t be_len;
+    uint32_t fixed_len;
+
+    if(asmb->len < FRAME_HEADER_LEN)
+    {
+        return 0;
+    }
+
+    hdr->opcode = buf[0];
+    memcpy(&be_len, buf + 4, sizeof(be_len));
+    hdr->length = be32toh(be_len);
+
+    switch(hdr->opcode)
+    {
+    case FRAME_OP_APPEND:
+        fixed_len = hdr->length;
+        break;
+    case FRAME_OP_SEEK:
+        fixed_len = FRAME_SEEK_LEN;
+        break;
+    case FRAME_OP_READ:
+        fixed_len = FRAME_RANGE_LEN;
+        break;
+    case FRAME_OP_STATS:
+        fixed_len = 0;
+        break;
+    default:
+        return ERROR;
+    }
+    if((buf[1] != 0) || (buf[2] != 0) || (buf[3] != 0) ||
+       (hdr->length != fixed_len) || (hdr->length > FRAME_MAX_PAYLOAD))
+    {
+        return ERROR;
+    }
+
+    return (asmb->len >= frame_size(hdr)) ? FRAME_COMPLETE : 0;
+}
+
+size_t frame_size(const frame_header_t *hdr)
+{
+    return FRAME_HEADER_LEN + (size_t)hdr->length;
+}
+
+/**
+ * @brief Completes the reply header once the reply snapshot is taken.
+ */
+static void frame_reply_header(const frame_header_t *hdr, history_snapshot_t *snap, off_t *reply_offset,
+                               frame_prefix_t *prefix)
+{
+    size_t reply_len;
+
+    // The reply length has to fit the header; a history beyond 4 GiB is cut short
+    reply_len = ((*reply_offset >= 0) && ((size_t)*reply_offset < snap->length)) ? snap->length - *reply_offset : 0;
+    if(reply_len > UINT32_MAX - (prefix->len - FRAME_HEADER_LEN))
+    {
+        reply_len = UINT32_MAX - (prefix->len - FRAME_HEADER_LEN);
+        snap->length = *reply_offset + reply_len;
+    }
+    frame_put_header(prefix->bytes, hdr->opcode | FRAME_REPLY, reply_len + (prefix->len - FRAME_HEADER_LEN));
+    prefix->more = (reply_len > 0);
+}
+
+int frame_request(const frame_header_t *hdr, const char *payload, admission_source_t *source,
+                  history_snapshot_t *snap, off_t *reply_offset, frame_prefix_t *prefix,
+                  append_request_t *async)
+{
+    uint64_t start = stats_now();
+    struct aesd_seekto seekto;
+    uint32_t be32[2];
+    uint64_t be64[2];
+
+    stats_add(STAT_FRAMES, 1);
+    *reply_offset = 0;
+    prefix->len = FRAME_HEADER_LEN;
+    prefix->sent = 0;
+
+    switch(hdr->opcode)
+    {
+    case FRAME_OP_APPEND:
+        // Anything else would store a partial record or several at once
+        if((hdr->length > 0) && ((payload[hdr->length - 1] != '\n') ||
+                                 (memchr(payload, '\n', hdr->length - 1) != NULL)))
+        {
+            log_msg(LOG_ERR, "Framed append is not exactly one newline-terminated record");
+            return ERROR;
+        }
+        stats_record(STAT_PHASE_PARSE, start);
+        if(admission_charge(source, 1, hdr->length) == ERROR)
+        {
+            return ERROR;
+        }
+        if((async != NULL) && (hdr->length > 0))
+        {
+            if(store_append_async(async, payload, hdr->length))
+            {
+                return FRAME_APPENDING;
+            }
+            if(async->result == ERROR)
+            {
+                return ERROR;
+            }
+        }
+        else if((hdr->length > 0) && (store_append(payload, hdr->length) == ERROR))
+        {
+            return ERROR;
+        }
+        history_acquire(snap);
+        break;
+
+    case FRAME_OP_SEEK:
+        memcpy(be32, payload, sizeof(be32));
+        seekto.write_cmd = be32toh(be32[0]);
+        seekto.write_cmd_offset = be32toh(be32[1]);
+        stats_record(STAT_PHASE_PARSE, start);
+        if(store_seek(&seekto, reply_offset) == ERROR)
+        {
+            log_msg(LOG_ERR, "Seek command rejected");
+            *reply_offset = 0;
+        }
+        history_acquire(snap);
+        break;
+
+    case FRAME_OP_READ:
+        memcpy(be64, payload, sizeof(be64));
+        stats_record(STAT_PHASE_PARSE, start);
+        // A range that does not fit the length field is cut short; next says where it stopped
+        history_acquire_range(snap, (off_t)be64toh(be64[0]),
+                              ((be64toh(be64[1]) > 0) && (be64toh(be64[1]) < UINT32_MAX - FRAME_RANGE_LEN)) ?
+                              be64toh(be64[1]) : UINT32_MAX - FRAME_RANGE_LEN);
+        be64[0] = htobe64(snap->origin);
+        be64[1] = htobe64(snap->origin + snap->length);
+        memcpy(prefix->bytes + FRAME_HEADER_LEN, be64, sizeof(be64));
+        prefix->len += FRAME_RANGE_LEN;
+        break;
+
+    default:
+        stats_record(STAT_PHASE_PARSE, start);
+        if(stats_acquire(snap) == ERROR)
+        {
+            return ERROR;
+        }
+        break;
+    }
+
+    frame_reply_header(hdr, snap, reply_offset, prefix);
+    return SUCCESS;
+}
+
+int frame_append_done(const frame_header_t *hdr, append_request_t *async,
+                      history_snapshot_t *snap, off_t *reply_offset, frame_prefix_t *prefix)
+{
+    if(store_append_finish(async) == ERROR)
+    {
+        return ERROR;
+    }
+    history_acquire(snap);
+    frame_reply_header(hdr, snap, reply_offset, prefix);
+    return SUCCESS;
+}
+
+ssize_t frame_prefix_send(int socket_fd, frame_prefix_t *prefix)
+{
+    ssize_t bytes_sent;
+
+    if(prefix->sent >= prefix->len)
+    {
+        return 0;
+    }
+
+    // MSG_MORE lets the header leave in one segment with the start of the payload
+    bytes_sent = send(socket_fd, prefix->bytes + prefix->sent, prefix->len - prefix->sent,
+                      MSG_NOSIGNAL | MSG_DONTWAIT | (prefix->more ? MSG_MORE : 0));
+    if(bytes_sent > 0)
+    {
+        prefix->sent += bytes_sent;
+        stats_add(STAT_BYTES_OUT, bytes_sent);
+    }
+    return bytes_sent;
+}
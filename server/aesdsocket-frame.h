@@ -0,0 +1,124 @@
+/****************************************************************
+ * @file      		aesdsocket-frame.h
+ * @brief		    Length-prefixed binary framing
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_FRAME_H
+#define AESDSOCKET_FRAME_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+#include "aesdsocket-assembler.h"
+#include "aesdsocket-history.h"
+
+/****************   Macros     ***************/
+
+// First byte of a connection that speaks frames instead of text lines
+#define FRAME_MAGIC             (0xAE)
+// opcode, three zero bytes, payload length as big-endian uint32
+#define FRAME_HEADER_LEN        (8)
+// Largest request payload; larger frames close the connection
+#define FRAME_MAX_PAYLOAD       (ASSEMBLER_MAX_PENDING)
+// Set in the opcode of a reply
+#define FRAME_REPLY             (0x80)
+// Payload of a seek request: write_cmd and write_cmd_offset, big-endian uint32
+#define FRAME_SEEK_LEN          (8)
+// Payload of a read request, and prefix of its reply: two big-endian uint64
+#define FRAME_RANGE_LEN         (16)
+
+// frame_complete() result: header and payload are buffered
+#define FRAME_COMPLETE          (1)
+// frame_request() result: the append was queued; see frame_append_done()
+#define FRAME_APPENDING         (2)
+
+/**
+ * @enum frame_op_t
+ * @brief Request opcodes.
+ */
+typedef enum
+{
+    FRAME_OP_APPEND = 1,    /**< Payload is one record ending in its only newline; reply is the history */
+    FRAME_OP_SEEK = 2,      /**< AESDCHAR_IOCSEEKTO; reply is the history from the new offset */
+    FRAME_OP_READ = 3,      /**< Cursor and length; reply is first position, next cursor and the bytes */
+    FRAME_OP_STATS = 4,     /**< Reply is the statistics report */
+} frame_op_t;
+
+/**
+ * @struct frame_header_t
+ * @brief Decoded request header.
+ */
+typedef struct
+{
+    uint8_t opcode;         /**< One of frame_op_t */
+    uint32_t length;        /**< Payload bytes after the header */
+} frame_header_t;
+
+/**
+ * @struct frame_prefix_t
+ * @brief Reply header, and range for a read, sent ahead of the snapshot.
+ */
+typedef struct
+{
+    char bytes[FRAME_HEADER_LEN + FRAME_RANGE_LEN];
+    size_t len;             /**< Bytes of the prefix */
+    size_t sent;            /**< Bytes of it already sent */
+    bool more;              /**< Reply bytes follow the prefix */
+} frame_prefix_t;
+
+/**
+ * @brief Checks whether a whole request frame is buffered.
+ *
+ * Only the fixed-size header is looked at; the payload is never scanned.
+ *
+ * @param asmb Receive buffer, starting at a frame boundary.
+ * @param[out] hdr Decoded header, valid once enough bytes are buffered.
+ * @return FRAME_COMPLETE, 0 if more bytes are needed, or ERROR for a
+ *         malformed header; the connection must then be closed.
+ */
+int frame_complete(const line_assembler_t *asmb, frame_header_t *hdr);
+
+/**
+ * @brief Bytes the whole frame needs, to size the receive buffer up front.
+ */
+size_t frame_size(const frame_header_t *hdr);
+
+/**
+ * @brief Executes one request and takes the snapshot that answers it.
+ *
+ * @param hdr Header from frame_complete().
+ * @param payload The hdr->length payload bytes.
+ * @param source Admission entry of the sender, charged for appends.
+ * @param[out] snap Reply snapshot; release it with history_release().
+ * @param[out] reply_offset Offset in snap the reply starts from.
+ * @param[out] prefix Reply header to send before the snapshot.
+ * @param async Request an event loop queues an append on instead of
+ *        waiting for it (see store_append_async()), NULL to wait.
+ * @return SUCCESS, FRAME_APPENDING, or ERROR if the append payload was
+ *         not one record, the append failed or it was over the sender's
+ *         rate limit.
+ */
+int frame_request(const frame_header_t *hdr, const char *payload, struct admission_source *source,
+                  history_snapshot_t *snap, off_t *reply_offset, frame_prefix_t *prefix,
+                  struct append_request *async);
+
+/**
+ * @brief Takes the reply of an append that frame_request() queued, once
+ *        async has been handed back.
+ *
+ * @return SUCCESS, or ERROR if the append failed.
+ */
+int frame_append_done(const frame_header_t *hdr, struct append_request *async,
+                      history_snapshot_t *snap, off_t *reply_offset, frame_prefix_t *prefix);
+
+/**
+ * @brief Sends what is left of a reply prefix.
+ *
+ * Never blocks; the payload is expected to follow right after.
+ *
+ * @return Bytes sent, 0 once the whole prefix is out, or ERROR with
+ *         errno set (EAGAIN when the socket is full).
+ */
+ssize_t frame_prefix_send(int socket_fd, frame_prefix_t *prefix);
+
+#endif // AESDSOCKET_FRAME_H
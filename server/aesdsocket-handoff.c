@@ -0,0 +1,446 @@
+/***********************************************************************
+ * @file      		aesdsocket-handoff.c
+ * @version   		0.1
+ * @brief		    Hot restart: listening socket handoff between processes
+ *
+ * Restarting used to mean closing the listener and binding a new one,
+ * and connections arriving in between were refused. Now a running
+ * server answers on a UNIX socket in the abstract namespace: a new
+ * process started with -R connects there instead of binding, receives
+ * the listening socket with SCM_RIGHTS and, once it is ready to accept,
+ * sends HANDOFF_MSG_READY back. The listener itself never closes, so
+ * connections keep queueing on it throughout.
+ *
+ * On ready the old process stops accepting, lets its open connections
+ * finish their current packet and exits. The new process keeps its end
+ * of the UNIX socket; it reads EOF once the old one is gone and then
+ * reloads its history mirror, which did not see the appends the old
+ * process made while draining.
+ *
+ * The name is released while a successor starts, so it can bind it in
+ * turn. If the successor never reports ready the old process binds the
+ * name again and carries on.
+ ************************************************************************/
+/****************   Includes    ***************/
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-timestamp.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct handoff_t
+ * @brief Handoff thread, its descriptors and the drain flag.
+ */
+typedef struct
+{
+    pthread_t threadId;         /**< Answers successors, later waits for the predecessor to exit */
+    bool running;               /**< threadId was started */
+    int serverFd;               /**< Named UNIX listener, ERROR while released */
+    int peerFd;                 /**< Predecessor connection after handoff_receive(), else ERROR */
+    int listenFd;               /**< TCP listener offered to successors */
+    int doneFd;                 /**< eventfd, readable from the handoff on, never read */
+    int stopFd;                 /**< eventfd waking the thread for handoff_stop() */
+    atomic_bool done;           /**< The listener belongs to a successor */
+} handoff_t;
+
+/****************   Global Variables     ***************/
+static handoff_t handoff = {
+    .serverFd = ERROR,
+    .peerFd = ERROR,
+    .listenFd = ERROR,
+    .doneFd = ERROR,
+    .stopFd = ERROR,
+};
+
+/**
+ * @brief Fills addr with HANDOFF_SOCKET_NAME in the abstract namespace.
+ *
+ * @return Address length to pass to bind() or connect().
+ */
+static socklen_t handoff_address(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // A leading NUL selects the abstract namespace
+    memcpy(addr->sun_path + 1, HANDOFF_SOCKET_NAME, strlen(HANDOFF_SOCKET_NAME));
+    return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(HANDOFF_SOCKET_NAME);
+}
+
+/**
+ * @brief Binds and listens on the handoff name.
+ *
+ * @return SUCCESS, or ERROR if the name is taken or sockets fail.
+ */
+static int handoff_bind(void)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = handoff_address(&addr);
+
+    handoff.serverFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(handoff.serverFd == ERROR)
+    {
+        return ERROR;
+    }
+    if((bind(handoff.serverFd, (struct sockaddr *)&addr, addr_len) == ERROR) ||
+       (listen(handoff.serverFd, 1) == ERROR))
+    {
+        close(handoff.serverFd);
+        handoff.serverFd = ERROR;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Closes doneFd when hot restart could not start.
+ */
+static void handoff_close_done(void)
+{
+    if(handoff.doneFd != ERROR)
+    {
+        close(handoff.doneFd);
+        handoff.doneFd = ERROR;
+    }
+}
+
+/**
+ * @brief Waits until fd is readable or handoff_stop() is called.
+ *
+ * @param timeout_ms poll() timeout.
+ * @return SUCCESS when fd is readable, ERROR on stop, timeout or failure.
+ */
+static int handoff_poll(int fd, int timeout_ms)
+{
+    struct pollfd fds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = handoff.stopFd, .events = POLLIN },
+    };
+    int ret;
+
+    do
+    {
+        ret = poll(fds, 2, timeout_ms);
+    } while((ret == ERROR) && (errno == EINTR));
+
+    if((ret <= 0) || (fds[1].revents != 0))
+    {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Only the same user, or root, may take the server over.
+ */
+static bool handoff_peer_allowed(int conn_fd)
+{
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+
+    if(getsockopt(conn_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == ERROR)
+    {
+        return false;
+    }
+    return (cred.uid == 0) || (cred.uid == geteuid());
+}
+
+/**
+ * @brief Sends the listener to a successor and waits for it to be ready.
+ *
+ * The name is released first so the successor can bind it.
+ *
+ * @return SUCCESS once the successor reported ready.
+ */
+static int handoff_offer(int conn_fd)
+{
+    char msg = HANDOFF_MSG_LISTENER;
+    struct iovec iov = { .iov_base = &msg, .iov_len = 1 };
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg;
+
+    memset(&control, 0, sizeof(control));
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &handoff.listenFd, sizeof(int));
+
+    close(handoff.serverFd);
+    handoff.serverFd = ERROR;
+
+    if(sendmsg(conn_fd, &hdr, MSG_NOSIGNAL) != 1)
+    {
+        log_msg(LOG_ERR, "Failed to send listener to successor");
+        return ERROR;
+    }
+
+    if((handoff_poll(conn_fd, HANDOFF_READY_TIMEOUT_MS) == ERROR) ||
+       (recv(conn_fd, &msg, 1, 0) != 1) || (msg != HANDOFF_MSG_READY))
+    {
+        log_msg(LOG_ERR, "Successor did not become ready, continuing to serve");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Handoff thread: answers successors until one takes over.
+ *
+ * In a process that took over itself, it first waits for the
+ * predecessor to exit and resyncs the history mirror.
+ */
+static void *handoff_thread(void *arg)
+{
+    uint64_t one = 1;
+    char byte;
+    int conn_fd;
+
+    (void)arg;
+
+    if(handoff.peerFd != ERROR)
+    {
+        if((handoff_poll(handoff.peerFd, -1) == SUCCESS) && (recv(handoff.peerFd, &byte, 1, 0) <= 0))
+        {
+            log_msg(LOG_INFO, "Previous server exited, resyncing history");
+            store_resync();
+        }
+        close(handoff.peerFd);
+        handoff.peerFd = ERROR;
+    }
+
+    for(;;)
+    {
+        if((handoff.serverFd == ERROR) && (handoff_bind() == ERROR))
+        {
+            log_msg(LOG_ERR, "Failed to bind hot restart socket, hot restart disabled");
+            break;
+        }
+        if(handoff_poll(handoff.serverFd, -1) == ERROR)
+        {
+            break;
+        }
+
+        conn_fd = accept4(handoff.serverFd, NULL, NULL, SOCK_CLOEXEC);
+        if(conn_fd == ERROR)
+        {
+            continue;
+        }
+        if(!handoff_peer_allowed(conn_fd))
+        {
+            log_msg(LOG_ERR, "Hot restart refused to a different user");
+            close(conn_fd);
+            continue;
+        }
+
+        if(handoff_offer(conn_fd) == SUCCESS)
+        {
+            log_msg(LOG_INFO, "Listener handed to successor, draining");
+            atomic_store(&handoff.done, true);
+            if(write(handoff.doneFd, &one, sizeof(one)) != sizeof(one))
+            {
+                log_msg(LOG_ERR, "Failed to signal handoff");
+            }
+            // The successor resyncs once this connection closes with the process
+            break;
+        }
+        close(conn_fd);
+    }
+
+    if(handoff.serverFd != ERROR)
+    {
+        close(handoff.serverFd);
+        handoff.serverFd = ERROR;
+    }
+    return NULL;
+}
+
+int handoff_receive(int *listen_fd)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = handoff_address(&addr);
+    char msg = 0;
+    struct iovec iov = { .iov_base = &msg, .iov_len = 1 };
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg;
+    int conn_fd;
+
+    conn_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(conn_fd == ERROR)
+    {
+        return ERROR;
+    }
+    if(connect(conn_fd, (struct sockaddr *)&addr, addr_len) == ERROR)
+    {
+        log_msg(LOG_INFO, "No running server to take over from");
+        close(conn_fd);
+        return ERROR;
+    }
+
+    if(recvmsg(conn_fd, &hdr, MSG_CMSG_CLOEXEC) != 1)
+    {
+        log_msg(LOG_ERR, "Failed to receive listener from running server");
+        close(conn_fd);
+        return ERROR;
+    }
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    if((msg != HANDOFF_MSG_LISTENER) || (cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) ||
+       (cmsg->cmsg_type != SCM_RIGHTS) || (cmsg->cmsg_len != CMSG_LEN(sizeof(int))))
+    {
+        log_msg(LOG_ERR, "Malformed handoff from running server");
+        close(conn_fd);
+        return ERROR;
+    }
+    memcpy(listen_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    handoff.peerFd = conn_fd;
+    log_msg(LOG_INFO, "Took listener over from running server");
+    return SUCCESS;
+}
+
+int handoff_start(int listen_fd)
+{
+    char msg = HANDOFF_MSG_READY;
+
+    handoff.listenFd = listen_fd;
+    handoff.doneFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    handoff.stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if((handoff.doneFd == ERROR) || (handoff.stopFd == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to create handoff events");
+        handoff_stop();
+        handoff_close_done();
+        return ERROR;
+    }
+
+    // The predecessor released the name before sending the listener
+    if(handoff_bind() == ERROR)
+    {
+        log_msg(LOG_WARNING, "Hot restart socket busy, will retry");
+    }
+
+    // From here the predecessor stops accepting, so this process must be about to
+    if((handoff.peerFd != ERROR) && (send(handoff.peerFd, &msg, 1, MSG_NOSIGNAL) != 1))
+    {
+        log_msg(LOG_ERR, "Failed to report ready to previous server");
+    }
+
+    if(pthread_create(&handoff.threadId, NULL, handoff_thread, NULL) != 0)
+    {
+        log_msg(LOG_ERR, "Failed to create handoff thread");
+        handoff_stop();
+        handoff_close_done();
+        return ERROR;
+    }
+    handoff.running = true;
+    return SUCCESS;
+}
+
+void handoff_stop(void)
+{
+    uint64_t one = 1;
+
+    if(handoff.running)
+    {
+        if(write(handoff.stopFd, &one, sizeof(one)) != sizeof(one))
+        {
+            log_msg(LOG_ERR, "Failed to stop handoff thread");
+        }
+        pthread_join(handoff.threadId, NULL);
+        handoff.running = false;
+    }
+
+    if(handoff.serverFd != ERROR)
+    {
+        close(handoff.serverFd);
+        handoff.serverFd = ERROR;
+    }
+    if(handoff.peerFd != ERROR)
+    {
+        close(handoff.peerFd);
+        handoff.peerFd = ERROR;
+    }
+    if(handoff.stopFd != ERROR)
+    {
+        close(handoff.stopFd);
+        handoff.stopFd = ERROR;
+    }
+    // doneFd stays open: event loops may still be registered on it
+}
+
+int handoff_fd(void)
+{
+    return handoff.doneFd;
+}
+
+bool handoff_done(void)
+{
+    return atomic_load(&handoff.done);
+}
+
+int handoff_wait_listener(int listen_fd)
+{
+    struct pollfd fds[4] = {
+        { .fd = listen_fd, .events = POLLIN },
+        { .fd = timestamp_fd(), .events = POLLIN },
+        { .fd = handoff.doneFd, .events = POLLIN },
+        { .fd = shutdown_fd(), .events = POLLIN },
+    };
+
+    for(;;)
+    {
+        if(handoff_done())
+        {
+            return HANDOFF_DRAINING;
+        }
+        // Negative descriptors are ignored by poll()
+        if(poll(fds, 4, -1) == ERROR)
+        {
+            return ERROR;
+        }
+        // Termination signal: the caller's loop sees fatal_error_in_progress
+        if(fatal_error_in_progress)
+        {
+            errno = EINTR;
+            return ERROR;
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            timestamp_fire();
+        }
+        if(fds[2].revents != 0)
+        {
+            return HANDOFF_DRAINING;
+        }
+        // Errors and hang-ups are left for accept() to report; readiness is
+        // only a hint, the non-blocking accept() may still find nothing
+        if(fds[0].revents != 0)
+        {
+            return SUCCESS;
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/****************************************************************
+ * @file      		aesdsocket-handoff.h
+ * @brief		    Hot restart: listening socket handoff between processes
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_HANDOFF_H
+#define AESDSOCKET_HANDOFF_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+// UNIX socket in the abstract namespace, so no file is left behind
+#define HANDOFF_SOCKET_NAME         "aesdsocket-handoff-9000"
+// How long a running server waits for its successor to report ready
+#define HANDOFF_READY_TIMEOUT_MS    (10000)
+// Idle timeout of kept-alive connections once the listener is handed off
+#define HANDOFF_DRAIN_IDLE_SECS     (2)
+// Message bytes: listener enclosed (old to new), ready to accept (new to old)
+#define HANDOFF_MSG_LISTENER        'L'
+#define HANDOFF_MSG_READY           'R'
+
+// handoff_wait_listener() result: the listener now belongs to a successor
+#define HANDOFF_DRAINING            (1)
+
+/**
+ * @brief Takes the listening socket over from a running aesdsocket.
+ *
+ * Used by a process started with -R instead of getaddrinfo() and bind().
+ * The running process keeps accepting until handoff_start() reports this
+ * one ready.
+ *
+ * @param[out] listen_fd Received listening socket.
+ * @return SUCCESS, or ERROR if no server is running or the handoff failed.
+ */
+int handoff_receive(int *listen_fd);
+
+/**
+ * @brief Starts answering hot restart requests for listen_fd.
+ *
+ * After a successful handoff_receive() this also tells the predecessor
+ * that this process is about to accept, upon which it drains and exits;
+ * once it is gone the history mirror is resynced with the store.
+ *
+ * @param listen_fd Listening socket to hand to a successor.
+ * @return SUCCESS or ERROR; serving continues without hot restart on ERROR.
+ */
+int handoff_start(int listen_fd);
+
+/**
+ * @brief Stops answering hot restart requests.
+ */
+void handoff_stop(void);
+
+/**
+ * @brief Readable file descriptor once the listener has been handed off.
+ *
+ * Event loops watch it next to their listener to start draining.
+ *
+ * @return The descriptor, or ERROR if hot restart is not running.
+ */
+int handoff_fd(void);
+
+/**
+ * @brief Whether the listener has been handed to a successor.
+ *
+ * From then on no connection may be accepted; open connections finish
+ * their current packet and close, kept-alive ones once they idle for
+ * HANDOFF_DRAIN_IDLE_SECS.
+ */
+bool handoff_done(void);
+
+/**
+ * @brief Blocks until listen_fd is readable, writing timestamps meanwhile.
+ *
+ * Lets the accept() loops of the thread and pool modes drive the
+ * timestamp timer and notice a handoff. The listener is non-blocking, so
+ * an accept() after SUCCESS that fails with EAGAIN just waits again.
+ *
+ * @param listen_fd Listening socket.
+ * @return SUCCESS once listen_fd is ready, HANDOFF_DRAINING once it has
+ *         been handed off, or ERROR with errno set; EINTR also once a
+ *         termination signal woke shutdown_fd().
+ */
+int handoff_wait_listener(int listen_fd);
+
+#endif // AESDSOCKET_HANDOFF_H
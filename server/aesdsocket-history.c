@@ -0,0 +1,420 @@
+/***********************************************************************
+ * @file      		aesdsocket-history.c
+ * @version   		0.1
+ * @brief		    In-memory mirror of the data store used for replies
+ *
+ * Every reply used to read the whole store back, so its cost grew with
+ * the history in syscalls and (for the char device) driver copies. The
+ * mirror keeps the same bytes in memory. It is updated in the critical
+ * section of each append, reloaded from the store at startup, on a hot
+ * restart and when a seek finds that another process changed the store's
+ * length, and replies are sent straight from a snapshot of it.
+ *
+ * For the aesdchar device the mirror reproduces the driver's behaviour:
+ * a write only becomes visible once its newline arrives, and the oldest
+ * of AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries is evicted when a
+ * new one completes, so replies stay byte-identical to a device read.
+ * The entry table is the driver's own aesd_circular_buffer, so cursor
+ * lookups go through aesd_circular_buffer_find_entry_offset_for_fpos()
+ * exactly as a read() on the device does.
+ *
+ * Every visible byte also has a stream position that keeps growing
+ * across evictions and reloads. AESDSOCKET_READFROM replies carry only
+ * the bytes after a client's cursor, tagged with the cursor to resume
+ * from, so a polling client no longer receives the whole history again.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include "aesdsocket-history.h"
+#include "aesdsocket-ring.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct history_t
+ * @brief Mirror state; changed with the global lock held for writing and
+ *        read with it held for reading.
+ */
+typedef struct
+{
+    history_block_t *block;     /**< Current backing block */
+    size_t start;               /**< First visible byte in block */
+    size_t visible;             /**< End of the visible bytes in block */
+    size_t pending;             /**< Bytes after visible still waiting for a newline */
+    bool bounded;               /**< Follow the driver's entry semantics */
+    size_t capacity;            /**< Most visible bytes, bounded mode only, 0 no limit */
+    struct aesd_circular_buffer entries;  /**< Visible entry sizes, bounded mode only */
+    off_t origin;               /**< Stream position of the first visible byte */
+    unsigned long generation;   /**< Bumped whenever the visible bytes change */
+} history_t;
+
+/****************   Global Variables     ***************/
+static history_t history;
+
+static void block_put(history_block_t *block)
+{
+    if((block != NULL) && (atomic_fetch_sub(&block->refcount, 1) == 1))
+    {
+        free(block);
+    }
+}
+
+/**
+ * @brief Makes room for extra more bytes after the pending data.
+ *
+ * Live bytes move to a new block at position 0; evicted bytes in front of
+ * start are dropped on the way.
+ *
+ * @return SUCCESS or ERROR on allocation failure.
+ */
+static int history_reserve(size_t extra)
+{
+    history_block_t *new_block;
+    size_t live = history.visible + history.pending - history.start;
+    size_t cap = HISTORY_MIN_BLOCK;
+
+    if((history.block != NULL) && (history.visible + history.pending + extra <= history.block->cap))
+    {
+        return SUCCESS;
+    }
+
+    while(cap < 2 * (live + extra))
+    {
+        cap *= 2;
+    }
+
+    new_block = malloc(sizeof(history_block_t) + cap);
+    if(new_block == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to grow history mirror to %zu bytes", cap);
+        return ERROR;
+    }
+    atomic_init(&new_block->refcount, 1);
+    new_block->cap = cap;
+
+    if(live > 0)
+    {
+        memcpy(new_block->data, history.block->data + history.start, live);
+    }
+    block_put(history.block);
+
+    history.block = new_block;
+    history.visible -= history.start;
+    history.start = 0;
+    return SUCCESS;
+}
+
+/**
+ * @brief Makes a completed write of length bytes visible, evicting the
+ *        oldest entry first if the driver would.
+ */
+static void history_complete_entry(size_t length)
+{
+    // The bytes live in the block; the table only tracks entry sizes
+    struct aesd_buffer_entry entry = { .buffptr = NULL, .size = length };
+    size_t evicted;
+
+    if(history.entries.full)
+    {
+        evicted = history.entries.entry[history.entries.out_offs].size;
+        history.start += evicted;
+        history.origin += evicted;
+    }
+    aesd_circular_buffer_add_entry(&history.entries, &entry);
+
+    history.visible += length;
+    history.pending -= length;
+
+    // Same rule as the ring backend: drop the oldest while over capacity, never the newest
+    while((history.capacity > 0) && (history.visible - history.start > history.capacity) &&
+          (ring_entry_count(&history.entries) > 1))
+    {
+        evicted = ring_evict_oldest(&history.entries).size;
+        history.start += evicted;
+        history.origin += evicted;
+    }
+}
+
+void history_init(bool bounded, size_t capacity)
+{
+    history_destroy();
+    history.bounded = bounded;
+    history.capacity = capacity;
+}
+
+void history_destroy(void)
+{
+    block_put(history.block);
+    memset(&history, 0, sizeof(history));
+}
+
+void history_trim(size_t length)
+{
+    size_t visible = history.visible - history.start;
+
+    if(history.bounded || (visible <= length))
+    {
+        return;
+    }
+    history.start += visible - length;
+    history.origin += visible - length;
+    history.generation++;
+}
+
+off_t history_length(void)
+{
+    return history.visible - history.start;
+}
+
+int history_append(const char *buf, size_t len)
+{
+    const char *newline;
+    size_t scanned = 0;
+
+    if(len == 0)
+    {
+        return SUCCESS;
+    }
+
+    if(history_reserve(len) == ERROR)
+    {
+        return ERROR;
+    }
+
+    memcpy(history.block->data + history.visible + history.pending, buf, len);
+    history.pending += len;
+
+    if(!history.bounded)
+    {
+        history.visible += history.pending;
+        history.pending = 0;
+    }
+    else
+    {
+        // Each newline closes one driver entry, together with the bytes pending before it
+        while((newline = memchr(buf + scanned, '\n', len - scanned)) != NULL)
+        {
+            scanned = newline - buf + 1;
+            history_complete_entry(history.pending - (len - scanned));
+        }
+    }
+
+    history.generation++;
+    return SUCCESS;
+}
+
+int history_load(store_backend_t *backend)
+{
+    char read_buffer[BUF_LEN];
+    char *pending_copy = NULL;
+    size_t pending = history.pending;
+    unsigned long generation = history.generation;
+    off_t end = history.origin + (history.visible - history.start);
+    ssize_t bytes_read;
+    off_t offset = 0;
+    int ret_status = SUCCESS;
+
+    // The driver still holds a partial write; carry it over to the new history
+    if(pending > 0)
+    {
+        pending_copy = malloc(pending);
+        if(pending_copy == NULL)
+        {
+            log_msg(LOG_ERR, "Failed to save pending history bytes");
+            return ERROR;
+        }
+        memcpy(pending_copy, history.block->data + history.visible, pending);
+    }
+
+    history_init(history.bounded, history.capacity);
+    history.generation = generation + 1;
+
+    while((bytes_read = backend->read(read_buffer, sizeof(read_buffer), offset)) > 0)
+    {
+        if(history_append(read_buffer, bytes_read) == ERROR)
+        {
+            ret_status = ERROR;
+            break;
+        }
+        offset += bytes_read;
+    }
+    if(bytes_read == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to read store into history mirror");
+        ret_status = ERROR;
+    }
+
+    // Stream positions continue from before the reload
+    history.origin = (end > (off_t)(history.visible - history.start)) ?
+                     end - (off_t)(history.visible - history.start) : 0;
+
+    if((ret_status == SUCCESS) && (pending > 0))
+    {
+        // Put the partial write back as pending without completing any entry
+        if(history_reserve(pending) == ERROR)
+        {
+            ret_status = ERROR;
+        }
+        else
+        {
+            memcpy(history.block->data + history.visible + history.pending, pending_copy, pending);
+            history.pending += pending;
+        }
+    }
+    free(pending_copy);
+
+    log_msg(LOG_INFO, "History mirror loaded %zu bytes (generation %lu)",
+           history.visible - history.start, history.generation);
+    return ret_status;
+}
+
+void history_acquire(history_snapshot_t *snap)
+{
+    pthread_rwlock_rdlock(&lock);
+    snap->block = history.block;
+    snap->base = history.start;
+    snap->length = history.visible - history.start;
+    snap->origin = history.origin;
+    snap->generation = history.generation;
+    if(snap->block != NULL)
+    {
+        atomic_fetch_add(&snap->block->refcount, 1);
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+int history_acquire_buffer(history_snapshot_t *snap, const char *buf, size_t len)
+{
+    history_block_t *block = malloc(sizeof(history_block_t) + len);
+
+    if(block == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to allocate reply buffer");
+        return ERROR;
+    }
+    atomic_init(&block->refcount, 1);
+    block->cap = len;
+    memcpy(block->data, buf, len);
+
+    snap->block = block;
+    snap->base = 0;
+    snap->length = len;
+    snap->origin = 0;
+    snap->generation = 0;
+    return SUCCESS;
+}
+
+void history_acquire_range(history_snapshot_t *snap, off_t cursor, size_t max_len)
+{
+    size_t entry_offset;
+    size_t offset;
+    off_t from;
+
+    pthread_rwlock_rdlock(&lock);
+    // A cursor into evicted bytes resumes at the oldest byte still held
+    from = (cursor > history.origin) ? cursor : history.origin;
+    offset = from - history.origin;
+    if((offset >= history.visible - history.start) ||
+       (history.bounded &&
+        (aesd_circular_buffer_find_entry_offset_for_fpos(&history.entries, offset, &entry_offset) == NULL)))
+    {
+        offset = history.visible - history.start;
+    }
+    snap->block = history.block;
+    snap->base = history.start + offset;
+    snap->length = history.visible - history.start - offset;
+    snap->origin = history.origin + offset;
+    snap->generation = history.generation;
+    if(snap->block != NULL)
+    {
+        atomic_fetch_add(&snap->block->refcount, 1);
+    }
+    pthread_rwlock_unlock(&lock);
+
+    if((max_len > 0) && (snap->length > max_len))
+    {
+        snap->length = max_len;
+    }
+}
+
+int history_acquire_since(history_snapshot_t *snap, off_t cursor)
+{
+    history_snapshot_t range;
+    history_block_t *block;
+    char header[64];
+    int header_len;
+
+    history_acquire_range(&range, cursor, 0);
+    header_len = snprintf(header, sizeof(header), HISTORY_CURSOR_HEADER "%lld,%lld\n",
+                          (long long)range.origin, (long long)(range.origin + range.length));
+
+    block = malloc(sizeof(history_block_t) + header_len + range.length);
+    if(block == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to allocate reply buffer");
+        history_release(&range);
+        return ERROR;
+    }
+    atomic_init(&block->refcount, 1);
+    block->cap = header_len + range.length;
+    memcpy(block->data, header, header_len);
+    if(range.length > 0)
+    {
+        memcpy(block->data + header_len, range.block->data + range.base, range.length);
+    }
+    history_release(&range);
+
+    snap->block = block;
+    snap->base = 0;
+    snap->length = block->cap;
+    snap->origin = 0;
+    snap->generation = 0;
+    return SUCCESS;
+}
+
+bool history_is_readfrom(const char *packet, size_t length, off_t *cursor)
+{
+    size_t cmd_len = strlen(HISTORY_READFROM_COMMAND);
+    char command[64];
+    long long value;
+
+    if((length < cmd_len) || (memcmp(packet, HISTORY_READFROM_COMMAND, cmd_len) != 0))
+    {
+        return false;
+    }
+
+    // Parse from a bounded, terminated copy; a malformed cursor reads everything
+    length = (length < sizeof(command)) ? length : sizeof(command) - 1;
+    memcpy(command, packet, length);
+    command[length] = '\0';
+    if((sscanf(command + cmd_len, "%lld", &value) != 1) || (value < 0))
+    {
+        value = 0;
+    }
+    *cursor = value;
+    return true;
+}
+
+void history_release(history_snapshot_t *snap)
+{
+    block_put(snap->block);
+    memset(snap, 0, sizeof(*snap));
+}
+
+ssize_t history_send(int socket_fd, const history_snapshot_t *snap, off_t *offset)
+{
+    ssize_t bytes_sent;
+
+    if((snap->block == NULL) || (*offset < 0) || ((size_t)*offset >= snap->length))
+    {
+        return 0;
+    }
+
+    bytes_sent = send(socket_fd, snap->block->data + snap->base + *offset,
+                      snap->length - *offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(bytes_sent > 0)
+    {
+        *offset += bytes_sent;
+        stats_add(STAT_BYTES_OUT, bytes_sent);
+    }
+    return bytes_sent;
+}
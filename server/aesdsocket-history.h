@@ -0,0 +1,186 @@
+/****************************************************************
+ * @file      		aesdsocket-history.h
+ * @brief		    In-memory mirror of the data store used for replies
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_HISTORY_H
+#define AESDSOCKET_HISTORY_H
+
+/****************   Includes    ***************/
+#include <stdatomic.h>
+#include "aesdsocket.h"
+#include "aesdsocket-backend.h"
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+
+/****************   Macros     ***************/
+
+// Smallest backing block; blocks double as the history grows
+#define HISTORY_MIN_BLOCK       (4096)
+
+// In-band command asking for the bytes after a stream position
+#define HISTORY_READFROM_COMMAND    "AESDSOCKET_READFROM:"
+// First line of its reply: "<first position>,<cursor to resume from>"
+#define HISTORY_CURSOR_HEADER       "AESDSOCKET_CURSOR:"
+
+/**
+ * @struct history_block_t
+ * @brief Reference counted backing storage of the mirror.
+ *
+ * Bytes below the published end of the history are never modified, so a
+ * snapshot can send them without the lock. When the mirror outgrows a
+ * block it moves to a new one; the old block lives until the last
+ * snapshot referencing it is released.
+ */
+typedef struct
+{
+    atomic_int refcount;        /**< Mirror reference plus one per snapshot */
+    size_t cap;                 /**< Capacity of data */
+    char data[];
+} history_block_t;
+
+/**
+ * @struct history_snapshot_t
+ * @brief Immutable view of the history taken for one reply.
+ */
+typedef struct history_snapshot
+{
+    history_block_t *block;     /**< Backing block, NULL for an empty history */
+    size_t base;                /**< Position of store offset 0 in block->data */
+    size_t length;              /**< Bytes visible in this snapshot */
+    off_t origin;               /**< Stream position of store offset 0 */
+    unsigned long generation;   /**< History generation the snapshot was taken at */
+} history_snapshot_t;
+
+/**
+ * @brief Resets the mirror.
+ *
+ * @param bounded Follow the aesdchar driver: only newline-terminated
+ *        writes become visible and just the last
+ *        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED of them are kept.
+ * @param capacity Bounded mode: also drop the oldest entries while more
+ *        than this many bytes are visible, 0 for no limit.
+ */
+void history_init(bool bounded, size_t capacity);
+
+/**
+ * @brief Frees the mirror; snapshots still held keep their block alive.
+ */
+void history_destroy(void);
+
+/**
+ * @brief Rebuilds the visible history from the store, keeping any
+ *        partial write still pending. Caller holds the global lock for
+ *        writing.
+ *
+ * @param backend Store to read from offset 0.
+ * @return SUCCESS or ERROR.
+ */
+int history_load(store_backend_t *backend);
+
+/**
+ * @brief Drops the oldest bytes so at most length remain visible, after a
+ *        store with its own retention dropped them. Caller holds the
+ *        global lock for writing. Bounded mirrors evict by themselves and
+ *        are left alone.
+ *
+ * @param length Bytes the store still holds.
+ */
+void history_trim(size_t length);
+
+/**
+ * @brief Bytes currently visible, to compare with the store's length().
+ *        Caller holds the global lock.
+ */
+off_t history_length(void);
+
+/**
+ * @brief Mirrors bytes that were just written to the store. Caller holds
+ *        the global lock for writing so the mirror sees appends in store
+ *        order.
+ *
+ * @param buf Bytes accepted by the store.
+ * @param len Number of bytes the store accepted.
+ * @return SUCCESS or ERROR if the mirror could not grow.
+ */
+int history_append(const char *buf, size_t len);
+
+/**
+ * @brief Takes a snapshot of the visible history.
+ *
+ * Only a read lock is taken, so concurrent repliers never wait for each
+ * other, only for an append or seek in progress.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ */
+void history_acquire(history_snapshot_t *snap);
+
+/**
+ * @brief Wraps a private copy of buf in a snapshot, so replies that are
+ *        not the history (the statistics report) use the same send path.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ * @param buf Reply bytes.
+ * @param len Number of bytes in buf.
+ * @return SUCCESS or ERROR on allocation failure.
+ */
+int history_acquire_buffer(history_snapshot_t *snap, const char *buf, size_t len);
+
+/**
+ * @brief Takes a snapshot of up to max_len bytes from a stream position.
+ *
+ * Nothing is copied: the snapshot references the mirror's block. Its
+ * origin is the stream position of its first byte, which is the oldest
+ * byte still held when cursor points into evicted bytes.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ * @param cursor Stream position to read from.
+ * @param max_len Most bytes to include, 0 for everything up to the end.
+ */
+void history_acquire_range(history_snapshot_t *snap, off_t cursor, size_t max_len);
+
+/**
+ * @brief Takes a snapshot of the bytes after a stream position, for an
+ *        AESDSOCKET_READFROM reply.
+ *
+ * The snapshot holds a HISTORY_CURSOR_HEADER line with the position of
+ * the first byte returned and the cursor to resume from, followed by the
+ * bytes themselves. A cursor into bytes that were already evicted starts
+ * at the oldest byte still held, which the header makes visible.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ * @param cursor Stream position to read from.
+ * @return SUCCESS or ERROR on allocation failure.
+ */
+int history_acquire_since(history_snapshot_t *snap, off_t cursor);
+
+/**
+ * @brief Recognizes an AESDSOCKET_READFROM:<cursor> packet.
+ *
+ * @param packet Packet bytes, not necessarily NUL terminated.
+ * @param length Number of bytes in packet.
+ * @param[out] cursor Requested stream position, 0 if it does not parse.
+ * @return true for a read-from command.
+ */
+bool history_is_readfrom(const char *packet, size_t length, off_t *cursor);
+
+/**
+ * @brief Drops a snapshot taken with history_acquire(),
+ *        history_acquire_buffer() or history_acquire_since().
+ */
+void history_release(history_snapshot_t *snap);
+
+/**
+ * @brief Sends snapshot bytes from *offset onwards to a socket.
+ *
+ * Never blocks, even on a blocking socket: a full socket is ERROR with
+ * errno EAGAIN. *offset only advances by what was sent.
+ *
+ * @param socket_fd Destination socket.
+ * @param snap Snapshot to send from.
+ * @param[in,out] offset Store offset to send from, advanced by the bytes sent.
+ * @return Bytes sent, 0 at the end of the snapshot, or ERROR with errno set.
+ */
+ssize_t history_send(int socket_fd, const history_snapshot_t *snap, off_t *offset);
+
+#endif // AESDSOCKET_HISTORY_H
@@ -0,0 +1,349 @@
+/***********************************************************************
+ * @file      		aesdsocket-index.c
+ * @version   		0.1
+ * @brief		    Persistent record index of the flat file store
+ *
+ * Seeking to record X of the flat file meant scanning it for newlines
+ * from the start. The index is a sidecar file holding the store offset
+ * just past each record's newline. It is extended as appends commit,
+ * from the bytes just written, and mapped, so a seek is two array
+ * lookups and the record count one load.
+ *
+ * It survives the store: a restart over an existing file maps the index
+ * again and scans only what was appended after its end. An index that
+ * does not fit the file (longer than it, or not ending on a newline) is
+ * rebuilt from scratch.
+ *
+ * During a hot restart both processes append to the file and the index,
+ * so every change is made with a flock() on the index held. A process
+ * whose append did not land right after the indexed bytes indexes the
+ * other process's bytes first, by scanning them.
+ ************************************************************************/
+/****************   Includes    ***************/
+#define _GNU_SOURCE
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "aesdsocket-index.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct record_index_t
+ * @brief Index file and its mapping.
+ */
+typedef struct
+{
+    int fd;                         /**< Index file, also the flock() target */
+    int data_fd;                    /**< Store the index describes */
+    const char *path;               /**< Index file path */
+    record_index_header_t *header;  /**< Start of the mapping */
+    uint64_t *ends;                 /**< Record end offsets, right after the header */
+    size_t capacity;                /**< Entries mapped */
+} record_index_t;
+
+/****************   Global Variables     ***************/
+static record_index_t record_index = { .fd = ERROR, .data_fd = ERROR };
+
+static size_t index_bytes(size_t entries)
+{
+    return sizeof(record_index_header_t) + entries * sizeof(uint64_t);
+}
+
+/**
+ * @brief Maps the whole index file, or remaps it after it grew.
+ *
+ * @return SUCCESS or ERROR.
+ */
+static int index_map(void)
+{
+    struct stat index_stat;
+    void *map;
+    size_t entries;
+
+    if(fstat(record_index.fd, &index_stat) == ERROR)
+    {
+        log_msg(LOG_ERR, "Record index stat failed");
+        return ERROR;
+    }
+    entries = ((size_t)index_stat.st_size - sizeof(record_index_header_t)) / sizeof(uint64_t);
+
+    if(record_index.header == NULL)
+    {
+        map = mmap(NULL, index_bytes(entries), PROT_READ | PROT_WRITE, MAP_SHARED, record_index.fd, 0);
+    }
+    else
+    {
+        map = mremap(record_index.header, index_bytes(record_index.capacity), index_bytes(entries), MREMAP_MAYMOVE);
+    }
+    if(map == MAP_FAILED)
+    {
+        log_msg(LOG_ERR, "Failed to map record index: %s", strerror(errno));
+        return ERROR;
+    }
+
+    record_index.header = map;
+    record_index.ends = (uint64_t *)(record_index.header + 1);
+    record_index.capacity = entries;
+    return SUCCESS;
+}
+
+/**
+ * @brief Makes sure entries entries are mapped, growing the file by
+ *        INDEX_GROW_ENTRIES steps or following another process that did.
+ *
+ * @return SUCCESS or ERROR.
+ */
+static int index_fit(uint64_t entries)
+{
+    size_t grown;
+    int ret;
+
+    if(entries <= record_index.capacity)
+    {
+        return SUCCESS;
+    }
+    if(index_map() == ERROR)
+    {
+        return ERROR;
+    }
+    if(entries <= record_index.capacity)
+    {
+        return SUCCESS;
+    }
+
+    grown = ((entries + INDEX_GROW_ENTRIES - 1) / INDEX_GROW_ENTRIES) * INDEX_GROW_ENTRIES;
+    if((ret = posix_fallocate(record_index.fd, 0, index_bytes(grown))) != 0)
+    {
+        log_msg(LOG_ERR, "Failed to grow record index: %s", strerror(ret));
+        return ERROR;
+    }
+    return index_map();
+}
+
+/**
+ * @brief Takes the index flock and follows growth by another process.
+ */
+static int index_lock(void)
+{
+    while((flock(record_index.fd, LOCK_EX) == ERROR) && (errno == EINTR))
+    {
+    }
+    if(index_fit(atomic_load(&record_index.header->count)) == ERROR)
+    {
+        flock(record_index.fd, LOCK_UN);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+static void index_unlock(void)
+{
+    flock(record_index.fd, LOCK_UN);
+}
+
+/**
+ * @brief Adds the record ending at end.
+ *
+ * @return SUCCESS or ERROR if the index could not grow.
+ */
+static int index_push(uint64_t end)
+{
+    uint64_t count = atomic_load(&record_index.header->count);
+
+    if(index_fit(count + 1) == ERROR)
+    {
+        return ERROR;
+    }
+    record_index.ends[count] = end;
+    atomic_store(&record_index.header->count, count + 1);
+    return SUCCESS;
+}
+
+/**
+ * @brief Indexes the store bytes from the indexed end up to end by
+ *        reading them back.
+ */
+static void index_catch_up(off_t end)
+{
+    char buf[BUF_LEN];
+    const char *scan;
+    const char *newline;
+    off_t position = record_index.header->indexed_end;
+    ssize_t bytes_read;
+    size_t len;
+
+    while(position < end)
+    {
+        len = ((size_t)(end - position) < sizeof(buf)) ? (size_t)(end - position) : sizeof(buf);
+        bytes_read = pread(record_index.data_fd, buf, len, position);
+        if(bytes_read <= 0)
+        {
+            log_msg(LOG_ERR, "Failed to read store into record index");
+            return;
+        }
+        for(scan = buf; (newline = memchr(scan, '\n', buf + bytes_read - scan)) != NULL; scan = newline + 1)
+        {
+            if(index_push(position + (newline - buf) + 1) == ERROR)
+            {
+                // Picked up again from this newline on the next catch up
+                record_index.header->indexed_end = position + (newline - buf);
+                return;
+            }
+        }
+        position += bytes_read;
+        record_index.header->indexed_end = position;
+    }
+}
+
+/**
+ * @brief Checks an existing index against the store it describes.
+ */
+static bool index_valid(off_t data_size)
+{
+    uint64_t count = atomic_load(&record_index.header->count);
+    char last;
+
+    if((record_index.header->magic != INDEX_MAGIC) ||
+       (record_index.header->indexed_end > (uint64_t)data_size) || (count > record_index.capacity))
+    {
+        return false;
+    }
+    if(count == 0)
+    {
+        return true;
+    }
+    return (record_index.ends[count - 1] <= record_index.header->indexed_end) &&
+           (pread(record_index.data_fd, &last, 1, record_index.ends[count - 1] - 1) == 1) && (last == '\n');
+}
+
+int record_index_open(const char *path, int data_fd)
+{
+    struct stat index_stat;
+    off_t data_size;
+    int ret;
+
+    record_index.path = path;
+    record_index.data_fd = data_fd;
+    record_index.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC,
+                           S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+    if(record_index.fd == ERROR)
+    {
+        log_msg(LOG_ERR, "Record index open failed: %s", path);
+        return ERROR;
+    }
+
+    while((flock(record_index.fd, LOCK_EX) == ERROR) && (errno == EINTR))
+    {
+    }
+    if((fstat(record_index.fd, &index_stat) == ERROR) ||
+       (((size_t)index_stat.st_size < sizeof(record_index_header_t)) &&
+        ((ret = posix_fallocate(record_index.fd, 0, index_bytes(INDEX_GROW_ENTRIES))) != 0)) ||
+       (index_map() == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to set up record index %s", path);
+        index_unlock();
+        record_index_close(false);
+        return ERROR;
+    }
+
+    data_size = lseek(data_fd, 0, SEEK_END);
+    if(!index_valid(data_size))
+    {
+        if(record_index.header->magic == INDEX_MAGIC)
+        {
+            log_msg(LOG_WARNING, "Record index does not match the store, rebuilding it");
+        }
+        record_index.header->magic = INDEX_MAGIC;
+        atomic_store(&record_index.header->count, 0);
+        record_index.header->indexed_end = 0;
+    }
+    log_msg(LOG_INFO, "Record index reused %llu records, scanning %lld new bytes",
+            (unsigned long long)atomic_load(&record_index.header->count),
+            (long long)(data_size - record_index.header->indexed_end));
+    index_catch_up(data_size);
+    index_unlock();
+    return SUCCESS;
+}
+
+void record_index_close(bool remove)
+{
+    if(record_index.header != NULL)
+    {
+        munmap(record_index.header, index_bytes(record_index.capacity));
+    }
+    if(record_index.fd != ERROR)
+    {
+        close(record_index.fd);
+    }
+    if(remove && (unlink(record_index.path) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to delete record index.");
+    }
+    memset(&record_index, 0, sizeof(record_index));
+    record_index.fd = ERROR;
+    record_index.data_fd = ERROR;
+}
+
+void record_index_append(const struct iovec *iov, size_t written, off_t end)
+{
+    const char *buf;
+    const char *scan;
+    const char *newline;
+    off_t position = end - written;
+    size_t len;
+
+    if(index_lock() == ERROR)
+    {
+        return;
+    }
+
+    if(record_index.header->indexed_end != (uint64_t)position)
+    {
+        index_catch_up(end);
+        index_unlock();
+        return;
+    }
+
+    for(; written > 0; iov++)
+    {
+        buf = iov->iov_base;
+        len = (iov->iov_len < written) ? iov->iov_len : written;
+        for(scan = buf; (newline = memchr(scan, '\n', buf + len - scan)) != NULL; scan = newline + 1)
+        {
+            if(index_push(position + (newline - buf) + 1) == ERROR)
+            {
+                record_index.header->indexed_end = position + (newline - buf);
+                index_unlock();
+                return;
+            }
+        }
+        position += len;
+        written -= len;
+    }
+    record_index.header->indexed_end = position;
+    index_unlock();
+}
+
+int record_index_find(uint64_t record, off_t *start, off_t *end)
+{
+    int ret_status = ERROR;
+
+    if(index_lock() == ERROR)
+    {
+        return ERROR;
+    }
+    // Appends by another process during a hot restart
+    index_catch_up(lseek(record_index.data_fd, 0, SEEK_END));
+    if(record < atomic_load(&record_index.header->count))
+    {
+        *start = (record > 0) ? record_index.ends[record - 1] : 0;
+        *end = record_index.ends[record];
+        ret_status = SUCCESS;
+    }
+    index_unlock();
+    return ret_status;
+}
+
+uint64_t record_index_count(void)
+{
+    return atomic_load(&record_index.header->count);
+}
@@ -0,0 +1,84 @@
+/****************************************************************
+ * @file      		aesdsocket-index.h
+ * @brief		    Persistent record index of the flat file store
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_INDEX_H
+#define AESDSOCKET_INDEX_H
+
+/****************   Includes    ***************/
+#include <sys/uio.h>
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+#define INDEX_MAGIC             (0x41455349u)
+// Entries the index file grows by at a time
+#define INDEX_GROW_ENTRIES      (64 * 1024)
+
+/**
+ * @struct record_index_header_t
+ * @brief Start of the index file, followed by one uint64_t per record: the
+ *        store offset just past its newline.
+ *
+ * Shared with any other process that has the index mapped; only changed
+ * with the index file flock held.
+ */
+typedef struct
+{
+    uint32_t magic;             /**< INDEX_MAGIC */
+    uint32_t reserved;
+    _Atomic uint64_t count;     /**< Records indexed */
+    uint64_t indexed_end;       /**< Store bytes scanned for newlines so far */
+    uint64_t padding[5];
+} record_index_header_t;
+
+/**
+ * @brief Maps the index next to a store and brings it up to date.
+ *
+ * An index left by a predecessor is reused and only the store bytes
+ * after its end are scanned; one that does not fit the store is rebuilt.
+ *
+ * @param path Index file.
+ * @param data_fd Store descriptor, read with pread() to catch up.
+ * @return SUCCESS or ERROR.
+ */
+int record_index_open(const char *path, int data_fd);
+
+/**
+ * @brief Unmaps the index.
+ *
+ * @param remove Also delete the index file.
+ */
+void record_index_close(bool remove);
+
+/**
+ * @brief Indexes bytes that were just appended to the store.
+ *
+ * When the write landed right after the indexed bytes its newlines are
+ * taken from iov; otherwise another process wrote in between and the
+ * store is scanned up to end instead.
+ *
+ * @param iov Buffers that were written.
+ * @param written Bytes of iov the store accepted.
+ * @param end Store offset just past the write.
+ */
+void record_index_append(const struct iovec *iov, size_t written, off_t end);
+
+/**
+ * @brief Looks up the bytes of a record.
+ *
+ * @param record Record number, 0 for the oldest.
+ * @param[out] start Store offset of its first byte.
+ * @param[out] end Store offset just past its newline.
+ * @return SUCCESS, or ERROR if the store holds fewer complete records.
+ */
+int record_index_find(uint64_t record, off_t *start, off_t *end);
+
+/**
+ * @brief Number of complete records in the store.
+ */
+uint64_t record_index_count(void);
+
+#endif // AESDSOCKET_INDEX_H
@@ -0,0 +1,416 @@
+/***********************************************************************
+ * @file      		aesdsocket-log.c
+ * @version   		0.1
+ * @brief		    Asynchronous logging through per-thread rings
+ *
+ * syslog() is a sendto() on /dev/log, made while the connection waits;
+ * a busy or stalled syslog daemon holds every serving thread up with it.
+ * log_msg() instead formats the message into a ring owned by the calling
+ * thread and returns. Each ring has a single writer, its thread, and a
+ * single reader, the drainer, so queueing takes no lock: the writer only
+ * publishes its head and the reader its tail. A full ring drops the
+ * message rather than wait.
+ *
+ * Rings are claimed like statistics slots: on a thread's first message,
+ * and handed to the next new thread when it exits, so thread per
+ * connection mode does not allocate one per connection.
+ *
+ * The drainer wakes every LOG_DRAIN_INTERVAL_MS and writes everything
+ * queued, to syslog or with -L to a file flushed once per pass, followed
+ * by a count, at most once a second, of the messages dropped or rate
+ * limited since the last one.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "aesdsocket-log.h"
+
+/**
+ * @struct log_entry_t
+ * @brief One queued message.
+ */
+typedef struct
+{
+    struct timespec time;               /**< CLOCK_REALTIME when it was logged */
+    int priority;                       /**< syslog priority */
+    char text[LOG_ENTRY_TEXT];          /**< Formatted message */
+} log_entry_t;
+
+/**
+ * @struct log_ring
+ * @brief Messages queued by one thread.
+ */
+typedef struct log_ring
+{
+    _Atomic size_t head;                /**< Next entry the owner writes */
+    _Atomic size_t tail;                /**< Next entry the drainer writes out */
+    atomic_bool busy;                   /**< Owner is queueing; log_stop() waits for it */
+    bool in_use;                        /**< Owned by a live thread, guarded by rings_mutex */
+    log_entry_t entries[LOG_RING_ENTRIES];
+
+    SLIST_ENTRY(log_ring) rings;
+} log_ring_t;
+
+/****************   Global Variables     ***************/
+// Rings are only ever added, at the head, so a reader that took the head under the mutex can walk on without it
+static SLIST_HEAD(log_ring_list, log_ring) ring_head = SLIST_HEAD_INITIALIZER(ring_head);
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static _Thread_local log_ring_t *local_ring;
+
+static pthread_t drainer_thread;
+static atomic_bool running;
+static atomic_bool stopping;
+static FILE *log_file;
+
+static atomic_ulong dropped;
+static atomic_ulong suppressed;
+static _Atomic time_t rate_second;
+static atomic_uint rate_count;
+
+static const struct
+{
+    const char *name;
+    int priority;
+} level_names[] = {
+    { "err", LOG_ERR },
+    { "warning", LOG_WARNING },
+    { "notice", LOG_NOTICE },
+    { "info", LOG_INFO },
+    { "debug", LOG_DEBUG },
+};
+
+/**
+ * @brief Thread exit hook: hands the ring on with whatever it still holds.
+ */
+static void ring_release(void *arg)
+{
+    log_ring_t *ring = (log_ring_t *)arg;
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->in_use = false;
+    pthread_mutex_unlock(&rings_mutex);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+/**
+ * @brief Returns the calling thread's ring, claiming one on first use.
+ *
+ * @return The ring, or NULL if none could be allocated.
+ */
+static log_ring_t *ring_get(void)
+{
+    log_ring_t *ring;
+
+    if(local_ring != NULL)
+    {
+        return local_ring;
+    }
+
+    pthread_once(&ring_key_once, ring_key_create);
+
+    pthread_mutex_lock(&rings_mutex);
+    SLIST_FOREACH(ring, &ring_head, rings)
+    {
+        if(!ring->in_use)
+        {
+            break;
+        }
+    }
+    if(ring == NULL)
+    {
+        ring = calloc(1, sizeof(log_ring_t));
+        if(ring != NULL)
+        {
+            SLIST_INSERT_HEAD(&ring_head, ring, rings);
+        }
+    }
+    if(ring != NULL)
+    {
+        ring->in_use = true;
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    if(ring != NULL)
+    {
+        pthread_setspecific(ring_key, ring);
+        local_ring = ring;
+    }
+    return ring;
+}
+
+/**
+ * @brief Takes one message from this second's allowance.
+ *
+ * The first message of a new second resets the count; a message racing
+ * that reset may be counted against either second.
+ */
+static bool rate_allow(void)
+{
+    struct timespec now;
+    time_t second;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    second = atomic_load_explicit(&rate_second, memory_order_relaxed);
+    if((second != now.tv_sec) &&
+       atomic_compare_exchange_strong(&rate_second, &second, now.tv_sec))
+    {
+        atomic_store_explicit(&rate_count, 0, memory_order_relaxed);
+    }
+    return atomic_fetch_add_explicit(&rate_count, 1, memory_order_relaxed) < LOG_RATE_PER_SEC;
+}
+
+void log_msg(int priority, const char *format, ...)
+{
+    log_ring_t *ring;
+    log_entry_t *entry;
+    size_t head;
+    va_list args;
+
+    if(LOG_PRI(priority) > s_config.log_level)
+    {
+        return;
+    }
+
+    // Before log_start(), after log_stop(), or re-entered from a signal handler on this thread
+    ring = atomic_load(&running) ? ring_get() : NULL;
+    if((ring == NULL) || atomic_load_explicit(&ring->busy, memory_order_relaxed))
+    {
+        va_start(args, format);
+        vsyslog(priority, format, args);
+        va_end(args);
+        return;
+    }
+
+    if((LOG_PRI(priority) >= LOG_NOTICE) && !rate_allow())
+    {
+        atomic_fetch_add_explicit(&suppressed, 1, memory_order_relaxed);
+        return;
+    }
+
+    // Paired with log_stop(): either it sees us busy and waits, or we see it stopped
+    atomic_store(&ring->busy, true);
+    if(!atomic_load(&running))
+    {
+        atomic_store(&ring->busy, false);
+        va_start(args, format);
+        vsyslog(priority, format, args);
+        va_end(args);
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_ENTRIES)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    }
+    else
+    {
+        entry = &ring->entries[head % LOG_RING_ENTRIES];
+        clock_gettime(CLOCK_REALTIME, &entry->time);
+        entry->priority = priority;
+        va_start(args, format);
+        vsnprintf(entry->text, sizeof(entry->text), format, args);
+        va_end(args);
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+    atomic_store_explicit(&ring->busy, false, memory_order_release);
+}
+
+/**
+ * @brief Writes one message to the log file, or to syslog without one.
+ */
+static void log_write(int priority, const struct timespec *time, const char *text)
+{
+    struct tm local;
+    char stamp[32];
+    size_t i;
+    const char *level = "?";
+
+    if(log_file == NULL)
+    {
+        syslog(priority, "%s", text);
+        return;
+    }
+
+    for(i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+    {
+        if(level_names[i].priority == LOG_PRI(priority))
+        {
+            level = level_names[i].name;
+        }
+    }
+    localtime_r(&time->tv_sec, &local);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &local);
+    fprintf(log_file, "%s.%03ld %s %s\n", stamp, time->tv_nsec / 1000000, level, text);
+}
+
+/**
+ * @brief Writes out every queued message once.
+ *
+ * @param final Last pass: report lost messages even within the second.
+ */
+static void log_drain(bool final)
+{
+    static time_t last_report;
+    log_ring_t *ring;
+    log_entry_t *entry;
+    struct timespec now;
+    unsigned long lost_full;
+    unsigned long lost_rate;
+    char text[LOG_ENTRY_TEXT];
+    size_t head;
+    size_t tail;
+
+    pthread_mutex_lock(&rings_mutex);
+    ring = SLIST_FIRST(&ring_head);
+    pthread_mutex_unlock(&rings_mutex);
+
+    for(; ring != NULL; ring = SLIST_NEXT(ring, rings))
+    {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        for(; tail != head; tail++)
+        {
+            entry = &ring->entries[tail % LOG_RING_ENTRIES];
+            log_write(entry->priority, &entry->time, entry->text);
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    // Losses are summed up at most once a second so the report cannot flood the log itself
+    clock_gettime(CLOCK_REALTIME, &now);
+    if(final || (now.tv_sec != last_report))
+    {
+        lost_full = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+        lost_rate = atomic_exchange_explicit(&suppressed, 0, memory_order_relaxed);
+    }
+    else
+    {
+        lost_full = lost_rate = 0;
+    }
+    if((lost_full > 0) || (lost_rate > 0))
+    {
+        last_report = now.tv_sec;
+        snprintf(text, sizeof(text), "Log messages lost: %lu to full rings, %lu to the rate limit",
+                 lost_full, lost_rate);
+        log_write(LOG_WARNING, &now, text);
+    }
+
+    if(log_file != NULL)
+    {
+        fflush(log_file);
+    }
+}
+
+/**
+ * @brief Drainer thread: empties the rings until log_stop().
+ */
+static void *log_drainer(void *arg)
+{
+    struct timespec interval = { .tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_MS * 1000000L };
+    bool stop;
+
+    (void)arg;
+    do
+    {
+        // One full pass after the stop request catches everything queued before it
+        stop = atomic_load(&stopping);
+        log_drain(stop);
+        if(!stop)
+        {
+            nanosleep(&interval, NULL);
+        }
+    } while(!stop);
+
+    return NULL;
+}
+
+int log_start(const char *path)
+{
+    sigset_t all_signals;
+    sigset_t previous;
+    int ret;
+
+    if(path != NULL)
+    {
+        log_file = fopen(path, "a");
+        if(log_file == NULL)
+        {
+            syslog(LOG_ERR, "Failed to open log file %s: %s", path, strerror(errno));
+            return ERROR;
+        }
+    }
+
+    // The drainer must not take SIGINT/SIGTERM: their handler stops it
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous);
+    atomic_store(&stopping, false);
+    ret = pthread_create(&drainer_thread, NULL, log_drainer, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if(ret != 0)
+    {
+        syslog(LOG_ERR, "Failed to create log drainer thread");
+        if(log_file != NULL)
+        {
+            fclose(log_file);
+            log_file = NULL;
+        }
+        return ERROR;
+    }
+
+    atomic_store(&running, true);
+    return SUCCESS;
+}
+
+void log_stop(void)
+{
+    log_ring_t *ring;
+
+    if(!atomic_exchange(&running, false))
+    {
+        return;
+    }
+
+    // Let messages already being queued land before the last pass
+    pthread_mutex_lock(&rings_mutex);
+    ring = SLIST_FIRST(&ring_head);
+    pthread_mutex_unlock(&rings_mutex);
+    for(; ring != NULL; ring = SLIST_NEXT(ring, rings))
+    {
+        // Our own ring is busy only if a signal interrupted us mid-message
+        while((ring != local_ring) && atomic_load(&ring->busy))
+        {
+            sched_yield();
+        }
+    }
+
+    atomic_store(&stopping, true);
+    pthread_join(drainer_thread, NULL);
+
+    if(log_file != NULL)
+    {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
+
+int log_parse_level(const char *name)
+{
+    size_t i;
+
+    for(i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+    {
+        if(strcmp(name, level_names[i].name) == 0)
+        {
+            return level_names[i].priority;
+        }
+    }
+    return ERROR;
+}
@@ -0,0 +1,63 @@
+/****************************************************************
+ * @file      		aesdsocket-log.h
+ * @brief		    Asynchronous logging through per-thread rings
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_LOG_H
+#define AESDSOCKET_LOG_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+// Messages each thread can have queued; more are dropped and counted
+#define LOG_RING_ENTRIES        (256)
+// Longest message; longer ones are cut
+#define LOG_ENTRY_TEXT          (240)
+// How often the drainer empties the rings
+#define LOG_DRAIN_INTERVAL_MS   (50)
+// Notice, info and debug messages accepted per second; errors and warnings are not limited
+#define LOG_RATE_PER_SEC        (1000)
+
+#define DEFAULT_LOG_LEVEL       (LOG_INFO)
+
+/**
+ * @brief Starts the drainer; log_msg() stops blocking from then on.
+ *
+ * Must be called after the daemon fork, which would not carry the
+ * drainer thread over.
+ *
+ * @param path File to append messages to, or NULL for syslog.
+ * @return SUCCESS, or ERROR if logging stays synchronous.
+ */
+int log_start(const char *path);
+
+/**
+ * @brief Writes out everything queued and stops the drainer.
+ *
+ * Messages logged afterwards go to syslog directly, as before log_start().
+ */
+void log_stop(void);
+
+/**
+ * @brief Queues a message for the drainer, syslog() style.
+ *
+ * Never blocks: a message above s_config.log_level is discarded before it
+ * is formatted, one over LOG_RATE_PER_SEC or one that finds the thread's
+ * ring full is counted and dropped.
+ *
+ * @param priority syslog priority.
+ * @param format printf format.
+ */
+void log_msg(int priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Parses a level name: err, warning, notice, info or debug.
+ *
+ * @return The syslog priority, or ERROR for an unknown name.
+ */
+int log_parse_level(const char *name);
+
+#endif // AESDSOCKET_LOG_H
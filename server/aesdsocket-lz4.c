@@ -0,0 +1,291 @@
+/***********************************************************************
+ * @file      		aesdsocket-lz4.c
+ * @version   		0.1
+ * @brief		    LZ4 block codec and reply framing
+ *
+ * A small, dependency free implementation of the LZ4 block format, used
+ * for compressed replies by the server and to decode them in
+ * aesdsocket-bench. Speed matters more than ratio here: one hash probe
+ * per position, no lazy matching.
+ *
+ * @reference
+ *
+ * 1. https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <stdbool.h>
+#include <string.h>
+#include "aesdsocket-lz4.h"
+
+/****************   Macros     ***************/
+#define LZ4_HASH_BITS           (12)
+#define LZ4_MIN_MATCH           (4)
+#define LZ4_MAX_OFFSET          (65535)
+// The last match must start this far before the end of the block
+#define LZ4_MF_LIMIT            (12)
+// and the last bytes of the block are always literals
+#define LZ4_LAST_LITERALS       (5)
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz4_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+/**
+ * @brief Appends the 255-run encoding of a length beyond its token nibble.
+ *
+ * @return Updated output position, or NULL if dst is full.
+ */
+static uint8_t *put_length(uint8_t *op, const uint8_t *op_end, size_t length)
+{
+    while(length >= 255)
+    {
+        if(op >= op_end)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+    if(op >= op_end)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/**
+ * @brief Emits one sequence: literals, then a match unless match_len is 0.
+ *
+ * @return Updated output position, or NULL if dst is full.
+ */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *op_end, const uint8_t *literals,
+                             size_t literal_len, size_t offset, size_t match_len)
+{
+    uint8_t *token;
+
+    if(op >= op_end)
+    {
+        return NULL;
+    }
+    token = op++;
+    *token = (uint8_t)(((literal_len >= 15) ? 15 : literal_len) << 4);
+    if((literal_len >= 15) && ((op = put_length(op, op_end, literal_len - 15)) == NULL))
+    {
+        return NULL;
+    }
+
+    if((size_t)(op_end - op) < literal_len)
+    {
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if(match_len == 0)
+    {
+        return op;
+    }
+
+    if(op_end - op < 2)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+
+    match_len -= LZ4_MIN_MATCH;
+    *token |= (uint8_t)((match_len >= 15) ? 15 : match_len);
+    if(match_len >= 15)
+    {
+        op = put_length(op, op_end, match_len - 15);
+    }
+    return op;
+}
+
+size_t lz4_compress_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    uint32_t table[1 << LZ4_HASH_BITS];
+    const uint8_t *op_end = dst + cap;
+    uint8_t *op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+    size_t candidate;
+    size_t match_len;
+    size_t match_end;
+    uint32_t sequence;
+    uint32_t hash;
+
+    memset(table, 0, sizeof(table));
+
+    if(len > LZ4_MF_LIMIT)
+    {
+        match_end = len - LZ4_LAST_LITERALS;
+        while(ip < len - LZ4_MF_LIMIT)
+        {
+            sequence = read32(src + ip);
+            hash = lz4_hash(sequence);
+            candidate = table[hash];
+            table[hash] = (uint32_t)ip;
+
+            if((candidate >= ip) || (ip - candidate > LZ4_MAX_OFFSET) || (read32(src + candidate) != sequence))
+            {
+                ip++;
+                continue;
+            }
+
+            match_len = LZ4_MIN_MATCH;
+            while((ip + match_len < match_end) && (src[candidate + match_len] == src[ip + match_len]))
+            {
+                match_len++;
+            }
+            while((ip > anchor) && (candidate > 0) && (src[ip - 1] == src[candidate - 1]))
+            {
+                ip--;
+                candidate--;
+                match_len++;
+            }
+
+            op = put_sequence(op, op_end, src + anchor, ip - anchor, ip - candidate, match_len);
+            if(op == NULL)
+            {
+                return 0;
+            }
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+
+    op = put_sequence(op, op_end, src + anchor, len - anchor, 0, 0);
+    return (op == NULL) ? 0 : (size_t)(op - dst);
+}
+
+/**
+ * @brief Reads the 255-run continuation of a length nibble.
+ *
+ * @return false if the input ends inside the length.
+ */
+static bool get_length(const uint8_t *src, size_t len, size_t *ip, size_t *length)
+{
+    uint8_t byte;
+
+    do
+    {
+        if(*ip >= len)
+        {
+            return false;
+        }
+        byte = src[(*ip)++];
+        *length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+size_t lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    size_t literal_len;
+    size_t match_len;
+    size_t offset;
+    uint8_t token;
+
+    while(ip < len)
+    {
+        token = src[ip++];
+
+        literal_len = token >> 4;
+        if((literal_len == 15) && !get_length(src, len, &ip, &literal_len))
+        {
+            return (size_t)-1;
+        }
+        if((literal_len > len - ip) || (literal_len > cap - op))
+        {
+            return (size_t)-1;
+        }
+        memcpy(dst + op, src + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        // The last sequence has no match
+        if(ip == len)
+        {
+            break;
+        }
+
+        if(len - ip < 2)
+        {
+            return (size_t)-1;
+        }
+        offset = src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if((offset == 0) || (offset > op))
+        {
+            return (size_t)-1;
+        }
+
+        match_len = token & 15;
+        if((match_len == 15) && !get_length(src, len, &ip, &match_len))
+        {
+            return (size_t)-1;
+        }
+        match_len += LZ4_MIN_MATCH;
+        if(match_len > cap - op)
+        {
+            return (size_t)-1;
+        }
+
+        if(offset >= match_len)
+        {
+            memcpy(dst + op, dst + op - offset, match_len);
+            op += match_len;
+            continue;
+        }
+        // Byte by byte: the match overlaps the bytes it produces
+        while(match_len-- > 0)
+        {
+            dst[op] = dst[op - offset];
+            op++;
+        }
+    }
+
+    return op;
+}
+
+void lz4_frame_put(uint8_t *header, uint32_t raw_len, uint32_t payload_len)
+{
+    int i;
+
+    for(i = 0; i < 4; i++)
+    {
+        header[i] = (uint8_t)(raw_len >> (8 * i));
+        header[4 + i] = (uint8_t)(payload_len >> (8 * i));
+    }
+}
+
+void lz4_frame_get(const uint8_t *header, uint32_t *raw_len, uint32_t *payload_len)
+{
+    int i;
+
+    *raw_len = 0;
+    *payload_len = 0;
+    for(i = 0; i < 4; i++)
+    {
+        *raw_len |= (uint32_t)header[i] << (8 * i);
+        *payload_len |= (uint32_t)header[4 + i] << (8 * i);
+    }
+}
@@ -0,0 +1,65 @@
+/****************************************************************
+ * @file      		aesdsocket-lz4.h
+ * @brief		    LZ4 block codec and reply framing
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_LZ4_H
+#define AESDSOCKET_LZ4_H
+
+/****************   Includes    ***************/
+#include <stddef.h>
+#include <stdint.h>
+
+/****************   Macros     ***************/
+
+// Largest raw block in a compressed reply; also the LZ4 offset window
+#define LZ4_FRAME_BLOCK         (64 * 1024)
+// Little-endian raw length and payload length in front of every block
+#define LZ4_FRAME_HEADER        (8)
+
+/**
+ * @brief Worst-case compressed size of len input bytes.
+ */
+size_t lz4_compress_bound(size_t len);
+
+/**
+ * @brief Compresses src into one LZ4 block (no frame, no checksum).
+ *
+ * Greedy single-pass matcher with a 4096 entry hash table; the output
+ * is a standard LZ4 block any LZ4 decoder accepts.
+ *
+ * @param src Input bytes.
+ * @param len Number of input bytes.
+ * @param dst Output buffer.
+ * @param cap Capacity of dst.
+ * @return Compressed size, or 0 if it does not fit in cap.
+ */
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/**
+ * @brief Decompresses one LZ4 block.
+ *
+ * @param src Compressed block.
+ * @param len Size of the compressed block.
+ * @param dst Output buffer.
+ * @param cap Capacity of dst.
+ * @return Decompressed size, or (size_t)-1 for a malformed block or one
+ *         that does not fit in cap.
+ */
+size_t lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/**
+ * @brief Writes a frame header.
+ *
+ * A payload as long as the raw block is stored uncompressed; a raw
+ * length of 0 ends the reply.
+ */
+void lz4_frame_put(uint8_t *header, uint32_t raw_len, uint32_t payload_len);
+
+/**
+ * @brief Reads a frame header written by lz4_frame_put().
+ */
+void lz4_frame_get(const uint8_t *header, uint32_t *raw_len, uint32_t *payload_len);
+
+#endif // AESDSOCKET_LZ4_H
@@ -0,0 +1,297 @@
+/***********************************************************************
+ * @file      		aesdsocket-pool.c
+ * @version   		0.1
+ * @brief		    Fixed-size worker pool fed by a bounded work queue
+ *
+ * The main thread only accepts connections and pushes them onto the
+ * queue. Workers are created once at startup and run the regular
+ * client_data_handler() for each job, so no pthread_create/pthread_join
+ * happens per connection.
+ ************************************************************************/
+/****************   Includes    ***************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include "aesdsocket-pool.h"
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-admission.h"
+#include "aesdsocket-log.h"
+
+/****************   Macros     ***************/
+// How often a producer blocked on a full queue checks for a termination signal
+#define POOL_SHUTDOWN_POLL_MS   (100)
+
+/**
+ * @brief Allocates the ring and initializes the synchronization objects.
+ *
+ * @param queue Queue to initialize.
+ * @param capacity Maximum number of queued jobs.
+ * @return SUCCESS or ERROR.
+ */
+static int work_queue_init(work_queue_t *queue, size_t capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->jobs = calloc(capacity, sizeof(pool_job_t));
+    if(queue->jobs == NULL)
+    {
+        return ERROR;
+    }
+    queue->capacity = capacity;
+
+    if((pthread_mutex_init(&queue->mutex, NULL) != 0) ||
+       (pthread_cond_init(&queue->not_empty, NULL) != 0) ||
+       (pthread_cond_init(&queue->not_full, NULL) != 0))
+    {
+        free(queue->jobs);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Frees the ring and closes any connection nobody picked up.
+ *
+ * @param queue Queue to destroy.
+ */
+static void work_queue_destroy(work_queue_t *queue)
+{
+    while(queue->count > 0)
+    {
+        close(queue->jobs[queue->head].clientSocketFd);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->jobs);
+}
+
+/**
+ * @brief Wakes every producer and consumer so they can observe shutdown.
+ *
+ * @param queue Queue to shut down.
+ */
+static void work_queue_shutdown(work_queue_t *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->shutdown = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * @brief Queues a job, blocking while the queue is full.
+ *
+ * The signal handler cannot broadcast not_full, and workers held by idle
+ * clients may never free a slot, so the wait wakes up every
+ * POOL_SHUTDOWN_POLL_MS to check fatal_error_in_progress.
+ *
+ * @param queue Queue to push to.
+ * @param job Job to copy into the queue.
+ * @return SUCCESS, or ERROR if the queue was shut down or a termination
+ *         signal arrived while it was full.
+ */
+static int work_queue_push(work_queue_t *queue, const pool_job_t *job)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&queue->mutex);
+    if((queue->count == queue->capacity) && !queue->shutdown)
+    {
+        log_msg(LOG_WARNING, "Work queue full, applying backpressure");
+        do
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += POOL_SHUTDOWN_POLL_MS * 1000000L;
+            if(deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&queue->not_full, &queue->mutex, &deadline);
+        } while((queue->count == queue->capacity) && !queue->shutdown && !fatal_error_in_progress);
+    }
+
+    if(queue->shutdown || ((queue->count == queue->capacity) && fatal_error_in_progress))
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return ERROR;
+    }
+
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = *job;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return SUCCESS;
+}
+
+/**
+ * @brief Removes the oldest job, blocking while the queue is empty.
+ *
+ * @param queue Queue to pop from.
+ * @param[out] job Receives the dequeued job.
+ * @return SUCCESS, or ERROR if the queue was shut down.
+ */
+static int work_queue_pop(work_queue_t *queue, pool_job_t *job)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while((queue->count == 0) && !queue->shutdown)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+
+    if(queue->count == 0)
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return ERROR;
+    }
+
+    *job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+    return SUCCESS;
+}
+
+/**
+ * @brief Worker thread body: serve queued connections until shutdown.
+ *
+ * @param arg Pointer to the shared work_queue_t.
+ * @return Always NULL.
+ */
+static void *pool_worker(void *arg)
+{
+    work_queue_t *queue = (work_queue_t *)arg;
+    ClientThreadData_t thread_data;
+    pool_job_t job;
+
+    while(work_queue_pop(queue, &job) == SUCCESS)
+    {
+        thread_data.threadId = pthread_self();
+        thread_data.pLock = &lock;
+        thread_data.isThreadComplete = false;
+        thread_data.clientSocketFd = job.clientSocketFd;
+        thread_data.pClientAddr = &job.clientAddr;
+        thread_data.pSource = job.pSource;
+
+        // The handler closes the socket on every path
+        client_data_handler(&thread_data);
+    }
+
+    return NULL;
+}
+
+int worker_pool_run(int listen_fd, int thread_count, int queue_depth)
+{
+    work_queue_t *queue;
+    pthread_t *workers;
+    pool_job_t job;
+    socklen_t clientSize;
+    int ret_status = SUCCESS;
+    int wait_status;
+    int started = 0;
+    int i;
+
+    // On the heap: workers still serving a client on a termination signal outlive this frame
+    queue = malloc(sizeof(work_queue_t));
+    if((queue == NULL) || (work_queue_init(queue, queue_depth) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to allocate work queue");
+        free(queue);
+        return ERROR;
+    }
+
+    workers = calloc(thread_count, sizeof(pthread_t));
+    if(workers == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to allocate worker pool");
+        work_queue_destroy(queue);
+        free(queue);
+        return ERROR;
+    }
+
+    for(i = 0; i < thread_count; i++)
+    {
+        if(pthread_create(&workers[i], NULL, pool_worker, queue) != 0)
+        {
+            log_msg(LOG_ERR, "Failed to create worker thread");
+            ret_status = ERROR;
+            break;
+        }
+        started++;
+    }
+
+    log_msg(LOG_INFO, "Worker pool running with %d threads, queue depth %d", started, queue_depth);
+
+    while((ret_status == SUCCESS) && !fatal_error_in_progress)
+    {
+        // Timestamps are written from here while no client is connecting
+        wait_status = handoff_wait_listener(listen_fd);
+        if(wait_status == HANDOFF_DRAINING)
+        {
+            // Workers finish the queued connections before the joins below return
+            log_msg(LOG_INFO, "Listener handed to successor, draining worker pool");
+            break;
+        }
+        if(wait_status == ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            log_msg(LOG_ERR, "Failed to wait for client connection");
+            ret_status = ERROR;
+            break;
+        }
+
+        clientSize = sizeof(job.clientAddr);
+        // The listener is non-blocking; the client socket is not
+        job.clientSocketFd = accept4(listen_fd, (struct sockaddr *)&job.clientAddr, &clientSize, SOCK_CLOEXEC);
+        if(job.clientSocketFd == ERROR)
+        {
+            // Another process or a dropped client took the connection: poll again
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ECONNABORTED) || (errno == EINTR))
+            {
+                continue;
+            }
+            if(!fatal_error_in_progress)
+            {
+                log_msg(LOG_ERR, "Failed to accept client connection");
+                ret_status = ERROR;
+            }
+            break;
+        }
+
+        if(admission_acquire((struct sockaddr *)&job.clientAddr, &job.pSource) == ERROR)
+        {
+            close(job.clientSocketFd);
+            continue;
+        }
+
+        if(work_queue_push(queue, &job) == ERROR)
+        {
+            admission_release(job.pSource);
+            close(job.clientSocketFd);
+            break;
+        }
+    }
+
+    work_queue_shutdown(queue);
+    // A worker may be blocked on a client that never sends; it ends with the
+    // re-raised signal instead, so the queue and worker list stay allocated
+    if(fatal_error_in_progress)
+    {
+        return ret_status;
+    }
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    work_queue_destroy(queue);
+    free(queue);
+
+    return ret_status;
+}
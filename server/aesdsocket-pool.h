@@ -0,0 +1,54 @@
+/****************************************************************
+ * @file      		aesdsocket-pool.h
+ * @brief		    Bounded worker thread pool for aesdsocket
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_POOL_H
+#define AESDSOCKET_POOL_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/**
+ * @struct pool_job_t
+ * @brief An accepted connection waiting for a worker.
+ */
+typedef struct
+{
+    int clientSocketFd;                     /**< Accepted client socket */
+    struct sockaddr_storage clientAddr;     /**< Peer address, copied out of accept() */
+    struct admission_source *pSource;       /**< Admission entry of the peer address, NULL if untracked */
+} pool_job_t;
+
+/**
+ * @struct work_queue_t
+ * @brief Bounded multi-producer/multi-consumer ring of pending jobs.
+ *
+ * Producers block on not_full once capacity jobs are queued, which is the
+ * backpressure point: the acceptor stops calling accept() and further
+ * clients wait in the kernel listen backlog instead of in our memory.
+ */
+typedef struct
+{
+    pool_job_t *jobs;               /**< Ring storage of capacity entries */
+    size_t capacity;                /**< Maximum number of queued jobs */
+    size_t head;                    /**< Index of the oldest job */
+    size_t count;                   /**< Number of queued jobs */
+    bool shutdown;                  /**< Set to release all waiters */
+    pthread_mutex_t mutex;          /**< Protects every field above */
+    pthread_cond_t not_empty;       /**< Signalled when a job is pushed */
+    pthread_cond_t not_full;        /**< Signalled when a job is popped */
+} work_queue_t;
+
+/**
+ * @brief Accepts clients and hands them to a pre-spawned pool of workers.
+ *
+ * @param listen_fd Listening socket.
+ * @param thread_count Number of worker threads.
+ * @param queue_depth Capacity of the pending connection queue.
+ * @return SUCCESS when accepting stops on shutdown, ERROR on failure.
+ */
+int worker_pool_run(int listen_fd, int thread_count, int queue_depth);
+
+#endif // AESDSOCKET_POOL_H
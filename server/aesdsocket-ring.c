@@ -0,0 +1,238 @@
+/***********************************************************************
+ * @file      		aesdsocket-ring.c
+ * @version   		0.1
+ * @brief		    In-memory storage backend on aesd_circular_buffer
+ *
+ * Behaves like the aesdchar driver without the kernel module: a write
+ * becomes an entry once its newline arrives, bytes before it wait as a
+ * pending partial write, and only the last
+ * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries are kept in the
+ * driver's own aesd_circular_buffer. With a capacity, the oldest entries
+ * are also dropped while the entries hold more than that many bytes;
+ * the newest entry always stays. The history mirror applies the same
+ * rule, so replies match what this store holds.
+ *
+ * Nothing survives the process, so a hot restart successor starts empty.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include "aesdsocket-ring.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct ring_store_t
+ * @brief Entries and the partial write after them.
+ */
+typedef struct
+{
+    struct aesd_circular_buffer entries;    /**< Completed writes, each in its own allocation */
+    size_t length;              /**< Bytes in entries */
+    size_t capacity;            /**< Most bytes entries may hold, 0 no limit */
+    char *pending;              /**< Partial write waiting for its newline */
+    size_t pending_len;         /**< Bytes in pending */
+    size_t pending_cap;         /**< Capacity of pending */
+} ring_store_t;
+
+/****************   Global Variables     ***************/
+static ring_store_t ring;
+
+size_t ring_entry_count(const struct aesd_circular_buffer *buffer)
+{
+    if(buffer->full)
+    {
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) %
+           AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+struct aesd_buffer_entry ring_evict_oldest(struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry oldest = buffer->entry[buffer->out_offs];
+
+    buffer->entry[buffer->out_offs].buffptr = NULL;
+    buffer->entry[buffer->out_offs].size = 0;
+    buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->full = false;
+    return oldest;
+}
+
+/**
+ * @brief Turns the pending bytes into an entry, evicting as the driver would.
+ */
+static void ring_complete_entry(void)
+{
+    struct aesd_buffer_entry entry = { .buffptr = ring.pending, .size = ring.pending_len };
+    struct aesd_buffer_entry evicted;
+
+    if(ring.entries.full)
+    {
+        evicted = ring_evict_oldest(&ring.entries);
+        ring.length -= evicted.size;
+        free((char *)evicted.buffptr);
+    }
+    aesd_circular_buffer_add_entry(&ring.entries, &entry);
+    ring.length += entry.size;
+    ring.pending = NULL;
+    ring.pending_len = 0;
+    ring.pending_cap = 0;
+
+    while((ring.capacity > 0) && (ring.length > ring.capacity) && (ring_entry_count(&ring.entries) > 1))
+    {
+        evicted = ring_evict_oldest(&ring.entries);
+        ring.length -= evicted.size;
+        free((char *)evicted.buffptr);
+    }
+}
+
+/**
+ * @brief Adds bytes to the partial write.
+ *
+ * @return SUCCESS or ERROR on allocation failure.
+ */
+static int ring_pend(const char *buf, size_t len)
+{
+    size_t cap = (ring.pending_cap > 0) ? ring.pending_cap : BUF_LEN;
+    char *grown;
+
+    while(cap < ring.pending_len + len)
+    {
+        cap *= 2;
+    }
+    if(cap != ring.pending_cap)
+    {
+        grown = realloc(ring.pending, cap);
+        if(grown == NULL)
+        {
+            log_msg(LOG_ERR, "Failed to grow ring store entry to %zu bytes", cap);
+            return ERROR;
+        }
+        ring.pending = grown;
+        ring.pending_cap = cap;
+    }
+    memcpy(ring.pending + ring.pending_len, buf, len);
+    ring.pending_len += len;
+    return SUCCESS;
+}
+
+static int ring_open(size_t capacity, size_t records)
+{
+    (void)records;
+    memset(&ring, 0, sizeof(ring));
+    aesd_circular_buffer_init(&ring.entries);
+    ring.capacity = capacity;
+    return SUCCESS;
+}
+
+static void ring_close(bool remove)
+{
+    uint8_t index;
+    struct aesd_buffer_entry *entry;
+
+    (void)remove;
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring.entries, index)
+    {
+        free((char *)entry->buffptr);
+    }
+    free(ring.pending);
+    memset(&ring, 0, sizeof(ring));
+}
+
+static ssize_t ring_append(const struct iovec *iov, int iovcnt)
+{
+    const char *buf;
+    const char *newline;
+    size_t len;
+    size_t chunk;
+    ssize_t accepted = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; i++)
+    {
+        buf = iov[i].iov_base;
+        len = iov[i].iov_len;
+        while(len > 0)
+        {
+            newline = memchr(buf, '\n', len);
+            chunk = (newline != NULL) ? (size_t)(newline - buf) + 1 : len;
+            if(ring_pend(buf, chunk) == ERROR)
+            {
+                return (accepted > 0) ? accepted : ERROR;
+            }
+            if(newline != NULL)
+            {
+                ring_complete_entry();
+            }
+            accepted += chunk;
+            buf += chunk;
+            len -= chunk;
+        }
+    }
+    return accepted;
+}
+
+static ssize_t ring_read(void *buf, size_t len, off_t offset)
+{
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+
+    if((offset < 0) || ((size_t)offset >= ring.length))
+    {
+        return 0;
+    }
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&ring.entries, offset, &entry_offset);
+    if(entry == NULL)
+    {
+        return 0;
+    }
+    if(len > entry->size - entry_offset)
+    {
+        len = entry->size - entry_offset;
+    }
+    memcpy(buf, entry->buffptr + entry_offset, len);
+    return len;
+}
+
+static int ring_seek(const struct aesd_seekto *seekto, off_t *offset)
+{
+    size_t position = 0;
+    uint32_t i;
+
+    if(seekto->write_cmd >= ring_entry_count(&ring.entries))
+    {
+        return ERROR;
+    }
+    for(i = 0; i < seekto->write_cmd; i++)
+    {
+        position += ring.entries.entry[(ring.entries.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+    }
+    if(seekto->write_cmd_offset >=
+       ring.entries.entry[(ring.entries.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size)
+    {
+        return ERROR;
+    }
+    *offset = position + seekto->write_cmd_offset;
+    return SUCCESS;
+}
+
+static off_t ring_length(void)
+{
+    return ring.length;
+}
+
+static ssize_t ring_record_count(void)
+{
+    return ring_entry_count(&ring.entries);
+}
+
+store_backend_t ring_backend = {
+    .name = "ring",
+    .capacity = true,
+    .bounded = true,
+    .open = ring_open,
+    .close = ring_close,
+    .append = ring_append,
+    .read = ring_read,
+    .seek = ring_seek,
+    .length = ring_length,
+    .record_count = ring_record_count,
+};
@@ -0,0 +1,30 @@
+/****************************************************************
+ * @file      		aesdsocket-ring.h
+ * @brief		    In-memory storage backend on aesd_circular_buffer
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_RING_H
+#define AESDSOCKET_RING_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+#include "aesdsocket-backend.h"
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+ * @brief Number of entries in a circular buffer.
+ */
+size_t ring_entry_count(const struct aesd_circular_buffer *buffer);
+
+/**
+ * @brief Drops the oldest entry of a circular buffer.
+ *
+ * @return The dropped entry; its memory is the caller's to release.
+ */
+struct aesd_buffer_entry ring_evict_oldest(struct aesd_circular_buffer *buffer);
+
+// Selected with -s ring[:bytes]
+extern store_backend_t ring_backend;
+
+#endif // AESDSOCKET_RING_H
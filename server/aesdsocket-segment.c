@@ -0,0 +1,693 @@
+/***********************************************************************
+ * @file      		aesdsocket-segment.c
+ * @version   		0.1
+ * @brief		    Segmented log storage backend on mmap'd files
+ *
+ * The file backend appends to a single file that only ever grows. This
+ * backend splits the log into SEGMENT_FILE_BYTES files in
+ * SEGMENT_DIR_PATH, each preallocated and mapped once, so an append is a
+ * memcpy() into the newest segment and a read is a memcpy() out of the
+ * mapping, whatever the size of the history. A new segment is started
+ * when the next write does not fit, at a record boundary where possible.
+ *
+ * With a retention limit (-s segments:bytes, -n records) the oldest
+ * segment is unmapped and unlinked as soon as the newer ones alone hold
+ * the limit, so disk and page cache use stay bounded and dropping old
+ * data costs one unlink() however much it holds.
+ *
+ * Replies are not sent from the mappings. Like every backend, this one
+ * is mirrored into the heap history (aesdsocket-history.c), and
+ * snapshots reference that single contiguous block. The retained bytes
+ * are therefore held twice: in the page cache behind the mappings and
+ * in a mirror block that history_reserve() sizes to twice the live
+ * bytes when it grows. So up to about three times the retention limit
+ * is in memory, and without a limit the mirror grows with the whole
+ * log. Serving from the mappings would take snapshots that span several
+ * segments and pin them against unlinking; that is not done here.
+ *
+ * During a hot restart the old and the new process append to the same
+ * segments, so every change is made with a flock() on the directory
+ * held. The segment headers are shared through the mappings: a sealed
+ * flag tells the other process a newer segment exists and a dropped flag
+ * that it was removed, and it picks both up before its next change.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "aesdsocket-segment.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct segment_t
+ * @brief One mapped segment file.
+ */
+typedef struct
+{
+    uint64_t seq;               /**< Sequence number, also the file name */
+    segment_header_t *header;   /**< Start of the mapping */
+    char *data;                 /**< First data byte, SEGMENT_HEADER_BYTES in */
+} segment_t;
+
+/**
+ * @struct segment_log_t
+ * @brief Mapped segments, oldest first, in a circular array so the oldest
+ *        is dropped without moving the others.
+ */
+typedef struct
+{
+    int dir_fd;                 /**< SEGMENT_DIR_PATH, also the flock() target */
+    segment_t *slots;           /**< Circular array of mapped segments */
+    size_t head;                /**< Slot of the oldest segment */
+    size_t count;               /**< Segments mapped */
+    size_t cap;                 /**< Slots allocated */
+    uint64_t sealed_records;    /**< Records in all segments but the newest */
+    size_t retain_bytes;        /**< Byte retention limit, 0 none */
+    size_t retain_records;      /**< Record retention limit, 0 none */
+    uint64_t sync_seq;          /**< Segment the last sync stopped in */
+    uint64_t sync_used;         /**< Bytes of it synced */
+} segment_log_t;
+
+/****************   Global Variables     ***************/
+static segment_log_t seglog = { .dir_fd = ERROR };
+
+static segment_t *segment_at(size_t index)
+{
+    return &seglog.slots[(seglog.head + index) % seglog.cap];
+}
+
+static segment_t *segment_newest(void)
+{
+    return segment_at(seglog.count - 1);
+}
+
+static void segment_name(char *name, size_t len, uint64_t seq)
+{
+    snprintf(name, len, "%016" PRIx64 ".seg", seq);
+}
+
+/**
+ * @brief Maps segment seq, creating and preallocating it if asked to.
+ *
+ * @return The mapped header, or NULL on failure.
+ */
+static segment_header_t *segment_map(uint64_t seq, bool create, uint64_t base)
+{
+    segment_header_t *header;
+    char name[32];
+    int fd;
+    int ret;
+
+    segment_name(name, sizeof(name), seq);
+    fd = openat(seglog.dir_fd, name, O_RDWR | O_CLOEXEC | (create ? (O_CREAT | O_EXCL) : 0),
+                S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+    if(fd == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to open segment %s: %s", name, strerror(errno));
+        return NULL;
+    }
+
+    // Reserve the blocks now: running out of space later would be a SIGBUS on a store
+    if(create && ((ret = posix_fallocate(fd, 0, SEGMENT_FILE_BYTES)) != 0))
+    {
+        log_msg(LOG_ERR, "Failed to allocate segment %s: %s", name, strerror(ret));
+        unlinkat(seglog.dir_fd, name, 0);
+        close(fd);
+        return NULL;
+    }
+
+    header = mmap(NULL, SEGMENT_FILE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED)
+    {
+        log_msg(LOG_ERR, "Failed to map segment %s: %s", name, strerror(errno));
+        if(create)
+        {
+            unlinkat(seglog.dir_fd, name, 0);
+        }
+        return NULL;
+    }
+
+    if(create)
+    {
+        header->magic = SEGMENT_MAGIC;
+        header->base = base;
+        atomic_init(&header->used, 0);
+        atomic_init(&header->records, 0);
+        atomic_init(&header->sealed, false);
+        atomic_init(&header->dropped, false);
+    }
+    else if((header->magic != SEGMENT_MAGIC) || (atomic_load(&header->used) > SEGMENT_DATA_BYTES))
+    {
+        log_msg(LOG_ERR, "Segment %s is not a valid segment", name);
+        munmap(header, SEGMENT_FILE_BYTES);
+        return NULL;
+    }
+    return header;
+}
+
+/**
+ * @brief Adds a mapped segment as the newest.
+ *
+ * @return SUCCESS or ERROR on allocation failure.
+ */
+static int segment_push(uint64_t seq, segment_header_t *header)
+{
+    segment_t *slots;
+    size_t cap;
+    size_t i;
+
+    if(seglog.count == seglog.cap)
+    {
+        cap = (seglog.cap > 0) ? 2 * seglog.cap : 16;
+        slots = malloc(cap * sizeof(segment_t));
+        if(slots == NULL)
+        {
+            log_msg(LOG_ERR, "Failed to grow segment table to %zu", cap);
+            return ERROR;
+        }
+        for(i = 0; i < seglog.count; i++)
+        {
+            slots[i] = *segment_at(i);
+        }
+        free(seglog.slots);
+        seglog.slots = slots;
+        seglog.cap = cap;
+        seglog.head = 0;
+    }
+
+    // The segment that was newest is sealed, so its count is final
+    if(seglog.count > 0)
+    {
+        seglog.sealed_records += atomic_load(&segment_newest()->header->records);
+    }
+    seglog.count++;
+    segment_newest()->seq = seq;
+    segment_newest()->header = header;
+    segment_newest()->data = (char *)header + SEGMENT_HEADER_BYTES;
+    return SUCCESS;
+}
+
+/**
+ * @brief Unmaps the oldest segment.
+ *
+ * @param remove Drop it for every process: flag it and unlink its file.
+ */
+static void segment_pop(bool remove)
+{
+    segment_t *oldest = segment_at(0);
+    char name[32];
+
+    if(seglog.count > 1)
+    {
+        seglog.sealed_records -= atomic_load(&oldest->header->records);
+    }
+    if(remove)
+    {
+        atomic_store(&oldest->header->dropped, true);
+        segment_name(name, sizeof(name), oldest->seq);
+        if(unlinkat(seglog.dir_fd, name, 0) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to delete segment %s", name);
+        }
+    }
+    munmap(oldest->header, SEGMENT_FILE_BYTES);
+    seglog.head = (seglog.head + 1) % seglog.cap;
+    seglog.count--;
+}
+
+static int seq_compare(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief Maps every segment file in the directory newer than after.
+ *
+ * @param any Map all of them, after is ignored.
+ * @return SUCCESS or ERROR.
+ */
+static int segment_scan(uint64_t after, bool any)
+{
+    segment_header_t *header;
+    struct dirent *dent;
+    uint64_t *seqs = NULL;
+    uint64_t *grown;
+    uint64_t seq;
+    size_t count = 0;
+    size_t cap = 0;
+    size_t i;
+    char *end;
+    DIR *dir;
+    int ret_status = SUCCESS;
+
+    dir = opendir(SEGMENT_DIR_PATH);
+    if(dir == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to list %s", SEGMENT_DIR_PATH);
+        return ERROR;
+    }
+    while((dent = readdir(dir)) != NULL)
+    {
+        seq = strtoull(dent->d_name, &end, 16);
+        if((end != dent->d_name + 16) || (strcmp(end, ".seg") != 0) || (!any && (seq <= after)))
+        {
+            continue;
+        }
+        if(count == cap)
+        {
+            cap = (cap > 0) ? 2 * cap : 16;
+            grown = realloc(seqs, cap * sizeof(uint64_t));
+            if(grown == NULL)
+            {
+                ret_status = ERROR;
+                break;
+            }
+            seqs = grown;
+        }
+        seqs[count++] = seq;
+    }
+    closedir(dir);
+
+    qsort(seqs, count, sizeof(uint64_t), seq_compare);
+    for(i = 0; (ret_status == SUCCESS) && (i < count); i++)
+    {
+        header = segment_map(seqs[i], false, 0);
+        if(header == NULL)
+        {
+            ret_status = ERROR;
+        }
+        else if(segment_push(seqs[i], header) == ERROR)
+        {
+            munmap(header, SEGMENT_FILE_BYTES);
+            ret_status = ERROR;
+        }
+        else if(seglog.count > 1)
+        {
+            atomic_store(&segment_at(seglog.count - 2)->header->sealed, true);
+        }
+    }
+    free(seqs);
+    return ret_status;
+}
+
+/**
+ * @brief Starts a new newest segment after the current one.
+ *
+ * @return SUCCESS or ERROR.
+ */
+static int segment_roll(void)
+{
+    segment_header_t *header;
+    segment_t *newest = (seglog.count > 0) ? segment_newest() : NULL;
+    uint64_t seq = (newest != NULL) ? newest->seq + 1 : 0;
+    uint64_t base = (newest != NULL) ? newest->header->base + atomic_load(&newest->header->used) : 0;
+
+    header = segment_map(seq, true, base);
+    if(header == NULL)
+    {
+        return ERROR;
+    }
+    if(segment_push(seq, header) == ERROR)
+    {
+        munmap(header, SEGMENT_FILE_BYTES);
+        return ERROR;
+    }
+    if(newest != NULL)
+    {
+        atomic_store(&segment_at(seglog.count - 2)->header->sealed, true);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Picks up segments another process added or dropped. Caller holds
+ *        the directory flock.
+ */
+static void segment_refresh(void)
+{
+    if((seglog.count > 0) && atomic_load(&segment_newest()->header->sealed))
+    {
+        segment_scan(segment_newest()->seq, false);
+    }
+    while((seglog.count > 0) && atomic_load(&segment_at(0)->header->dropped))
+    {
+        segment_pop(false);
+    }
+}
+
+static uint64_t segment_total_bytes(void)
+{
+    segment_t *newest = segment_newest();
+
+    return newest->header->base + atomic_load(&newest->header->used) - segment_at(0)->header->base;
+}
+
+static uint64_t segment_total_records(void)
+{
+    return seglog.sealed_records + atomic_load(&segment_newest()->header->records);
+}
+
+/**
+ * @brief Drops the oldest segments while the newer ones alone still hold
+ *        the byte or record limit.
+ */
+static void segment_retain(void)
+{
+    segment_header_t *oldest;
+
+    while(seglog.count > 1)
+    {
+        oldest = segment_at(0)->header;
+        if(!((seglog.retain_bytes > 0) &&
+             (segment_total_bytes() - atomic_load(&oldest->used) >= seglog.retain_bytes)) &&
+           !((seglog.retain_records > 0) &&
+             (segment_total_records() - atomic_load(&oldest->records) >= seglog.retain_records)))
+        {
+            break;
+        }
+        segment_pop(true);
+    }
+}
+
+static void segment_lock(void)
+{
+    while((flock(seglog.dir_fd, LOCK_EX) == ERROR) && (errno == EINTR))
+    {
+    }
+}
+
+static void segment_unlock(void)
+{
+    flock(seglog.dir_fd, LOCK_UN);
+}
+
+static int segment_open(size_t capacity, size_t records)
+{
+    int ret_status = SUCCESS;
+
+    if((mkdir(SEGMENT_DIR_PATH, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == ERROR) &&
+       (errno != EEXIST))
+    {
+        log_msg(LOG_ERR, "Failed to create %s", SEGMENT_DIR_PATH);
+        return ERROR;
+    }
+    seglog.dir_fd = open(SEGMENT_DIR_PATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(seglog.dir_fd == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to open %s", SEGMENT_DIR_PATH);
+        return ERROR;
+    }
+    seglog.retain_bytes = capacity;
+    seglog.retain_records = records;
+
+    // A predecessor's segments, or what a crash left behind, are carried on
+    segment_lock();
+    if(segment_scan(0, true) == ERROR)
+    {
+        ret_status = ERROR;
+    }
+    else if(seglog.count == 0)
+    {
+        ret_status = segment_roll();
+    }
+    segment_unlock();
+
+    if(ret_status == SUCCESS)
+    {
+        seglog.sync_seq = segment_newest()->seq;
+        seglog.sync_used = atomic_load(&segment_newest()->header->used);
+    }
+    return ret_status;
+}
+
+static void segment_close(bool remove)
+{
+    segment_lock();
+    if(remove)
+    {
+        segment_refresh();
+    }
+    while(seglog.count > 0)
+    {
+        segment_pop(remove);
+    }
+    segment_unlock();
+
+    if(remove && (rmdir(SEGMENT_DIR_PATH) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to delete %s", SEGMENT_DIR_PATH);
+    }
+    close(seglog.dir_fd);
+    free(seglog.slots);
+    memset(&seglog, 0, sizeof(seglog));
+    seglog.dir_fd = ERROR;
+}
+
+static ssize_t segment_append(const struct iovec *iov, int iovcnt)
+{
+    segment_header_t *header;
+    const char *buf;
+    const char *scan;
+    const char *newline;
+    size_t remaining = 0;
+    size_t len;
+    size_t used;
+    size_t chunk;
+    ssize_t accepted = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; i++)
+    {
+        remaining += iov[i].iov_len;
+    }
+
+    segment_lock();
+    segment_refresh();
+    for(i = 0; i < iovcnt; i++)
+    {
+        buf = iov[i].iov_base;
+        len = iov[i].iov_len;
+        while(len > 0)
+        {
+            header = segment_newest()->header;
+            used = atomic_load(&header->used);
+
+            // Roll when full, or early if that keeps the rest of the write in one segment
+            if((used == SEGMENT_DATA_BYTES) ||
+               ((used > 0) && (remaining > SEGMENT_DATA_BYTES - used) &&
+                (segment_newest()->data[used - 1] == '\n')))
+            {
+                if(segment_roll() == ERROR)
+                {
+                    segment_unlock();
+                    return (accepted > 0) ? accepted : ERROR;
+                }
+                continue;
+            }
+
+            chunk = (len < SEGMENT_DATA_BYTES - used) ? len : SEGMENT_DATA_BYTES - used;
+            memcpy(segment_newest()->data + used, buf, chunk);
+            for(scan = buf; (newline = memchr(scan, '\n', buf + chunk - scan)) != NULL; scan = newline + 1)
+            {
+                atomic_fetch_add(&header->records, 1);
+            }
+            atomic_store(&header->used, used + chunk);
+
+            accepted += chunk;
+            remaining -= chunk;
+            buf += chunk;
+            len -= chunk;
+        }
+    }
+    segment_retain();
+    segment_unlock();
+    return accepted;
+}
+
+/**
+ * @brief Copies out of the mapping of the segment holding offset.
+ *
+ * A read from offset 0 starts a new pass over the store, so it first
+ * picks up segments another process added or dropped.
+ */
+static ssize_t segment_read(void *buf, size_t len, off_t offset)
+{
+    segment_t *segment;
+    uint64_t position;
+    uint64_t used;
+    size_t low = 0;
+    size_t high;
+    size_t mid;
+
+    if(offset == 0)
+    {
+        segment_lock();
+        segment_refresh();
+        segment_unlock();
+    }
+
+    position = segment_at(0)->header->base + offset;
+    high = seglog.count - 1;
+    while(low < high)
+    {
+        mid = (low + high + 1) / 2;
+        if(segment_at(mid)->header->base <= position)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+
+    segment = segment_at(low);
+    used = atomic_load(&segment->header->used);
+    if(position - segment->header->base >= used)
+    {
+        return 0;
+    }
+    if(len > used - (position - segment->header->base))
+    {
+        len = used - (position - segment->header->base);
+    }
+    memcpy(buf, segment->data + (position - segment->header->base), len);
+    return len;
+}
+
+/**
+ * @brief Finds the stream position just after the nth newline, using the
+ *        per-segment counts to skip to the segment holding it.
+ *
+ * @return SUCCESS, or ERROR if fewer than n records are held.
+ */
+static int segment_record_end(uint64_t n, uint64_t *position)
+{
+    segment_t *segment;
+    const char *scan;
+    const char *end;
+    uint64_t records;
+    size_t i;
+
+    if(n == 0)
+    {
+        *position = segment_at(0)->header->base;
+        return SUCCESS;
+    }
+
+    for(i = 0; i < seglog.count; i++)
+    {
+        segment = segment_at(i);
+        records = atomic_load(&segment->header->records);
+        if(n > records)
+        {
+            n -= records;
+            continue;
+        }
+        scan = segment->data;
+        end = segment->data + atomic_load(&segment->header->used);
+        while((scan = memchr(scan, '\n', end - scan)) != NULL)
+        {
+            scan++;
+            if(--n == 0)
+            {
+                *position = segment->header->base + (scan - segment->data);
+                return SUCCESS;
+            }
+        }
+        break;
+    }
+    return ERROR;
+}
+
+static int segment_seek(const struct aesd_seekto *seekto, off_t *offset)
+{
+    uint64_t start;
+    uint64_t end;
+    int ret_status = ERROR;
+
+    segment_lock();
+    segment_refresh();
+    if((segment_record_end(seekto->write_cmd, &start) == SUCCESS) &&
+       (segment_record_end((uint64_t)seekto->write_cmd + 1, &end) == SUCCESS) &&
+       (seekto->write_cmd_offset < end - start))
+    {
+        *offset = start + seekto->write_cmd_offset - segment_at(0)->header->base;
+        ret_status = SUCCESS;
+    }
+    segment_unlock();
+    return ret_status;
+}
+
+static off_t segment_length(void)
+{
+    return segment_total_bytes();
+}
+
+static ssize_t segment_record_count(void)
+{
+    return segment_total_records();
+}
+
+/**
+ * @brief msync()s what was appended since the last sync.
+ *
+ * Runs after the appender released the store lock; the read lock keeps
+ * a seek from unmapping segments under it. Ranges are aligned down from
+ * the start of the mapping, which mmap() puts on a page boundary, so the
+ * data need not start on one with pages larger than the header.
+ */
+static int segment_sync(void)
+{
+    segment_t *segment;
+    uint64_t used;
+    size_t from;
+    size_t i;
+    long page = sysconf(_SC_PAGESIZE);
+    int ret_status = SUCCESS;
+
+    pthread_rwlock_rdlock(&lock);
+    for(i = 0; i < seglog.count; i++)
+    {
+        segment = segment_at(i);
+        if(segment->seq < seglog.sync_seq)
+        {
+            continue;
+        }
+        // File offsets, header included
+        used = SEGMENT_HEADER_BYTES + atomic_load(&segment->header->used);
+        from = SEGMENT_HEADER_BYTES + ((segment->seq == seglog.sync_seq) ? seglog.sync_used : 0);
+        from -= from % page;
+        if(((used > from) && (msync((char *)segment->header + from, used - from, MS_SYNC) == ERROR)) ||
+           (msync(segment->header, SEGMENT_HEADER_BYTES, MS_SYNC) == ERROR))
+        {
+            ret_status = ERROR;
+        }
+    }
+    seglog.sync_seq = segment_newest()->seq;
+    seglog.sync_used = atomic_load(&segment_newest()->header->used);
+    pthread_rwlock_unlock(&lock);
+    return ret_status;
+}
+
+store_backend_t segment_backend = {
+    .name = "segments",
+    .capacity = true,
+    .records = true,
+    .retention = true,
+    .shared = true,
+    .timestamps = true,
+    .open = segment_open,
+    .close = segment_close,
+    .append = segment_append,
+    .read = segment_read,
+    .seek = segment_seek,
+    .length = segment_length,
+    .sync = segment_sync,
+    .record_count = segment_record_count,
+};
@@ -0,0 +1,46 @@
+/****************************************************************
+ * @file      		aesdsocket-segment.h
+ * @brief		    Segmented log storage backend on mmap'd files
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_SEGMENT_H
+#define AESDSOCKET_SEGMENT_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+#include "aesdsocket-backend.h"
+
+/****************   Macros     ***************/
+
+#define SEGMENT_DIR_PATH        "/var/tmp/aesdsocketdata.d"
+// Size of every segment file, header included
+#define SEGMENT_FILE_BYTES      (1024 * 1024)
+// Header in front of the data; segment_sync() aligns msync() ranges from the
+// start of the mapping, so this is not tied to the page size
+#define SEGMENT_HEADER_BYTES    (4096)
+#define SEGMENT_DATA_BYTES      (SEGMENT_FILE_BYTES - SEGMENT_HEADER_BYTES)
+#define SEGMENT_MAGIC           (0x41455347u)
+
+/**
+ * @struct segment_header_t
+ * @brief First page of every segment file.
+ *
+ * Shared with any other process that has the segment mapped; the counters
+ * are only changed with the directory flock held.
+ */
+typedef struct
+{
+    uint32_t magic;             /**< SEGMENT_MAGIC */
+    uint32_t reserved;
+    uint64_t base;              /**< Stream position of the first data byte */
+    _Atomic uint64_t used;      /**< Data bytes written */
+    _Atomic uint64_t records;   /**< Newlines in the data */
+    atomic_bool sealed;         /**< A newer segment exists */
+    atomic_bool dropped;        /**< Removed by retention; forget it */
+} segment_header_t;
+
+// Selected with -s segments[:bytes], -n records
+extern store_backend_t segment_backend;
+
+#endif // AESDSOCKET_SEGMENT_H
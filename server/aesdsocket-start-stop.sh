@@ -9,8 +9,13 @@ case "$1" in
         echo "Stopping aesdsocket server"
         start-stop-daemon -K -n aesdsocket
         ;;
+    restart)
+        # The new daemon takes the listener over; the running one drains and exits on its own
+        echo "Restarting aesdsocket server"
+        /usr/bin/aesdsocket -d -R
+        ;;
     *)
-        echo "Usage: $0 {start|stop}"
+        echo "Usage: $0 {start|stop|restart}"
     exit 1
 esac
 
@@ -0,0 +1,388 @@
+/***********************************************************************
+ * @file      		aesdsocket-stats.c
+ * @version   		0.1
+ * @brief		    Per-thread counters and latency histograms
+ *
+ * Every thread that touches a counter claims a slot on first use and is
+ * the only writer of that slot, so the hot path never takes a lock or
+ * does an atomic read-modify-write. Readers sum all slots with relaxed
+ * loads. When a thread exits its slot is handed to the next new thread
+ * and keeps its totals, so the sums stay monotonic.
+ *
+ * Latencies go into log-linear histograms in the HDR style: values are
+ * bucketed by their highest set bit and the next STATS_SUB_BUCKET_BITS
+ * bits, which bounds the relative error at 1/8 from nanoseconds to
+ * minutes in a fixed 4 KB per phase.
+ *
+ * The report is returned in band for the STATS_COMMAND packet and written
+ * to STATS_DUMP_FILE on SIGUSR1.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <stdatomic.h>
+#include "aesdsocket-stats.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct stats_slot
+ * @brief Counters owned by one thread.
+ */
+typedef struct stats_slot
+{
+    _Atomic uint64_t counters[STAT_COUNTER_COUNT];
+    _Atomic uint64_t histograms[STAT_PHASE_COUNT][STATS_BUCKETS];
+    bool in_use;                        /**< Owned by a live thread, guarded by slots_mutex */
+
+    SLIST_ENTRY(stats_slot) slots;
+} stats_slot_t;
+
+/****************   Global Variables     ***************/
+static SLIST_HEAD(stats_slot_list, stats_slot) slot_head = SLIST_HEAD_INITIALIZER(slot_head);
+static pthread_mutex_t slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;
+static _Thread_local stats_slot_t *local_slot;
+
+static const char *counter_names[STAT_COUNTER_COUNT] = {
+    [STAT_CONN_ACCEPTED] = "connections_accepted",
+    [STAT_CONN_CLOSED] = "connections_closed",
+    [STAT_CONN_EVICTED] = "connections_evicted",
+    [STAT_CONN_REJECTED] = "connections_rejected",
+    [STAT_BYTES_IN] = "bytes_in",
+    [STAT_BYTES_OUT] = "bytes_out",
+    [STAT_RECORDS_APPENDED] = "records_appended",
+    [STAT_SEEKS] = "seek_ioctls",
+    [STAT_RECORDS_THROTTLED] = "records_throttled",
+    [STAT_COMPRESS_RAW_BYTES] = "compress_raw_bytes",
+    [STAT_COMPRESS_OUT_BYTES] = "compress_out_bytes",
+    [STAT_COMPRESS_CACHE_HITS] = "compress_cache_hits",
+    [STAT_FRAMES] = "frames",
+    [STAT_SYNCS] = "syncs",
+};
+
+static const char *phase_names[STAT_PHASE_COUNT] = {
+    [STAT_PHASE_RECEIVE] = "receive",
+    [STAT_PHASE_APPEND] = "append",
+    [STAT_PHASE_REPLY] = "reply",
+    [STAT_PHASE_COMPRESS] = "compress",
+    [STAT_PHASE_PARSE] = "parse",
+    [STAT_PHASE_SYNC] = "sync",
+};
+
+static pthread_t dumper_thread;
+static atomic_bool dumper_running;
+
+/**
+ * @brief Thread exit hook: hands the slot on, totals included.
+ */
+static void slot_release(void *arg)
+{
+    stats_slot_t *slot = (stats_slot_t *)arg;
+
+    pthread_mutex_lock(&slots_mutex);
+    slot->in_use = false;
+    pthread_mutex_unlock(&slots_mutex);
+}
+
+static void slot_key_create(void)
+{
+    pthread_key_create(&slot_key, slot_release);
+}
+
+/**
+ * @brief Returns the calling thread's slot, claiming one on first use.
+ *
+ * @return The slot, or NULL if none could be allocated.
+ */
+static stats_slot_t *slot_get(void)
+{
+    stats_slot_t *slot;
+
+    if(local_slot != NULL)
+    {
+        return local_slot;
+    }
+
+    pthread_once(&slot_key_once, slot_key_create);
+
+    pthread_mutex_lock(&slots_mutex);
+    SLIST_FOREACH(slot, &slot_head, slots)
+    {
+        if(!slot->in_use)
+        {
+            break;
+        }
+    }
+    if(slot == NULL)
+    {
+        slot = calloc(1, sizeof(stats_slot_t));
+        if(slot != NULL)
+        {
+            SLIST_INSERT_HEAD(&slot_head, slot, slots);
+        }
+    }
+    if(slot != NULL)
+    {
+        slot->in_use = true;
+    }
+    pthread_mutex_unlock(&slots_mutex);
+
+    if(slot != NULL)
+    {
+        pthread_setspecific(slot_key, slot);
+        local_slot = slot;
+    }
+    return slot;
+}
+
+/**
+ * @brief Single-writer increment: the owning thread is the only writer.
+ */
+static void slot_bump(_Atomic uint64_t *cell, uint64_t value)
+{
+    atomic_store_explicit(cell, atomic_load_explicit(cell, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/**
+ * @brief Maps a latency to its log-linear bucket.
+ */
+static int bucket_index(uint64_t value)
+{
+    int msb;
+
+    if(value < (1u << STATS_SUB_BUCKET_BITS))
+    {
+        return (int)value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    return ((msb - STATS_SUB_BUCKET_BITS + 1) << STATS_SUB_BUCKET_BITS) +
+           (int)((value >> (msb - STATS_SUB_BUCKET_BITS)) & ((1u << STATS_SUB_BUCKET_BITS) - 1));
+}
+
+/**
+ * @brief Largest value that falls into a bucket.
+ */
+static uint64_t bucket_upper(int index)
+{
+    int shift;
+
+    if(index < (1 << STATS_SUB_BUCKET_BITS))
+    {
+        return index;
+    }
+    shift = (index >> STATS_SUB_BUCKET_BITS) - 1;
+    return ((((uint64_t)1 << STATS_SUB_BUCKET_BITS) + (index & ((1 << STATS_SUB_BUCKET_BITS) - 1)) + 1)
+            << shift) - 1;
+}
+
+void stats_add(stat_counter_t counter, uint64_t value)
+{
+    stats_slot_t *slot = slot_get();
+
+    if(slot != NULL)
+    {
+        slot_bump(&slot->counters[counter], value);
+    }
+}
+
+uint64_t stats_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void stats_record(stat_phase_t phase, uint64_t start_ns)
+{
+    stats_slot_t *slot = slot_get();
+    uint64_t now = stats_now();
+
+    if(slot != NULL)
+    {
+        slot_bump(&slot->histograms[phase][bucket_index((now > start_ns) ? now - start_ns : 0)], 1);
+    }
+}
+
+bool stats_is_command(const char *packet, size_t length)
+{
+    size_t cmd_len = strlen(STATS_COMMAND);
+
+    // Accept the command with or without its trailing newline
+    if((length > cmd_len) && (packet[length - 1] == '\n'))
+    {
+        length--;
+    }
+    return (length == cmd_len) && (memcmp(packet, STATS_COMMAND, cmd_len) == 0);
+}
+
+/**
+ * @brief Prints count, percentiles and the non-empty buckets of one phase.
+ */
+static void histogram_write(FILE *out, const char *name, const uint64_t *buckets)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *quantile_names[] = { "p50", "p90", "p99", "p999" };
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    size_t q = 0;
+    int i;
+
+    for(i = 0; i < STATS_BUCKETS; i++)
+    {
+        total += buckets[i];
+    }
+
+    fprintf(out, "latency_%s_ns count %llu", name, (unsigned long long)total);
+    for(i = 0; (i < STATS_BUCKETS) && (q < sizeof(quantiles) / sizeof(quantiles[0])); i++)
+    {
+        seen += buckets[i];
+        while((total > 0) && (q < sizeof(quantiles) / sizeof(quantiles[0])) &&
+              (seen >= quantiles[q] * total))
+        {
+            fprintf(out, " %s %llu", quantile_names[q], (unsigned long long)bucket_upper(i));
+            q++;
+        }
+    }
+    fprintf(out, "\n");
+
+    for(i = 0; i < STATS_BUCKETS; i++)
+    {
+        if(buckets[i] > 0)
+        {
+            fprintf(out, "latency_%s_ns_bucket le %llu %llu\n", name,
+                    (unsigned long long)bucket_upper(i), (unsigned long long)buckets[i]);
+        }
+    }
+}
+
+void stats_write(FILE *out)
+{
+    static uint64_t histograms[STAT_PHASE_COUNT][STATS_BUCKETS];
+    static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+    uint64_t counters[STAT_COUNTER_COUNT] = { 0 };
+    stats_slot_t *slot;
+    ssize_t records;
+    int counter;
+    int phase;
+    int i;
+
+    // The summing buffer is large; reports are rare, so share one
+    pthread_mutex_lock(&report_mutex);
+    memset(histograms, 0, sizeof(histograms));
+
+    pthread_mutex_lock(&slots_mutex);
+    SLIST_FOREACH(slot, &slot_head, slots)
+    {
+        for(counter = 0; counter < STAT_COUNTER_COUNT; counter++)
+        {
+            counters[counter] += atomic_load_explicit(&slot->counters[counter], memory_order_relaxed);
+        }
+        for(phase = 0; phase < STAT_PHASE_COUNT; phase++)
+        {
+            for(i = 0; i < STATS_BUCKETS; i++)
+            {
+                histograms[phase][i] += atomic_load_explicit(&slot->histograms[phase][i],
+                                                             memory_order_relaxed);
+            }
+        }
+    }
+    pthread_mutex_unlock(&slots_mutex);
+
+    for(counter = 0; counter < STAT_COUNTER_COUNT; counter++)
+    {
+        fprintf(out, "%s %llu\n", counter_names[counter], (unsigned long long)counters[counter]);
+    }
+    fprintf(out, "connections_active %llu\n",
+            (unsigned long long)((counters[STAT_CONN_ACCEPTED] > counters[STAT_CONN_CLOSED]) ?
+                                 counters[STAT_CONN_ACCEPTED] - counters[STAT_CONN_CLOSED] : 0));
+    if((records = store_record_count()) != ERROR)
+    {
+        fprintf(out, "store_records %lld\n", (long long)records);
+    }
+    for(phase = 0; phase < STAT_PHASE_COUNT; phase++)
+    {
+        histogram_write(out, phase_names[phase], histograms[phase]);
+    }
+    pthread_mutex_unlock(&report_mutex);
+}
+
+int stats_acquire(history_snapshot_t *snap)
+{
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *out;
+    int ret_status;
+
+    out = open_memstream(&report, &report_len);
+    if(out == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to open statistics buffer");
+        return ERROR;
+    }
+    stats_write(out);
+    fclose(out);
+
+    ret_status = history_acquire_buffer(snap, report, report_len);
+    free(report);
+    return ret_status;
+}
+
+/**
+ * @brief Dump thread body: writes the report each time SIGUSR1 arrives.
+ */
+static void *stats_dumper(void *arg)
+{
+    sigset_t signals;
+    FILE *out;
+    int signal_number;
+
+    (void)arg;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+
+    while(atomic_load(&dumper_running))
+    {
+        if((sigwait(&signals, &signal_number) != 0) || !atomic_load(&dumper_running))
+        {
+            continue;
+        }
+
+        out = fopen(STATS_DUMP_FILE, "w");
+        if(out == NULL)
+        {
+            log_msg(LOG_ERR, "Failed to open %s", STATS_DUMP_FILE);
+            continue;
+        }
+        stats_write(out);
+        fclose(out);
+        log_msg(LOG_INFO, "Statistics written to %s", STATS_DUMP_FILE);
+    }
+
+    return NULL;
+}
+
+int stats_start_dumper(void)
+{
+    atomic_store(&dumper_running, true);
+    if(pthread_create(&dumper_thread, NULL, stats_dumper, NULL) != 0)
+    {
+        log_msg(LOG_ERR, "Failed to create statistics dump thread");
+        atomic_store(&dumper_running, false);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+void stats_stop_dumper(void)
+{
+    if(!atomic_exchange(&dumper_running, false))
+    {
+        return;
+    }
+
+    // Wake the sigwait() so the thread sees the flag
+    pthread_kill(dumper_thread, SIGUSR1);
+    pthread_join(dumper_thread, NULL);
+}
@@ -0,0 +1,117 @@
+/****************************************************************
+ * @file      		aesdsocket-stats.h
+ * @brief		    Per-thread counters and latency histograms
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_STATS_H
+#define AESDSOCKET_STATS_H
+
+/****************   Includes    ***************/
+#include <stdint.h>
+#include "aesdsocket.h"
+#include "aesdsocket-history.h"
+
+/****************   Macros     ***************/
+
+// In-band admin command; the reply is the statistics text instead of the history
+#define STATS_COMMAND           "AESDSOCKET_STATS"
+// Written on SIGUSR1
+#define STATS_DUMP_FILE         "/var/tmp/aesdsocket.stats"
+
+// Histogram resolution: 2^STATS_SUB_BUCKET_BITS linear buckets per power of two
+#define STATS_SUB_BUCKET_BITS   (3)
+#define STATS_BUCKETS           (64 << STATS_SUB_BUCKET_BITS)
+
+/**
+ * @enum stat_counter_t
+ * @brief Monotonic event counters.
+ */
+typedef enum
+{
+    STAT_CONN_ACCEPTED,     /**< Connections taken from a listener */
+    STAT_CONN_CLOSED,       /**< Connections released */
+    STAT_CONN_EVICTED,      /**< Connections dropped for not taking their reply */
+    STAT_CONN_REJECTED,     /**< Connections refused by the per-address limit */
+    STAT_BYTES_IN,          /**< Bytes received from clients */
+    STAT_BYTES_OUT,         /**< Bytes sent to clients */
+    STAT_RECORDS_APPENDED,  /**< Successful store appends */
+    STAT_SEEKS,             /**< AESDCHAR_IOCSEEKTO requests issued */
+    STAT_RECORDS_THROTTLED, /**< Appends refused by a per-address rate limit */
+    STAT_COMPRESS_RAW_BYTES,    /**< History bytes sent as compressed replies */
+    STAT_COMPRESS_OUT_BYTES,    /**< Frame bytes those replies took */
+    STAT_COMPRESS_CACHE_HITS,   /**< Full blocks taken from the compressed block cache */
+    STAT_FRAMES,            /**< Requests received as binary frames */
+    STAT_SYNCS,             /**< Store syncs run for -D interval or strict */
+    STAT_COUNTER_COUNT
+} stat_counter_t;
+
+/**
+ * @enum stat_phase_t
+ * @brief Request phases with a latency histogram.
+ */
+typedef enum
+{
+    STAT_PHASE_RECEIVE,     /**< First byte of a packet until it is complete */
+    STAT_PHASE_APPEND,      /**< Store append, including the group-commit wait */
+    STAT_PHASE_REPLY,       /**< History snapshot until the last byte is sent */
+    STAT_PHASE_COMPRESS,    /**< LZ4 compression of one reply block */
+    STAT_PHASE_PARSE,       /**< Complete packet until its request is decoded */
+    STAT_PHASE_SYNC,        /**< One store sync covering every batch since the previous one */
+    STAT_PHASE_COUNT
+} stat_phase_t;
+
+/**
+ * @brief Adds value to a counter of the calling thread.
+ *
+ * Every thread owns its counters, so this is a plain load and store with
+ * no atomic read-modify-write and no shared cache line.
+ */
+void stats_add(stat_counter_t counter, uint64_t value);
+
+/**
+ * @brief Monotonic clock in nanoseconds, for phase start stamps.
+ */
+uint64_t stats_now(void);
+
+/**
+ * @brief Records the latency of a phase that started at start_ns.
+ */
+void stats_record(stat_phase_t phase, uint64_t start_ns);
+
+/**
+ * @brief Reports whether a packet is the statistics command.
+ */
+bool stats_is_command(const char *packet, size_t length);
+
+/**
+ * @brief Sums every thread's counters and histograms and prints them.
+ *
+ * @param out Stream to write the text report to.
+ */
+void stats_write(FILE *out);
+
+/**
+ * @brief Builds a reply snapshot holding the current statistics report.
+ *
+ * @param[out] snap Snapshot to fill; release it with history_release().
+ * @return SUCCESS or ERROR.
+ */
+int stats_acquire(history_snapshot_t *snap);
+
+/**
+ * @brief Starts the thread that writes STATS_DUMP_FILE on SIGUSR1.
+ *
+ * SIGUSR1 must already be blocked in every thread (see main()) so that
+ * only this thread's sigwait() receives it.
+ *
+ * @return SUCCESS or ERROR.
+ */
+int stats_start_dumper(void);
+
+/**
+ * @brief Stops the SIGUSR1 dump thread.
+ */
+void stats_stop_dumper(void);
+
+#endif // AESDSOCKET_STATS_H
@@ -0,0 +1,218 @@
+/***********************************************************************
+ * @file      		aesdsocket-store.c
+ * @version   		0.1
+ * @brief		    Long-lived data store shared by every connection
+ *
+ * DATA_FILE used to be opened and closed for every received chunk and
+ * again for every reply. The store is now opened once at startup through
+ * the backend selected with -s (aesdsocket-backend.c). Appends are
+ * batched by the group-commit appender thread (aesdsocket-appender.c).
+ * Every append is mirrored into the history cache (aesdsocket-history.c)
+ * inside the same critical section, and replies are served from that
+ * mirror instead of reading the store back.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <errno.h>
+#include <sys/uio.h>
+#include "aesdsocket-store.h"
+#include "aesdsocket-backend.h"
+#include "aesdsocket-history.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-compress.h"
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-log.h"
+
+/****************   Global Variables     ***************/
+// Backend picked with -s, set by store_open()
+static store_backend_t *backend;
+
+int store_open(void)
+{
+    durability_t durability;
+    int ret_status;
+
+    backend = store_backend_find(s_config.store_name);
+    if((backend == NULL) || (backend->open(s_config.store_capacity, s_config.store_records) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to open %s store", s_config.store_name);
+        backend = NULL;
+        return ERROR;
+    }
+    log_msg(LOG_INFO, "Store backend %s, capacity %zu, records %zu", backend->name,
+            s_config.store_capacity, s_config.store_records);
+
+    history_init(backend->bounded, s_config.store_capacity);
+
+    pthread_rwlock_wrlock(&lock);
+    ret_status = history_load(backend);
+    pthread_rwlock_unlock(&lock);
+
+    durability = s_config.durability;
+    if((durability != DURABILITY_NONE) && (backend->sync == NULL))
+    {
+        log_msg(LOG_WARNING, "Store backend %s has nothing to sync, durability none", backend->name);
+        durability = DURABILITY_NONE;
+    }
+
+    if((ret_status == SUCCESS) &&
+       (appender_start(backend, durability, s_config.sync_interval_ms) == ERROR))
+    {
+        log_msg(LOG_WARNING, "Appender thread unavailable, clients will write directly");
+    }
+    return ret_status;
+}
+
+void store_close(void)
+{
+    if(backend == NULL)
+    {
+        return;
+    }
+
+    appender_stop();
+    // Client threads cut off by a signal may still append or reply meanwhile
+    pthread_rwlock_wrlock(&lock);
+    // A successor serves the same store
+    backend->close(!handoff_done());
+    backend = NULL;
+    history_destroy();
+    pthread_rwlock_unlock(&lock);
+    compress_cache_clear();
+}
+
+ssize_t store_record_count(void)
+{
+    ssize_t count = ERROR;
+
+    pthread_rwlock_rdlock(&lock);
+    if((backend != NULL) && (backend->record_count != NULL))
+    {
+        count = backend->record_count();
+    }
+    pthread_rwlock_unlock(&lock);
+    return count;
+}
+
+bool store_timestamps(void)
+{
+    store_backend_t *selected = store_backend_find(s_config.store_name);
+
+    return (selected != NULL) && selected->timestamps;
+}
+
+void store_resync(void)
+{
+    pthread_rwlock_wrlock(&lock);
+    if((backend != NULL) && (history_load(backend) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to resync history mirror");
+    }
+    pthread_rwlock_unlock(&lock);
+
+    // Stream positions may have moved under the cached blocks
+    compress_cache_clear();
+}
+
+ssize_t store_append(const void *buf, size_t len)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    uint64_t start = stats_now();
+    store_backend_t *store;
+    ssize_t written = ERROR;
+
+    if(appender_running())
+    {
+        written = appender_submit(buf, len);
+    }
+    else
+    {
+        pthread_rwlock_wrlock(&lock);
+        store = backend;
+        if(store != NULL)
+        {
+            written = store->append(&iov, 1);
+        }
+        if((written > 0) && (history_append(buf, written) == ERROR))
+        {
+            // The store has the bytes but the mirror does not; resync from the store
+            history_load(store);
+        }
+        else if((written > 0) && store->retention)
+        {
+            history_trim(store->length());
+        }
+        pthread_rwlock_unlock(&lock);
+
+        if(written == ERROR)
+        {
+            log_msg(LOG_ERR, "Unsuccessful file write operation");
+        }
+        // Without the appender thread there is no interval sync, only the strict one
+        else if((s_config.durability == DURABILITY_STRICT) && (store->sync != NULL) &&
+                (store->sync() == ERROR))
+        {
+            log_msg(LOG_ERR, "Sync of appended record failed");
+        }
+    }
+
+    if(written > 0)
+    {
+        stats_add(STAT_RECORDS_APPENDED, 1);
+        stats_record(STAT_PHASE_APPEND, start);
+    }
+    return written;
+}
+
+bool store_append_async(append_request_t *req, const void *buf, size_t len)
+{
+    req->start = stats_now();
+    if((len > 0) && (appender_submit_async(req, buf, len) == SUCCESS))
+    {
+        return true;
+    }
+    req->result = store_append(buf, len);
+    return false;
+}
+
+ssize_t store_append_finish(append_request_t *req)
+{
+    if(req->result > 0)
+    {
+        stats_add(STAT_RECORDS_APPENDED, 1);
+        stats_record(STAT_PHASE_APPEND, req->start);
+    }
+    return req->result;
+}
+
+int store_seek(struct aesd_seekto *seekto, off_t *offset)
+{
+    bool reloaded = false;
+    int ret_status = SUCCESS;
+
+    stats_add(STAT_SEEKS, 1);
+    pthread_rwlock_wrlock(&lock);
+    if((backend == NULL) || (backend->seek(seekto, offset) == ERROR))
+    {
+        ret_status = ERROR;
+    }
+    /**
+     * Resync with what another writer of the store may have changed before
+     * replying from the mirror. Only a length that no longer matches the
+     * mirror tells it did; a full reload on every seek would cost the whole
+     * history under the write lock.
+     */
+    else if(backend->shared && (backend->length() != history_length()))
+    {
+        reloaded = true;
+        ret_status = history_load(backend);
+    }
+    pthread_rwlock_unlock(&lock);
+
+    // Stream positions may have moved under the cached blocks, as in store_resync()
+    if(reloaded)
+    {
+        compress_cache_clear();
+    }
+    return ret_status;
+}
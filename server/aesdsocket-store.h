@@ -0,0 +1,104 @@
+/****************************************************************
+ * @file      		aesdsocket-store.h
+ * @brief		    Process-wide handle to the aesdsocket data store
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_STORE_H
+#define AESDSOCKET_STORE_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+struct append_request;
+
+/**
+ * @brief Opens the s_config.store_name backend for the lifetime of the
+ *        process and loads the history mirror from it.
+ *
+ * @return SUCCESS or ERROR.
+ */
+int store_open(void);
+
+/**
+ * @brief Closes the store and discards what it holds, unless it was
+ *        handed to a successor process.
+ */
+void store_close(void);
+
+/**
+ * @brief Complete records the store holds.
+ *
+ * @return The count, or ERROR if the backend does not keep one.
+ */
+ssize_t store_record_count(void);
+
+/**
+ * @brief Whether the selected backend takes the periodic timestamp records.
+ */
+bool store_timestamps(void);
+
+/**
+ * @brief Reloads the history mirror from the store.
+ *
+ * Used after a hot restart, once the previous process has exited, to
+ * pick up the appends it made while draining.
+ */
+void store_resync(void);
+
+/**
+ * @brief Appends a buffer to the store.
+ *
+ * The buffer is handed to the appender thread, which commits it in one
+ * piece together with whatever else is pending and returns once it is
+ * visible (or durable with -D strict). Descriptor backends are opened with
+ * O_APPEND so every write lands at the end regardless of the shared file
+ * position, and the accepted bytes are copied into the history mirror under the
+ * same lock, so the mirror sees appends in store order.
+ *
+ * @param buf Data to append.
+ * @param len Number of bytes in buf.
+ * @return Bytes written or ERROR.
+ */
+ssize_t store_append(const void *buf, size_t len);
+
+/**
+ * @brief Appends a buffer to the store without waiting for the commit,
+ *        for event loops.
+ *
+ * The record is queued with appender_submit_async() and comes back on
+ * req->completion; store_append_finish() then gives the result. Without
+ * the appender thread, or for an empty buffer, it is appended right away
+ * with store_append() instead.
+ *
+ * @param req Request with completion set; it and buf must stay valid
+ *        until the request is handed back.
+ * @param buf Data to append.
+ * @param len Number of bytes in buf.
+ * @return true if queued, false if already done with the result in req->result.
+ */
+bool store_append_async(struct append_request *req, const void *buf, size_t len);
+
+/**
+ * @brief Accounts for a request handed back after store_append_async().
+ *
+ * @return Bytes written or ERROR, as store_append().
+ */
+ssize_t store_append_finish(struct append_request *req);
+
+/**
+ * @brief Resolves an AESDCHAR_IOCSEEKTO request to a store offset.
+ *
+ * The backend resolves it under the global lock; for the char device the
+ * ioctl moves the shared file position, which is read back under the same
+ * lock. A store other processes can write is then reloaded into the
+ * history mirror if its length no longer matches, so the reply shows
+ * what they appended.
+ *
+ * @param seekto Write command and offset to seek to.
+ * @param[out] offset Receives the resulting store offset.
+ * @return SUCCESS, or ERROR if the backend rejected the request.
+ */
+int store_seek(struct aesd_seekto *seekto, off_t *offset);
+
+#endif // AESDSOCKET_STORE_H
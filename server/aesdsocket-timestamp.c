@@ -0,0 +1,188 @@
+/***********************************************************************
+ * @file      		aesdsocket-timestamp.c
+ * @version   		0.1
+ * @brief		    timerfd driven timestamp records
+ *
+ * Timestamps used to come from a dedicated thread sleeping in
+ * clock_nanosleep() that called localtime() and strftime() for every
+ * record. The period is now a timerfd that the existing server loop
+ * waits on next to its listener, so no thread of its own is needed and
+ * the record is queued with the appender like any client packet,
+ * batching with them. The loop does not wait for the commit: the
+ * request is reaped on the next expiration, so a -D strict sync never
+ * stalls the loop that happened to fire.
+ *
+ * The formatted text is cached: localtime_r() and strftime() only run
+ * when the minute changes, every other record just rewrites the two
+ * seconds digits.
+ ************************************************************************/
+/****************   Includes    ***************/
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include "aesdsocket-timestamp.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-log.h"
+
+/**
+ * @struct timestamp_t
+ * @brief Timer and cached record text.
+ */
+typedef struct
+{
+    int timerFd;                /**< Periodic timerfd, ERROR when off */
+    pthread_mutex_t mutex;      /**< Serializes formatting if several loops fire */
+    time_t minute_start;        /**< Wall clock second the cached prefix starts at */
+    size_t prefix_len;          /**< Bytes of the cached prefix in text */
+    char text[TIMESTAMP_STRING_LENGTH];  /**< Cached prefix, then seconds and newline */
+    append_request_t append;    /**< Record queued with the appender, sent from text */
+    append_completion_t appended;   /**< Where the appender hands append back */
+    bool appending;             /**< append is queued; text must not change */
+} timestamp_t;
+
+/****************   Global Variables     ***************/
+static timestamp_t timestamp = {
+    .timerFd = ERROR,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .minute_start = (time_t)-1,
+    .append.completion = &timestamp.appended,
+    .appended.eventFd = ERROR,
+};
+
+/**
+ * @brief Renders the record for now into timestamp.text.
+ *
+ * @return Record length, or 0 if the time could not be formatted.
+ */
+static size_t timestamp_format(time_t now)
+{
+    struct tm local_time_info;
+    int seconds;
+
+    // Time zone and DST changes land on minute boundaries, so the prefix holds for 60 s
+    if((timestamp.minute_start == (time_t)-1) || (now < timestamp.minute_start) ||
+       (now >= timestamp.minute_start + 60))
+    {
+        if(localtime_r(&now, &local_time_info) == NULL)
+        {
+            return 0;
+        }
+        timestamp.prefix_len = strftime(timestamp.text, sizeof(timestamp.text) - 4,
+                                        TIMESTAMP_FORMAT_PREFIX, &local_time_info);
+        if(timestamp.prefix_len == 0)
+        {
+            timestamp.minute_start = (time_t)-1;
+            return 0;
+        }
+        timestamp.minute_start = now - local_time_info.tm_sec;
+    }
+
+    seconds = now - timestamp.minute_start;
+    timestamp.text[timestamp.prefix_len] = '0' + seconds / 10;
+    timestamp.text[timestamp.prefix_len + 1] = '0' + seconds % 10;
+    timestamp.text[timestamp.prefix_len + 2] = '\n';
+    return timestamp.prefix_len + 3;
+}
+
+/**
+ * @brief Takes the queued record back once the appender committed it.
+ *
+ * Called with timestamp.mutex held.
+ */
+static void timestamp_reap(void)
+{
+    if(timestamp.appending && (appender_completion_take(&timestamp.appended) != NULL))
+    {
+        timestamp.appending = false;
+        if(store_append_finish(&timestamp.append) == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to write timestamp to file.");
+        }
+    }
+}
+
+int timestamp_open(long interval_ms)
+{
+    struct itimerspec period;
+
+    if(appender_completion_init(&timestamp.appended) == ERROR)
+    {
+        return ERROR;
+    }
+
+    timestamp.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timestamp.timerFd == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to create timestamp timer");
+        timestamp_close();
+        return ERROR;
+    }
+
+    period.it_interval.tv_sec = interval_ms / 1000;
+    period.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    period.it_value = period.it_interval;
+    if(timerfd_settime(timestamp.timerFd, 0, &period, NULL) == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to arm timestamp timer");
+        timestamp_close();
+        return ERROR;
+    }
+
+    log_msg(LOG_INFO, "Timestamp every %ld ms", interval_ms);
+    return SUCCESS;
+}
+
+void timestamp_close(void)
+{
+    if(timestamp.timerFd != ERROR)
+    {
+        close(timestamp.timerFd);
+        timestamp.timerFd = ERROR;
+    }
+    appender_completion_destroy(&timestamp.appended);
+    timestamp.appending = false;
+}
+
+int timestamp_fd(void)
+{
+    return timestamp.timerFd;
+}
+
+void timestamp_fire(void)
+{
+    uint64_t expirations;
+    size_t length;
+
+    // Whoever reads the counter writes the record; a racing loop gets EAGAIN
+    if(read(timestamp.timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+    // The successor writes them now
+    if(handoff_done())
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&timestamp.mutex);
+    timestamp_reap();
+    // A whole period without a commit: the appender is far behind, do not pile on
+    if(timestamp.appending)
+    {
+        log_msg(LOG_WARNING, "Previous timestamp not committed yet, skipping one");
+    }
+    else if((length = timestamp_format(time(NULL))) == 0)
+    {
+        log_msg(LOG_ERR, "Failed to write timestamp to file.");
+    }
+    else if(store_append_async(&timestamp.append, timestamp.text, length))
+    {
+        timestamp.appending = true;
+    }
+    else if(timestamp.append.result == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to write timestamp to file.");
+    }
+    pthread_mutex_unlock(&timestamp.mutex);
+}
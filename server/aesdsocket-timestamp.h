@@ -0,0 +1,48 @@
+/****************************************************************
+ * @file      		aesdsocket-timestamp.h
+ * @brief		    timerfd driven timestamp records
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_TIMESTAMP_H
+#define AESDSOCKET_TIMESTAMP_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+#define TIMESTAMP_FORMAT_PREFIX     "timestamp: %Y, %b %d, %H:%M:"
+
+/**
+ * @brief Arms the periodic timestamp timer.
+ *
+ * Nothing is written until a server loop sees timestamp_fd() become
+ * readable and calls timestamp_fire().
+ *
+ * @param interval_ms Time between timestamp records.
+ * @return SUCCESS or ERROR.
+ */
+int timestamp_open(long interval_ms);
+
+/**
+ * @brief Disarms and closes the timer.
+ */
+void timestamp_close(void);
+
+/**
+ * @brief Returns the timerfd to wait on, or ERROR when timestamps are off.
+ */
+int timestamp_fd(void);
+
+/**
+ * @brief Consumes the timer expirations and queues one timestamp record.
+ *
+ * Does not wait for the commit; the previous record is reaped first, and
+ * if it is still not committed this expiration writes nothing.
+ * Expirations missed while the loop was busy are folded into one record.
+ * Safe to call when another loop already consumed the expiration.
+ */
+void timestamp_fire(void);
+
+#endif // AESDSOCKET_TIMESTAMP_H
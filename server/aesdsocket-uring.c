@@ -0,0 +1,1132 @@
+/***********************************************************************
+ * @file      		aesdsocket-uring.c
+ * @version   		0.1
+ * @brief		    io_uring execution engine for the socket server
+ *
+ * A single thread drives one ring. Client sockets are registered as
+ * fixed files 0..URING_MAX_CONNS-1 and each connection slot owns one
+ * registered receive buffer, so the kernel never has to pin user pages
+ * per request.
+ *
+ * Per packet the pipeline is:
+ *   READ_FIXED(socket) -> line assembler -+-> READ_FIXED(socket)  (no newline yet)
+ *                                         +-> handle_packet() -> POLL(appended) -> SEND(snapshot) ...
+ * Chunks are gathered into a line_assembler_t until the record is
+ * complete, so the packet is parsed, charged and appended whole by the
+ * same handle_packet() and reply_acquire() as every other mode. The
+ * reply is sent straight from a snapshot of the mirror; the store is
+ * never read back. The append is queued with the appender, not waited
+ * for: it counts as one more op in flight on its connection until a
+ * POLL_ADD on the engine's completion eventfd reports its batch
+ * committed (and synced with -D strict), so the other connections keep
+ * going meanwhile. All SQEs of all connections are flushed with one
+ * io_uring_enter() per loop iteration, which also reaps their completions.
+ * A POLL_ADD on the timestamp timerfd rides in the same ring. Every SEND
+ * carries a LINK_TIMEOUT for whatever reply_wait_ms() still allows, so a
+ * client that stops reading is cancelled and evicted instead of holding
+ * its slot forever. A POLL_ADD on the hot restart event stops the engine
+ * accepting, cancelling the armed ACCEPT, once the listener has gone to a
+ * successor; the loop then ends with its last connection. One more on
+ * shutdown_fd() ends it on a termination signal.
+ *
+ * The raw syscalls are used directly so the target image needs no
+ * liburing. If the toolchain headers or the running kernel lack
+ * io_uring, uring_server_run() reports URING_UNSUPPORTED.
+ *
+ * @reference
+ *
+ * 1. https://kernel.dk/io_uring.pdf
+ ************************************************************************/
+/****************   Includes    ***************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "aesdsocket-uring.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-history.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-timestamp.h"
+#include "aesdsocket-admission.h"
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-frame.h"
+#include "aesdsocket-assembler.h"
+#include "aesdsocket-log.h"
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+/****************   Macros     ***************/
+
+#define URING_ACCEPT_SLOT       (URING_MAX_CONNS)
+#define URING_TIMER_SLOT        (URING_MAX_CONNS + 1)
+#define URING_HANDOFF_SLOT      (URING_MAX_CONNS + 2)
+#define URING_APPEND_SLOT       (URING_MAX_CONNS + 3)
+
+#define URING_USER_DATA(slot, op)   ((((uint64_t)(slot)) << 8) | (op))
+#define URING_USER_SLOT(data)       ((int)((data) >> 8))
+#define URING_USER_OP(data)         ((int)((data) & 0xff))
+
+/**
+ * @enum uring_op_t
+ * @brief Operation tag carried in every SQE's user_data.
+ */
+typedef enum
+{
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_TIMER,
+    URING_OP_SEND_TIMEOUT,
+    URING_OP_HANDOFF,
+    URING_OP_CANCEL,
+    URING_OP_SHUTDOWN,
+    URING_OP_APPEND,
+} uring_op_t;
+
+/**
+ * @struct uring_t
+ * @brief Mapped submission and completion rings.
+ */
+typedef struct
+{
+    int ringFd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned sq_local_tail;     /**< Tail including SQEs not yet published */
+    unsigned to_submit;         /**< SQEs published but not yet consumed */
+} uring_t;
+
+/**
+ * @struct uring_conn_t
+ * @brief Per-slot connection state.
+ */
+typedef struct
+{
+    int clientSocketFd;
+    bool in_use;
+    bool closing;               /**< Release once inflight drops to zero */
+    int inflight;               /**< SQEs submitted whose CQE is outstanding */
+    off_t reply_off;            /**< Next store offset to send */
+    history_snapshot_t reply;   /**< History snapshot the reply is sent from */
+    line_assembler_t assembler; /**< Packet gathered from the received chunks */
+    append_request_t append;    /**< Record queued with the appender, counted in inflight */
+    bool append_partial;        /**< The queued record is an oversize chunk, not the packet */
+    uint64_t receive_start;     /**< stats_now() at the packet's first byte, 0 if none yet */
+    uint64_t reply_start;       /**< stats_now() when the reply snapshot was taken */
+    uint64_t reply_progress;    /**< stats_now() when the client last took reply bytes */
+    struct __kernel_timespec send_timeout;  /**< Deadline of the SEND in flight, read by the kernel */
+    admission_source_t *source; /**< Admission entry of the peer address, NULL if untracked */
+    char ip[INET6_ADDRSTRLEN];
+} uring_conn_t;
+
+/**
+ * @struct uring_server_t
+ * @brief Engine state: the ring, fixed resources and connection slots.
+ */
+typedef struct
+{
+    uring_t ring;
+    int listenFd;
+    bool accept_armed;
+    bool accept_polling;        /**< The armed op is a POLL_ADD on the listener, not an ACCEPT */
+    bool draining;              /**< Listener handed to a successor; stop once idle */
+    int active_conns;
+    struct sockaddr_storage acceptAddr;
+    socklen_t acceptLen;
+    char *buffers;              /**< URING_MAX_CONNS registered receive buffers of BUF_LEN */
+    append_completion_t appends;    /**< Records the appender hands back */
+    uring_conn_t conns[URING_MAX_CONNS];
+} uring_server_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static char *rx_buf(uring_server_t *srv, int slot)
+{
+    return srv->buffers + (size_t)slot * BUF_LEN;
+}
+
+/**
+ * @brief Creates a ring and maps its SQ, CQ and SQE arrays.
+ *
+ * @param ring Ring to set up.
+ * @param entries Requested submission queue size.
+ * @return SUCCESS or ERROR with errno set.
+ */
+static int uring_setup(uring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->ringFd = sys_io_uring_setup(entries, &params);
+    if(ring->ringFd == ERROR)
+    {
+        return ERROR;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_size > ring->sq_size)
+        {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ringFd, IORING_OFF_SQ_RING);
+    if(ring->sq_ptr == MAP_FAILED)
+    {
+        close(ring->ringFd);
+        return ERROR;
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ringFd, IORING_OFF_CQ_RING);
+        if(ring->cq_ptr == MAP_FAILED)
+        {
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(ring->ringFd);
+            return ERROR;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ringFd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        if(ring->cq_ptr != ring->sq_ptr)
+        {
+            munmap(ring->cq_ptr, ring->cq_size);
+        }
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->ringFd);
+        return ERROR;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + params.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    return SUCCESS;
+}
+
+/**
+ * @brief Unmaps and closes a ring created by uring_setup().
+ *
+ * @param ring Ring to tear down.
+ */
+static void uring_teardown(uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->ringFd);
+}
+
+/**
+ * @brief Publishes queued SQEs and optionally waits for completions.
+ *
+ * @param ring Ring to submit on.
+ * @param wait_nr Minimum number of completions to wait for.
+ * @return Number of SQEs consumed, or ERROR with errno set.
+ */
+static int uring_submit(uring_t *ring, unsigned wait_nr)
+{
+    int ret;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    ring->to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    ret = sys_io_uring_enter(ring->ringFd, ring->to_submit, wait_nr,
+                             (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0);
+    if(ret > 0)
+    {
+        ring->to_submit -= ret;
+    }
+    return ret;
+}
+
+/**
+ * @brief Reserves the next free SQE, flushing the queue if it is full.
+ *
+ * @param ring Ring to take an SQE from.
+ * @return A zeroed SQE.
+ */
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    while((ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= ring->entries)
+    {
+        if((uring_submit(ring, 0) == ERROR) && (errno != EINTR) && (errno != EBUSY))
+        {
+            break;
+        }
+    }
+
+    index = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+/**
+ * @brief Checks that the kernel implements every opcode this engine issues.
+ *
+ * @param ring Ring to probe.
+ * @return true if all required opcodes are supported.
+ */
+static bool uring_probe_ops(uring_t *ring)
+{
+    static const int required_ops[] = {
+        IORING_OP_ACCEPT, IORING_OP_READ_FIXED, IORING_OP_SEND, IORING_OP_POLL_ADD, IORING_OP_LINK_TIMEOUT,
+        IORING_OP_ASYNC_CANCEL
+    };
+    struct io_uring_probe *probe;
+    size_t probe_size = sizeof(*probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    bool supported = true;
+    size_t i;
+
+    probe = calloc(1, probe_size);
+    if(probe == NULL)
+    {
+        return false;
+    }
+
+    if(sys_io_uring_register(ring->ringFd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == ERROR)
+    {
+        free(probe);
+        return false;
+    }
+
+    for(i = 0; i < sizeof(required_ops) / sizeof(required_ops[0]); i++)
+    {
+        if((required_ops[i] > probe->last_op) ||
+           !(probe->ops[required_ops[i]].flags & IO_URING_OP_SUPPORTED))
+        {
+            supported = false;
+        }
+    }
+
+    free(probe);
+    return supported;
+}
+
+/**
+ * @brief Registers the empty socket slots and all connection buffers.
+ *
+ * @param srv Engine state with buffers already set up.
+ * @return SUCCESS or ERROR with errno set.
+ */
+static int uring_register_resources(uring_server_t *srv)
+{
+    int fds[URING_MAX_CONNS];
+    struct iovec iov[URING_MAX_CONNS];
+    int i;
+
+    for(i = 0; i < URING_MAX_CONNS; i++)
+    {
+        fds[i] = -1;
+    }
+    if(sys_io_uring_register(srv->ring.ringFd, IORING_REGISTER_FILES, fds, URING_MAX_CONNS) == ERROR)
+    {
+        return ERROR;
+    }
+
+    for(i = 0; i < URING_MAX_CONNS; i++)
+    {
+        iov[i].iov_base = rx_buf(srv, i);
+        iov[i].iov_len = BUF_LEN;
+    }
+    return sys_io_uring_register(srv->ring.ringFd, IORING_REGISTER_BUFFERS, iov, URING_MAX_CONNS);
+}
+
+/**
+ * @brief Points a client's fixed file slot at fd (or clears it with -1).
+ */
+static int uring_update_slot(uring_server_t *srv, int slot, int fd)
+{
+    struct io_uring_files_update update;
+
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+    return sys_io_uring_register(srv->ring.ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+/**
+ * @brief Fills an SQE for a fixed-file read/write style operation.
+ */
+static struct io_uring_sqe *uring_prep(uring_server_t *srv, int op, int fixed_fd, void *addr,
+                                       unsigned len, uint64_t off, int slot, uring_op_t tag)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&srv->ring);
+
+    sqe->opcode = op;
+    sqe->fd = fixed_fd;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = URING_USER_DATA(slot, tag);
+    srv->conns[slot].inflight++;
+    return sqe;
+}
+
+static void conn_submit_recv(uring_server_t *srv, int slot)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_prep(srv, IORING_OP_READ_FIXED, slot, rx_buf(srv, slot), BUF_LEN, 0,
+                     slot, URING_OP_RECV);
+    sqe->buf_index = slot;
+}
+
+/**
+ * @brief Keeps one accept outstanding while a connection slot is free.
+ *
+ * The listener is non-blocking, so an ACCEPT with nothing queued
+ * completes with -EAGAIN; the next one armed is a POLL_ADD waiting for a
+ * connection instead. Both carry the same user_data, so uring_drain()
+ * cancels whichever is in flight.
+ */
+static void uring_arm_accept(uring_server_t *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    if(srv->accept_armed || srv->draining || (srv->active_conns == URING_MAX_CONNS) || fatal_error_in_progress)
+    {
+        return;
+    }
+
+    if(srv->accept_polling)
+    {
+        sqe = uring_get_sqe(&srv->ring);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = srv->listenFd;
+        sqe->poll_events = POLLIN;
+        sqe->user_data = URING_USER_DATA(URING_ACCEPT_SLOT, URING_OP_ACCEPT);
+        srv->accept_armed = true;
+        return;
+    }
+
+    srv->acceptLen = sizeof(srv->acceptAddr);
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->listenFd;
+    sqe->addr = (uint64_t)(uintptr_t)&srv->acceptAddr;
+    sqe->addr2 = (uint64_t)(uintptr_t)&srv->acceptLen;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_USER_DATA(URING_ACCEPT_SLOT, URING_OP_ACCEPT);
+    srv->accept_armed = true;
+}
+
+/**
+ * @brief Waits for the next timestamp timer expiration.
+ */
+static void uring_arm_timer(uring_server_t *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    if(timestamp_fd() == ERROR)
+    {
+        return;
+    }
+
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = timestamp_fd();
+    sqe->poll_events = POLLIN;
+    sqe->user_data = URING_USER_DATA(URING_TIMER_SLOT, URING_OP_TIMER);
+}
+
+/**
+ * @brief Waits for the listener to be handed to a successor.
+ */
+static void uring_arm_handoff(uring_server_t *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    if(handoff_fd() == ERROR)
+    {
+        return;
+    }
+
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = handoff_fd();
+    sqe->poll_events = POLLIN;
+    sqe->user_data = URING_USER_DATA(URING_HANDOFF_SLOT, URING_OP_HANDOFF);
+}
+
+/**
+ * @brief Wakes the loop once a termination signal arrived.
+ */
+static void uring_arm_shutdown(uring_server_t *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    if(shutdown_fd() == ERROR)
+    {
+        return;
+    }
+
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = shutdown_fd();
+    sqe->poll_events = POLLIN;
+    sqe->user_data = URING_USER_DATA(URING_HANDOFF_SLOT, URING_OP_SHUTDOWN);
+}
+
+/**
+ * @brief Waits for the appender to hand back committed records.
+ */
+static void uring_arm_appends(uring_server_t *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = srv->appends.eventFd;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = URING_USER_DATA(URING_APPEND_SLOT, URING_OP_APPEND);
+}
+
+/**
+ * @brief Stops accepting; the ACCEPT in flight would otherwise take a
+ *        connection meant for the successor.
+ */
+static void uring_drain(uring_server_t *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    srv->draining = true;
+    if(!srv->accept_armed)
+    {
+        return;
+    }
+
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_USER_DATA(URING_ACCEPT_SLOT, URING_OP_ACCEPT);
+    sqe->user_data = URING_USER_DATA(URING_HANDOFF_SLOT, URING_OP_CANCEL);
+}
+
+/**
+ * @brief Frees a slot once none of its operations are in flight.
+ */
+static void conn_release(uring_server_t *srv, int slot)
+{
+    uring_conn_t *conn = &srv->conns[slot];
+
+    uring_update_slot(srv, slot, -1);
+    close(conn->clientSocketFd);
+    history_release(&conn->reply);
+    assembler_release(&conn->assembler);
+    admission_release(conn->source);
+    log_msg(LOG_INFO, "Terminated connection: %s", conn->ip);
+    stats_add(STAT_CONN_CLOSED, 1);
+
+    conn->in_use = false;
+    srv->active_conns--;
+    uring_arm_accept(srv);
+}
+
+static void conn_fail(uring_server_t *srv, int slot)
+{
+    srv->conns[slot].closing = true;
+    if(srv->conns[slot].inflight == 0)
+    {
+        conn_release(srv, slot);
+    }
+}
+
+/**
+ * @brief Sends the next part of the reply snapshot, or closes once it is all out.
+ *
+ * The SEND is linked to a timeout covering what reply_wait_ms() allows;
+ * a client already past its limits is evicted right away.
+ */
+static void conn_submit_send(uring_server_t *srv, int slot)
+{
+    uring_conn_t *conn = &srv->conns[slot];
+    struct io_uring_sqe *sqe;
+    size_t remaining;
+    int wait_ms;
+
+    if((conn->reply.block == NULL) || (conn->reply_off < 0) ||
+       ((size_t)conn->reply_off >= conn->reply.length))
+    {
+        stats_record(STAT_PHASE_REPLY, conn->reply_start);
+        conn_fail(srv, slot);
+        return;
+    }
+
+    remaining = conn->reply.length - conn->reply_off;
+    wait_ms = reply_wait_ms(remaining, conn->reply_start, conn->reply_progress);
+    if(wait_ms == 0)
+    {
+        log_msg(LOG_INFO, "Evicted slow client: %s", conn->ip);
+        stats_add(STAT_CONN_EVICTED, 1);
+        conn_fail(srv, slot);
+        return;
+    }
+
+    sqe = uring_prep(srv, IORING_OP_SEND, slot,
+                     conn->reply.block->data + conn->reply.base + conn->reply_off,
+                     (remaining > UINT32_MAX) ? UINT32_MAX : remaining, 0, slot, URING_OP_SEND);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    if(wait_ms < 0)
+    {
+        return;
+    }
+
+    // The ring holds far more than two SQEs per slot, so the pair is never split across submits
+    sqe->flags |= IOSQE_IO_LINK;
+    conn->send_timeout.tv_sec = wait_ms / 1000;
+    conn->send_timeout.tv_nsec = (wait_ms % 1000) * 1000000L;
+    sqe = uring_get_sqe(&srv->ring);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&conn->send_timeout;
+    sqe->len = 1;
+    sqe->user_data = URING_USER_DATA(slot, URING_OP_SEND_TIMEOUT);
+    conn->inflight++;
+}
+
+/**
+ * @brief Snapshots the reply selected by packet_status (see
+ *        reply_acquire()) and starts sending it from reply_off.
+ */
+static void conn_start_reply(uring_server_t *srv, int slot, int packet_status)
+{
+    uring_conn_t *conn = &srv->conns[slot];
+
+    if(conn->receive_start != 0)
+    {
+        stats_record(STAT_PHASE_RECEIVE, conn->receive_start);
+        conn->receive_start = 0;
+    }
+
+    conn->reply_start = stats_now();
+    conn->reply_progress = conn->reply_start;
+    // One packet per connection: a compression command only gets its acknowledgement
+    if(reply_acquire(&conn->reply, packet_status, &conn->reply_off, false) == ERROR)
+    {
+        conn_fail(srv, slot);
+        return;
+    }
+    conn_submit_send(srv, slot);
+}
+
+/**
+ * @brief Completes an accept by binding the new socket to a free slot.
+ *
+ * @param srv Engine state.
+ * @param fd Accepted socket, or a negative errno; the poll mask when the
+ *           armed op was the listener POLL_ADD.
+ */
+static void uring_on_accept(uring_server_t *srv, int fd)
+{
+    uring_conn_t *conn;
+    admission_source_t *source;
+    int slot;
+
+    srv->accept_armed = false;
+    if(srv->accept_polling)
+    {
+        // Listener readable (or the poll failed): try the ACCEPT again
+        srv->accept_polling = false;
+        if((fd < 0) && (fd != -ECANCELED))
+        {
+            log_msg(LOG_ERR, "Failed to wait for client connection");
+        }
+        uring_arm_accept(srv);
+        return;
+    }
+    if(fd < 0)
+    {
+        // Nothing queued, or another process took it: poll, then accept again
+        srv->accept_polling = ((fd == -EAGAIN) || (fd == -EWOULDBLOCK));
+        if((fd != -EINTR) && (fd != -ECANCELED) && (fd != -ECONNABORTED) && !srv->accept_polling)
+        {
+            log_msg(LOG_ERR, "Failed to accept client connection");
+        }
+        uring_arm_accept(srv);
+        return;
+    }
+
+    if(admission_acquire((struct sockaddr *)&srv->acceptAddr, &source) == ERROR)
+    {
+        close(fd);
+        uring_arm_accept(srv);
+        return;
+    }
+
+    for(slot = 0; slot < URING_MAX_CONNS; slot++)
+    {
+        if(!srv->conns[slot].in_use)
+        {
+            break;
+        }
+    }
+
+    if((slot == URING_MAX_CONNS) || (uring_update_slot(srv, slot, fd) == ERROR))
+    {
+        log_msg(LOG_ERR, "No io_uring slot for new client connection");
+        admission_release(source);
+        close(fd);
+        uring_arm_accept(srv);
+        return;
+    }
+
+    conn = &srv->conns[slot];
+    memset(conn, 0, sizeof(*conn));
+    conn->clientSocketFd = fd;
+    conn->source = source;
+    conn->append.completion = &srv->appends;
+    assembler_init(&conn->assembler);
+    conn->in_use = true;
+    inet_ntop(srv->acceptAddr.ss_family, get_in_addr((struct sockaddr *)&srv->acceptAddr),
+              conn->ip, sizeof(conn->ip));
+    srv->active_conns++;
+    log_msg(LOG_INFO, "New connection established: %s", conn->ip);
+    stats_add(STAT_CONN_ACCEPTED, 1);
+
+    conn_submit_recv(srv, slot);
+    uring_arm_accept(srv);
+}
+
+/**
+ * @brief Handles the assembled packet and starts its reply.
+ *
+ * One packet per connection: everything received so far is the packet.
+ */
+static void conn_handle_packet(uring_server_t *srv, int slot)
+{
+    uring_conn_t *conn = &srv->conns[slot];
+    size_t packet_length = conn->assembler.len;
+    int packet_status;
+
+    conn->reply_off = 0;
+    packet_status = (packet_length > 0) ?
+                    handle_packet(conn->assembler.buf, packet_length, &conn->reply_off, conn->source,
+                                  &conn->append) : SUCCESS;
+    if(packet_status == PACKET_APPENDING)
+    {
+        // The record stays in the assembler until the appender hands it back
+        conn->inflight++;
+        return;
+    }
+    assembler_release(&conn->assembler);
+    if(packet_status == ERROR)
+    {
+        conn_fail(srv, slot);
+        return;
+    }
+    conn_start_reply(srv, slot, packet_status);
+}
+
+/**
+ * @brief Adds a received chunk to the packet, and handles the packet once
+ *        its newline arrived or the peer closed.
+ */
+static void uring_on_recv(uring_server_t *srv, int slot, int res)
+{
+    uring_conn_t *conn = &srv->conns[slot];
+    char *buf = rx_buf(srv, slot);
+
+    if(res < 0)
+    {
+        log_msg(LOG_ERR, "Data reception unsuccessful");
+        conn_fail(srv, slot);
+        return;
+    }
+
+    // Peer closed without a newline: commit what we have as the packet
+    if(res == 0)
+    {
+        conn_handle_packet(srv, slot);
+        return;
+    }
+
+    stats_add(STAT_BYTES_IN, res);
+    if(conn->receive_start == 0)
+    {
+        // Requests are one packet per connection here; frames need the thread, pool or epoll modes
+        if((conn->assembler.len == 0) && ((uint8_t)buf[0] == FRAME_MAGIC))
+        {
+            log_msg(LOG_ERR, "Binary framing is not supported by the io_uring engine: %s", conn->ip);
+            conn_fail(srv, slot);
+            return;
+        }
+        conn->receive_start = stats_now();
+    }
+
+    // The registered buffer is reused by the next READ_FIXED
+    if(assembler_reserve(&conn->assembler, res) == ERROR)
+    {
+        conn_fail(srv, slot);
+        return;
+    }
+    memcpy(conn->assembler.buf + conn->assembler.len, buf, res);
+    assembler_commit(&conn->assembler, res);
+
+    if(assembler_record_length(&conn->assembler) > 0)
+    {
+        conn_handle_packet(srv, slot);
+        return;
+    }
+
+    // Bound memory for a packet that never ends
+    if(conn->assembler.len >= ASSEMBLER_MAX_PENDING)
+    {
+        if(admission_charge(conn->source, 0, conn->assembler.len) == ERROR)
+        {
+            conn_fail(srv, slot);
+            return;
+        }
+        if(store_append_async(&conn->append, conn->assembler.buf, conn->assembler.len))
+        {
+            conn->append_partial = true;
+            conn->inflight++;
+            return;
+        }
+        if(conn->append.result == ERROR)
+        {
+            conn_fail(srv, slot);
+            return;
+        }
+        assembler_consume(&conn->assembler, conn->assembler.len);
+    }
+    conn_submit_recv(srv, slot);
+}
+
+/**
+ * @brief Carries on with a connection whose queued record the appender
+ *        handed back: receives on after an oversize chunk, replies after
+ *        the packet.
+ */
+static void conn_committed(uring_server_t *srv, int slot)
+{
+    uring_conn_t *conn = &srv->conns[slot];
+    bool partial = conn->append_partial;
+    ssize_t result = store_append_finish(&conn->append);
+
+    conn->append_partial = false;
+    conn->inflight--;
+    if(conn->closing)
+    {
+        if(conn->inflight == 0)
+        {
+            conn_release(srv, slot);
+        }
+        return;
+    }
+
+    if(result == ERROR)
+    {
+        conn_fail(srv, slot);
+        return;
+    }
+    if(partial)
+    {
+        assembler_consume(&conn->assembler, conn->assembler.len);
+        conn_submit_recv(srv, slot);
+        return;
+    }
+    assembler_release(&conn->assembler);
+    conn_start_reply(srv, slot, SUCCESS);
+}
+
+/**
+ * @brief Hands every record the appender committed back to its connection.
+ */
+static void uring_committed(uring_server_t *srv)
+{
+    append_request_t *req = appender_completion_take(&srv->appends);
+    append_request_t *next;
+    uring_conn_t *conn;
+
+    while(req != NULL)
+    {
+        next = req->completed_next;
+        conn = (uring_conn_t *)((char *)req - offsetof(uring_conn_t, append));
+        conn_committed(srv, (int)(conn - srv->conns));
+        req = next;
+    }
+}
+
+/**
+ * @brief Dispatches one completion to the owning connection.
+ */
+static void uring_handle_cqe(uring_server_t *srv, const struct io_uring_cqe *cqe)
+{
+    int slot = URING_USER_SLOT(cqe->user_data);
+    uring_conn_t *conn;
+
+    if(URING_USER_OP(cqe->user_data) == URING_OP_ACCEPT)
+    {
+        uring_on_accept(srv, cqe->res);
+        return;
+    }
+
+    if(URING_USER_OP(cqe->user_data) == URING_OP_TIMER)
+    {
+        timestamp_fire();
+        uring_arm_timer(srv);
+        return;
+    }
+
+    if(URING_USER_OP(cqe->user_data) == URING_OP_APPEND)
+    {
+        uring_committed(srv);
+        uring_arm_appends(srv);
+        return;
+    }
+
+    if(URING_USER_OP(cqe->user_data) == URING_OP_HANDOFF)
+    {
+        log_msg(LOG_INFO, "Listener handed to successor, draining io_uring engine");
+        uring_drain(srv);
+        return;
+    }
+
+    // The cancelled ACCEPT completes on its own; the loop condition sees a shutdown
+    if((URING_USER_OP(cqe->user_data) == URING_OP_CANCEL) ||
+       (URING_USER_OP(cqe->user_data) == URING_OP_SHUTDOWN))
+    {
+        return;
+    }
+
+    conn = &srv->conns[slot];
+    conn->inflight--;
+    if(conn->closing)
+    {
+        if(conn->inflight == 0)
+        {
+            conn_release(srv, slot);
+        }
+        return;
+    }
+
+    switch(URING_USER_OP(cqe->user_data))
+    {
+    case URING_OP_RECV:
+        uring_on_recv(srv, slot, cqe->res);
+        break;
+
+    case URING_OP_SEND:
+        // Cancelled by its linked timeout. The SEND only wakes once a large
+        // part of the socket buffer has drained, so a slow reader may still
+        // have room: push directly once before giving up on the client
+        if(cqe->res == -ECANCELED)
+        {
+            if(history_send(conn->clientSocketFd, &conn->reply, &conn->reply_off) > 0)
+            {
+                conn->reply_progress = stats_now();
+                conn_submit_send(srv, slot);
+                break;
+            }
+            log_msg(LOG_INFO, "Evicted slow client: %s", conn->ip);
+            stats_add(STAT_CONN_EVICTED, 1);
+            conn_fail(srv, slot);
+            break;
+        }
+        if(cqe->res < 0)
+        {
+            log_msg(LOG_ERR, "Data transmission unsuccessful");
+            conn_fail(srv, slot);
+            break;
+        }
+        conn->reply_off += cqe->res;
+        conn->reply_progress = stats_now();
+        stats_add(STAT_BYTES_OUT, cqe->res);
+        conn_submit_send(srv, slot);
+        break;
+
+    case URING_OP_SEND_TIMEOUT:
+        // The SEND's own completion decides what happens next
+        break;
+
+    default:
+        break;
+    }
+}
+
+int uring_server_run(int listen_fd)
+{
+    uring_server_t *srv;
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    int ret_status = SUCCESS;
+    int slot;
+
+    srv = calloc(1, sizeof(uring_server_t));
+    if(srv == NULL)
+    {
+        log_msg(LOG_ERR, "Failed to allocate io_uring engine");
+        return ERROR;
+    }
+    srv->listenFd = listen_fd;
+
+    if(uring_setup(&srv->ring, URING_QUEUE_ENTRIES) == ERROR)
+    {
+        log_msg(LOG_WARNING, "io_uring_setup failed: %s", strerror(errno));
+        free(srv);
+        return URING_UNSUPPORTED;
+    }
+
+    if(!uring_probe_ops(&srv->ring))
+    {
+        log_msg(LOG_WARNING, "Kernel io_uring lacks required operations");
+        uring_teardown(&srv->ring);
+        free(srv);
+        return URING_UNSUPPORTED;
+    }
+
+    srv->buffers = aligned_alloc(sysconf(_SC_PAGESIZE), (size_t)URING_MAX_CONNS * BUF_LEN);
+    if((srv->buffers == NULL) || (uring_register_resources(srv) == ERROR))
+    {
+        log_msg(LOG_WARNING, "io_uring resource registration failed: %s", strerror(errno));
+        free(srv->buffers);
+        uring_teardown(&srv->ring);
+        free(srv);
+        return URING_UNSUPPORTED;
+    }
+
+    if(appender_completion_init(&srv->appends) == ERROR)
+    {
+        free(srv->buffers);
+        uring_teardown(&srv->ring);
+        free(srv);
+        return ERROR;
+    }
+
+    log_msg(LOG_INFO, "io_uring engine running with %u entries", srv->ring.entries);
+
+    uring_arm_accept(srv);
+    uring_arm_timer(srv);
+    uring_arm_handoff(srv);
+    uring_arm_shutdown(srv);
+    uring_arm_appends(srv);
+    while(!fatal_error_in_progress &&
+          !(srv->draining && (srv->active_conns == 0) && !srv->accept_armed))
+    {
+        if(uring_submit(&srv->ring, 1) == ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            log_msg(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+            ret_status = ERROR;
+            break;
+        }
+
+        head = *srv->ring.cq_head;
+        while(head != __atomic_load_n(srv->ring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            cqe = &srv->ring.cqes[head & *srv->ring.cq_mask];
+            uring_handle_cqe(srv, cqe);
+            head++;
+        }
+        __atomic_store_n(srv->ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Connections still committing own the requests the appender holds
+    appender_completion_destroy(&srv->appends);
+    for(slot = 0; slot < URING_MAX_CONNS; slot++)
+    {
+        if(srv->conns[slot].in_use)
+        {
+            // Same accounting as conn_release(), without touching the ring
+            close(srv->conns[slot].clientSocketFd);
+            history_release(&srv->conns[slot].reply);
+            assembler_release(&srv->conns[slot].assembler);
+            admission_release(srv->conns[slot].source);
+            log_msg(LOG_INFO, "Terminated connection: %s", srv->conns[slot].ip);
+            stats_add(STAT_CONN_CLOSED, 1);
+            srv->conns[slot].in_use = false;
+        }
+    }
+    uring_teardown(&srv->ring);
+    free(srv->buffers);
+    free(srv);
+
+    return ret_status;
+}
+
+#else /* !HAVE_IO_URING */
+
+int uring_server_run(int listen_fd)
+{
+    (void)listen_fd;
+    log_msg(LOG_WARNING, "aesdsocket was built without io_uring support");
+    return URING_UNSUPPORTED;
+}
+
+#endif /* HAVE_IO_URING */
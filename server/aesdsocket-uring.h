@@ -0,0 +1,36 @@
+/****************************************************************
+ * @file      		aesdsocket-uring.h
+ * @brief		    io_uring execution engine for aesdsocket
+*****************************************************************/
+
+//Include guard
+#ifndef AESDSOCKET_URING_H
+#define AESDSOCKET_URING_H
+
+/****************   Includes    ***************/
+#include "aesdsocket.h"
+
+/****************   Macros     ***************/
+
+// Returned by uring_server_run() when the kernel or headers lack io_uring
+#define URING_UNSUPPORTED       (1)
+
+#define URING_MAX_CONNS         (128)
+#define URING_QUEUE_ENTRIES     (512)
+
+/**
+ * @brief Serves clients from a single io_uring submission/completion loop.
+ *
+ * Sockets are registered as fixed files and every connection slot owns a
+ * registered receive buffer. Receives and sends are issued as SQEs; a
+ * packet is appended through the store and its reply is sent straight
+ * from a snapshot of the history mirror.
+ *
+ * @param listen_fd Listening socket.
+ * @return SUCCESS when the loop exits on shutdown, ERROR on failure, or
+ *         URING_UNSUPPORTED if io_uring cannot be used on this system and
+ *         the caller should fall back to another mode.
+ */
+int uring_server_run(int listen_fd);
+
+#endif // AESDSOCKET_URING_H
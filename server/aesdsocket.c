@@ -13,24 +13,64 @@
  * 2. https://beej.us/guide/bgnet/html/
  ************************************************************************/
 /****************   Includes    ***************/ 
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "aesdsocket.h"
 
-/****************   Macros     ***************/ 
-#define USE_AESD_CHAR_DEVICE
+#include "aesdsocket-epoll.h"
+#include "aesdsocket-pool.h"
+#include "aesdsocket-uring.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-backend.h"
+#include "aesdsocket-assembler.h"
+#include "aesdsocket-history.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-timestamp.h"
+#include "aesdsocket-compress.h"
+#include "aesdsocket-admission.h"
+#include "aesdsocket-handoff.h"
+#include "aesdsocket-frame.h"
+#include "aesdsocket-log.h"
 
-#ifdef USE_AESD_CHAR_DEVICE
-	#define DATA_FILE "/dev/aesdchar"
-#else
-	#define DATA_FILE "/var/tmp/aesdsocketdata"
-#endif
+/****************   Macros     ***************/ 
 const char *ioctl_str = "AESDCHAR_IOCSEEKTO:";
 /****************   Global Variables     ***************/ 
 sig_atomic_t fatal_error_in_progress = 0;
+// Termination signal being handled, re-raised once the shutdown is done
+static volatile sig_atomic_t caught_signal = 0;
+// eventfd written by the signal handler so every waiting loop wakes up
+static int shutdownFd = ERROR;
 
 // Daemon application
 bool daemon_mode = false;
-// Outout data file
-int dataFileDescriptor;
+// Connection handling model and worker count
+server_config_t s_config = {
+    .mode = SERVER_MODE_THREAD,
+    .worker_threads = DEFAULT_WORKER_THREADS,
+    .queue_depth = DEFAULT_QUEUE_DEPTH,
+    .keepalive = false,
+    .idle_timeout_secs = DEFAULT_IDLE_TIMEOUT_SECS,
+    .durability = DURABILITY_NONE,
+    .sync_interval_ms = DEFAULT_SYNC_INTERVAL_MS,
+    .backlog = BACKLOG_CONNECTIONS,
+    .timestamp_interval_ms = DEFAULT_TIMESTAMP_MS,
+    .write_timeout_secs = DEFAULT_WRITE_TIMEOUT_SECS,
+    .max_output_bytes = DEFAULT_MAX_OUTPUT_BYTES,
+    .max_conns_per_ip = 0,
+    .records_per_sec = 0,
+    .bytes_per_sec = 0,
+    .hot_restart = false,
+    .log_level = DEFAULT_LOG_LEVEL,
+    .log_path = NULL,
+    .store_name = DEFAULT_STORE_BACKEND,
+    .store_capacity = 0,
+    .store_records = 0,
+};
 
 // Server & Client Socket fd
 int sock_fd;
@@ -38,12 +78,10 @@ int clientSocketFd;
 // linked list head init
 SLIST_HEAD(head_s, node) head;
 node_t * node = NULL;
-// thread mutex
-pthread_mutex_t lock;
-#ifndef USE_AESD_CHAR_DEVICE
-// timestamp struct
-ThreadTimestampData_t TS_data;
-#endif
+// Store lock: appends and seeks write, repliers taking a history snapshot read.
+// A read hold only pins a snapshot pointer, so sharing it measures no faster
+// than an exclusive lock; the rwlock stays for its writer preference.
+pthread_rwlock_t lock;
 // to print IP
 char s[INET6_ADDRSTRLEN];
 
@@ -56,9 +94,6 @@ int run_daemon();
 int accept_and_log_client();
 void cleanup_on_exit();
 void *recv_send_thread(void *thread_param);
-int setup_time_logging(void);
-void *log_timestamps(void *timestamp_param);
-void* client_data_handler(void *thread_param);
 
 // Initialize all elements to false
 status_flags s_flags = {false, false, false, false, false, false, false};
@@ -75,42 +110,40 @@ void free_and_nullify_result() {
 /**
  * @name handle_termination
  * 
- * @brief Gracefully handles the termination signals for a multithreaded program.
+ * @brief Starts a graceful shutdown on SIGINT or SIGTERM.
  * 
- * This function serves as the signal handler for termination-related signals (e.g., SIGINT, SIGTERM).
- * It ensures a graceful shutdown by cleaning up resources, logging appropriate messages, and finally
- * re-raising the signal for default handling. The function also checks for recursive invocation.
+ * Only async-signal-safe work is done here: the shutdown is flagged and
+ * shutdown_fd() is made readable, which wakes whichever loop is waiting
+ * on it. The server loop then returns and main_socket_application()
+ * cleans up on the main thread, where joining threads, taking the store
+ * lock and syncing are safe. A second signal during that terminates
+ * right away.
  * 
  * @param sig The signal number passed to the handler function.
  */
 void handle_termination(int sig)
 {
-    // Prevent recursive invocation of the handler
+    uint64_t one = 1;
+    int saved_errno = errno;
+
     if (fatal_error_in_progress) {
+        signal(sig, SIG_DFL);
         raise(sig);
         return;
     }
     fatal_error_in_progress = 1;
+    caught_signal = sig;
+    s_flags.signal_caught = true;
 
-    // Log that the program is preparing to terminate due to a specific signal
-    syslog(LOG_INFO, "Signal %d received, initiating graceful shutdown.", sig);
-
-    // Attempt to close the socket and log an error if unsuccessful
-    if (shutdown(sock_fd, SHUT_RDWR) == -1) {
-        syslog(LOG_ERR, "Unable to properly close socket.");
+    if ((shutdownFd != ERROR) && (write(shutdownFd, &one, sizeof(one)) != sizeof(one))) {
+        // Nothing to report from here; loops still see the flag when they next wake
     }
+    errno = saved_errno;
+}
 
-    // Attempt to cancel any active threads and log an error if unsuccessful
-    // if (pthread_cancel(TS_data.threadId) != 0) {
-    //     syslog(LOG_ERR, "Failed to cancel active thread.");
-    // }
-    s_flags.signal_caught = true;
-    // Call the function to perform any additional cleanup tasks
-    cleanup_on_exit();
-    
-    // Reset the signal handling to default and re-raise the signal for standard termination
-    signal(sig, SIG_DFL);
-    raise(sig);
+int shutdown_fd(void)
+{
+    return shutdownFd;
 }
 
 /**
@@ -142,30 +175,22 @@ void *get_in_addr(struct sockaddr *sa)
  */
 void cleanup_on_exit(void)
 {
-    int ret_status;
-
     // Log initiation of cleanup
-    syslog(LOG_INFO, "Initiating clean-up procedures.");
+    log_msg(LOG_INFO, "Initiating clean-up procedures.");
 
-    // Close data file
-    ret_status = close(dataFileDescriptor);
-    if(ret_status == -1)
-    {
-        syslog(LOG_ERR, "Failed to close data file.");
-        s_flags.command_status_success = false;
-    }
+    // Write out queued messages; the rest of the shutdown is logged synchronously
+    log_stop();
 
-    // Delete data file
-#ifndef USE_AESD_CHAR_DEVICE
-    ret_status = unlink(DATA_FILE);
-    if(ret_status == -1)
-    {
-        syslog(LOG_ERR, "Failed to delete data file.");
-    }
-#endif
+    // Close (and for the file backend delete) the data store
+    store_close();
+    // Closing the predecessor link only now lets a successor resync after our last append
+    handoff_stop();
+    stats_stop_dumper();
+    timestamp_close();
 
-    // Free elements from the queue if any (assuming head is defined elsewhere)
-    while (!SLIST_EMPTY(&head))
+    // Free elements from the queue if any; on a signal the client threads
+    // may still be running on them and end with the re-raised signal instead
+    while (!s_flags.signal_caught && !SLIST_EMPTY(&head))
     {
         node = SLIST_FIRST(&head);
         SLIST_REMOVE(&head, node, node, nodes);
@@ -174,12 +199,8 @@ void cleanup_on_exit(void)
     }
 
     if(s_flags.signal_caught != true){
-#ifndef USE_AESD_CHAR_DEVICE
-    // Join timestamp thread
-    pthread_join(TS_data.threadId, NULL);
-#endif
-    // Destroy mutex lock (assuming lock is defined elsewhere)
-    pthread_mutex_destroy(&lock);
+    // Destroy the store lock
+    pthread_rwlock_destroy(&lock);
 
     }
 
@@ -202,7 +223,7 @@ void cleanup_on_exit(void)
     free_and_nullify_result();
 
     // Close syslog
-    syslog(LOG_INFO, "Application is shutting down.");
+    log_msg(LOG_INFO, "Application is shutting down.");
     if(s_flags.log_open)
     {
         closelog();
@@ -210,79 +231,469 @@ void cleanup_on_exit(void)
     }
 }
 
+/**
+ * @brief Parses -s backend[:bytes] into s_config.
+ *
+ * @param arg Option argument; the colon is overwritten.
+ * @return SUCCESS, or ERROR for an unknown backend or a capacity it cannot take.
+ */
+static int parse_store_option(char *arg)
+{
+    store_backend_t *backend;
+    char *capacity = strchr(arg, ':');
+    char *end;
+
+    if(capacity != NULL)
+    {
+        *capacity++ = '\0';
+    }
+
+    backend = store_backend_find(arg);
+    if(backend == NULL)
+    {
+        log_msg(LOG_ERR, "Unknown store backend %s", arg);
+        return ERROR;
+    }
+    s_config.store_name = backend->name;
+    s_config.store_capacity = 0;
+
+    if(capacity != NULL)
+    {
+        errno = 0;
+        s_config.store_capacity = strtoull(capacity, &end, 10);
+        if(!backend->capacity || (errno != 0) || (*capacity == '\0') || (*end != '\0') ||
+           (s_config.store_capacity == 0))
+        {
+            log_msg(LOG_ERR, "Invalid capacity %s for store backend %s", capacity, arg);
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Parses -D none|interval[:ms]|strict into s_config.
+ *
+ * @param arg Option argument.
+ * @return SUCCESS, or ERROR for an unknown mode or a bad interval.
+ */
+static int parse_durability_option(const char *arg)
+{
+    char *end;
+
+    if(strcmp(arg, "none") == 0)
+    {
+        s_config.durability = DURABILITY_NONE;
+    }
+    else if(strcmp(arg, "strict") == 0)
+    {
+        s_config.durability = DURABILITY_STRICT;
+    }
+    else if(strncmp(arg, "interval", strlen("interval")) == 0)
+    {
+        s_config.durability = DURABILITY_INTERVAL;
+        arg += strlen("interval");
+        if(*arg == ':')
+        {
+            s_config.sync_interval_ms = strtol(arg + 1, &end, 10);
+            if((end == arg + 1) || (*end != '\0') || (s_config.sync_interval_ms <= 0))
+            {
+                log_msg(LOG_ERR, "Invalid sync interval %s", arg + 1);
+                return ERROR;
+            }
+        }
+        else if(*arg != '\0')
+        {
+            log_msg(LOG_ERR, "Unknown durability mode %s", arg - strlen("interval"));
+            return ERROR;
+        }
+    }
+    else
+    {
+        log_msg(LOG_ERR, "Unknown durability mode %s", arg);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Parses -T seconds, fractions allowed, into s_config.
+ *
+ * @param arg Option argument.
+ * @return SUCCESS, or ERROR unless it is a number of at least one
+ *         millisecond whose milliseconds fit a long.
+ */
+static int parse_timestamp_option(const char *arg)
+{
+    char *end;
+    double period;
+
+    errno = 0;
+    period = strtod(arg, &end);
+    // Written so that NaN fails too
+    if((errno != 0) || (end == arg) || (*end != '\0') ||
+       !((period >= 0.001) && (period <= LONG_MAX / 1000)))
+    {
+        log_msg(LOG_ERR, "Invalid timestamp period %s", arg);
+        return ERROR;
+    }
+    s_config.timestamp_interval_ms = (long)(period * 1000);
+    return SUCCESS;
+}
+
+/**
+ * @brief Parses the decimal count taken by an option.
+ *
+ * @param arg Option argument.
+ * @param what Name of the setting, for the error message.
+ * @param[out] value Parsed count.
+ * @return SUCCESS, or ERROR for anything but digits or a count a size_t
+ *         cannot hold.
+ */
+static int parse_count_option(const char *arg, const char *what, size_t *value)
+{
+    unsigned long long parsed;
+    char *end;
+
+    errno = 0;
+    parsed = strtoull(arg, &end, 10);
+    // strtoull() would skip blanks and take a sign, wrapping negative numbers
+    if(!isdigit((unsigned char)arg[0]) || (errno != 0) || (*end != '\0') || (parsed > SIZE_MAX))
+    {
+        log_msg(LOG_ERR, "Invalid %s %s", what, arg);
+        return ERROR;
+    }
+    *value = parsed;
+    return SUCCESS;
+}
+
+/**
+ * @brief Parses a decimal count option into an int within [min, max].
+ *
+ * @param arg Option argument.
+ * @param what Name of the setting, for the error message.
+ * @param min Smallest accepted value.
+ * @param max Largest accepted value.
+ * @param[out] value Parsed value.
+ * @return SUCCESS, or ERROR if parse_count_option() rejects it or it is
+ *         out of range.
+ */
+static int parse_int_option(const char *arg, const char *what, int min, int max, int *value)
+{
+    size_t parsed;
+
+    if(parse_count_option(arg, what, &parsed) == ERROR)
+    {
+        return ERROR;
+    }
+    if((parsed < (size_t)min) || (parsed > (size_t)max))
+    {
+        log_msg(LOG_ERR, "Invalid %s %s", what, arg);
+        return ERROR;
+    }
+    *value = (int)parsed;
+    return SUCCESS;
+}
+
+/**
+ * @brief Parses a per second rate option, fractions allowed.
+ *
+ * @param arg Option argument.
+ * @param what Name of the setting, for the error message.
+ * @param[out] value Parsed rate, 0 for no limit.
+ * @return SUCCESS, or ERROR unless it is a finite number of at least 0.
+ */
+static int parse_rate_option(const char *arg, const char *what, double *value)
+{
+    char *end;
+    double rate;
+
+    errno = 0;
+    rate = strtod(arg, &end);
+    if((errno != 0) || (end == arg) || (*end != '\0') || !isfinite(rate) || (rate < 0))
+    {
+        log_msg(LOG_ERR, "Invalid %s %s", what, arg);
+        return ERROR;
+    }
+    *value = rate;
+    return SUCCESS;
+}
+
+/**
+ * @brief Prints the supported command line options.
+ *
+ * @param prog_name Name the application was invoked with.
+ */
+static void print_usage(const char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [-d] [-m thread|epoll|pool|uring|reuseport] [-t threads] [-q depth] [-k] [-i seconds] [-S] [-D durability] [-b backlog] [-T seconds] [-w seconds] [-o bytes]\n"
+                    "          [-c connections] [-r records] [-B bytes] [-R] [-v level] [-L file]\n"
+                    "          [-s backend[:bytes]] [-n records]\n", prog_name);
+    fprintf(stderr, "  -d          run as a daemon\n");
+    fprintf(stderr, "  -m mode     connection model: thread (default), epoll, pool, uring or reuseport\n");
+    fprintf(stderr, "  -t threads  event loop or worker threads (1-%d, default %d, reuseport: one per CPU)\n",
+            MAX_WORKER_THREADS, DEFAULT_WORKER_THREADS);
+    fprintf(stderr, "  -q depth    pool mode pending connection queue (1-%d, default %d)\n",
+            MAX_QUEUE_DEPTH, DEFAULT_QUEUE_DEPTH);
+    fprintf(stderr, "  -k          keep connections open for pipelined packets (not in uring mode)\n");
+    fprintf(stderr, "  -i seconds  idle timeout for kept-alive connections (default %d)\n",
+            DEFAULT_IDLE_TIMEOUT_SECS);
+    fprintf(stderr, "  -S          same as -D strict\n");
+    fprintf(stderr, "  -D mode     sync appends: none (default), interval[:ms] every ms (default %d) or strict\n"
+                    "              before replying; syncs are shared by concurrent clients (no effect on the driver or ring)\n",
+                    DEFAULT_SYNC_INTERVAL_MS);
+    fprintf(stderr, "  -b backlog  listen backlog per listener (1-%d, default %d)\n",
+            MAX_BACKLOG_CONNECTIONS, BACKLOG_CONNECTIONS);
+    fprintf(stderr, "  -T seconds  timestamp record period, fractions allowed (file backend, default %d)\n",
+            DEFAULT_TIMESTAMP_MS / 1000);
+    fprintf(stderr, "  -w seconds  evict a client that takes no reply bytes this long, 0 never (default %d)\n",
+            DEFAULT_WRITE_TIMEOUT_SECS);
+    fprintf(stderr, "  -o bytes    evict a client still holding more unsent reply bytes after -w seconds,\n"
+                    "              0 no limit (default %d)\n", DEFAULT_MAX_OUTPUT_BYTES);
+    fprintf(stderr, "  -c conns    concurrent connections per client address (default no limit)\n");
+    fprintf(stderr, "  -r records  appended records per second per client address, fractions allowed (default no limit)\n");
+    fprintf(stderr, "  -B bytes    appended bytes per second per client address (default no limit)\n");
+    fprintf(stderr, "  -R          hot restart: take the listener over from the running server, which drains and exits\n");
+    fprintf(stderr, "  -v level    least severe message logged: err, warning, notice, info (default) or debug\n");
+    fprintf(stderr, "  -L file     append log messages to file instead of syslog\n");
+    fprintf(stderr, "  -s backend  store: chardev, file, ring or segments, optionally backend:bytes to keep at most\n"
+                    "              with ring or segments (default %s)\n", DEFAULT_STORE_BACKEND);
+    fprintf(stderr, "  -n records  records the segments store keeps at most (default no limit)\n");
+}
+
 int main(int argc, char *argv[])
 {
+    bool threads_given = false;
     int opt;
     int ret;
 
-    // Initialize the mutex for threads
-    ret = pthread_mutex_init(&lock, NULL);
+    // Initialize the store lock; writers are preferred so a steady stream
+    // of repliers cannot starve appends, which is all the rwlock adds here
+    pthread_rwlockattr_t lock_attr;
+    pthread_rwlockattr_init(&lock_attr);
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    ret = pthread_rwlock_init(&lock, &lock_attr);
+    pthread_rwlockattr_destroy(&lock_attr);
     if(ret != 0)
     {
-        syslog(LOG_ERR, "mutex init failed");
+        log_msg(LOG_ERR, "rwlock init failed");
         return -1;
     }
 
     // Open syslog
     openlog(NULL, 0, LOG_USER);
 
-    while((opt = getopt(argc, argv, "d")) != -1)
+    // SIGUSR1 is only taken by the statistics dump thread's sigwait();
+    // every thread created from here on inherits the blocked mask
+    sigset_t stats_signals;
+    sigemptyset(&stats_signals);
+    sigaddset(&stats_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stats_signals, NULL);
+
+    while((opt = getopt(argc, argv, "dm:t:q:ki:SD:b:T:w:o:c:r:B:Rv:L:s:n:")) != -1)
     {
-        if(opt == 'd')
+        switch(opt)
         {
+        case 'd':
             s_flags.daemon_mode = true;
+            break;
+        case 'm':
+            if(strcmp(optarg, "thread") == 0)
+            {
+                s_config.mode = SERVER_MODE_THREAD;
+            }
+            else if(strcmp(optarg, "epoll") == 0)
+            {
+                s_config.mode = SERVER_MODE_EPOLL;
+            }
+            else if(strcmp(optarg, "pool") == 0)
+            {
+                s_config.mode = SERVER_MODE_POOL;
+            }
+            else if(strcmp(optarg, "uring") == 0)
+            {
+                s_config.mode = SERVER_MODE_URING;
+            }
+            else if(strcmp(optarg, "reuseport") == 0)
+            {
+                s_config.mode = SERVER_MODE_REUSEPORT;
+            }
+            else
+            {
+                log_msg(LOG_ERR, "Unknown server mode %s", optarg);
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 't':
+            threads_given = true;
+            if(parse_int_option(optarg, "worker thread count", 1, MAX_WORKER_THREADS,
+                                &s_config.worker_threads) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'q':
+            if(parse_int_option(optarg, "queue depth", 1, MAX_QUEUE_DEPTH, &s_config.queue_depth) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'k':
+            s_config.keepalive = true;
+            break;
+        case 'i':
+            if(parse_int_option(optarg, "idle timeout", 1, INT_MAX, &s_config.idle_timeout_secs) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'S':
+            s_config.durability = DURABILITY_STRICT;
+            break;
+        case 'D':
+            if(parse_durability_option(optarg) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'b':
+            if(parse_int_option(optarg, "listen backlog", 1, MAX_BACKLOG_CONNECTIONS, &s_config.backlog) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'T':
+            if(parse_timestamp_option(optarg) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'w':
+            if(parse_int_option(optarg, "write timeout", 0, INT_MAX, &s_config.write_timeout_secs) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'o':
+            if(parse_count_option(optarg, "output limit", &s_config.max_output_bytes) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'c':
+            if(parse_int_option(optarg, "connection limit", 0, INT_MAX, &s_config.max_conns_per_ip) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'r':
+            if(parse_rate_option(optarg, "record rate", &s_config.records_per_sec) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'B':
+            if(parse_rate_option(optarg, "byte rate", &s_config.bytes_per_sec) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'R':
+            s_config.hot_restart = true;
+            break;
+        case 'v':
+            s_config.log_level = log_parse_level(optarg);
+            if(s_config.log_level == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'L':
+            s_config.log_path = optarg;
+            break;
+        case 's':
+            if(parse_store_option(optarg) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'n':
+            if(parse_count_option(optarg, "record limit", &s_config.store_records) == ERROR)
+            {
+                print_usage(argv[0]);
+                return -1;
+            }
+            if(s_config.store_records == 0)
+            {
+                log_msg(LOG_ERR, "Invalid record limit %s", optarg);
+                print_usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
         }
     }
 
+    if((s_config.store_records > 0) && !store_backend_find(s_config.store_name)->records)
+    {
+        log_msg(LOG_ERR, "Store backend %s takes no record limit", s_config.store_name);
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    // One shard per online CPU unless told otherwise
+    if((s_config.mode == SERVER_MODE_REUSEPORT) && !threads_given)
+    {
+        long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        s_config.worker_threads = (cpu_count < 1) ? 1 :
+                                  (cpu_count > MAX_WORKER_THREADS) ? MAX_WORKER_THREADS : (int)cpu_count;
+    }
+
     main_socket_application();
 
+    // Terminate by the signal that asked for it, now that cleanup is done
+    if (s_flags.signal_caught)
+    {
+        signal(caught_signal, SIG_DFL);
+        raise(caught_signal);
+    }
+
     return (s_flags.command_status_success) ? 0 : -1;
 }
 
 /**
- * @brief Main application function to initialize and manage a socket server.
- * 
- * This function performs the essential steps to set up a socket server. 
- * It starts by opening a data file, sets up signal handlers, and initializes the syslog.
- * After that, the function proceeds with a series of networking steps:
+ * @brief Creates and binds the listening socket on port 9000.
+ *
  * 1. Use getaddrinfo() to get the required structures for socket creation.
  * 2. Create a socket.
  * 3. Set socket options.
  * 4. Bind the socket.
- * 5. Optionally start the application as a daemon if specified.
- * 6. Setup timestamp logging.
- * 7. Listen for client connections.
- * 8. Accept and log client connections.
- * 
- * @note The function uses global variables for sock_fd, result, s_flags, and dataFileDescriptor.
- * 
- * @return This function doesn't return a value. It performs cleanup if any operation fails.
+ *
+ * @return SUCCESS, or ERROR with the failure logged.
  */
-void main_socket_application()
+int open_socket(void)
 {
     int ret_status;
     struct addrinfo hints;
     int yes = 1;  // for setsockopt()
 
-    // Open the data file
-    // dataFileDescriptor = open(DATA_FILE, O_RDWR | O_CREAT | O_APPEND, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
-    // if(dataFileDescriptor == ERROR)
-    // {
-    //     syslog(LOG_ERR, "Data file open failed");
-    //     return;
-    // }
-
-    // signal handler for SIGINT and SIGTERM
-    signal(SIGINT, handle_termination);
-    signal(SIGTERM, handle_termination);
-    
-    // Initialize syslog
-    syslog(LOG_INFO,"AESD Socket application started");
-    if(s_flags.daemon_mode)
-    {
-        syslog(LOG_INFO,"Started as a daemon");
-    }
-    
     // Initialize hints struct
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;	        /* IPv4 */
@@ -294,47 +705,105 @@ void main_socket_application()
     ret_status = getaddrinfo(NULL, "9000", &hints, &result);
     if (ret_status != SUCCESS)
     {
-        syslog(LOG_ERR, "Failure in getaddrinfo()");
-        cleanup_on_exit();
-        return;
+        log_msg(LOG_ERR, "Failure in getaddrinfo()");
+        return ERROR;
     }
     
     // Check for malloc success
     if (result == NULL)
     {
-        syslog(LOG_ERR, "Memory allocation failed in getaddrinfo()");
-        cleanup_on_exit();
-        return;
+        log_msg(LOG_ERR, "Memory allocation failed in getaddrinfo()");
+        return ERROR;
     }
     
     // STEP 2: Create socket
-    sock_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    // Non-blocking from the start: every mode polls and then accepts, and a
+    // hot restart may hand it to a successor running another mode
+    sock_fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, result->ai_protocol);
     if (sock_fd == ERROR)
     {
-        syslog(LOG_ERR, "Failed to create socket");
-        cleanup_on_exit();
-        return;
+        log_msg(LOG_ERR, "Failed to create socket");
+        return ERROR;
     }
     
     // STEP 3: Set socket options
     if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == ERROR)
     {
-        syslog(LOG_ERR, "Failed to set socket options");
-        cleanup_on_exit();
-        return;
+        log_msg(LOG_ERR, "Failed to set socket options");
+        return ERROR;
+    }
+
+    // The other shards bind the same port later, which needs the group flag on every socket
+    if((s_config.mode == SERVER_MODE_REUSEPORT) &&
+       (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == ERROR))
+    {
+        log_msg(LOG_ERR, "Failed to set SO_REUSEPORT");
+        return ERROR;
     }
     
     // STEP 4: Bind the socket
     ret_status = bind(sock_fd, result->ai_addr, sizeof(struct sockaddr));
     if (ret_status == ERROR)
     {
-        syslog(LOG_ERR, "Binding socket operation unsuccessful");
-        cleanup_on_exit();
-        return;
+        log_msg(LOG_ERR, "Binding socket operation unsuccessful");
+        return ERROR;
     }
     
     // Free malloced addr struct
     free_and_nullify_result();
+    return SUCCESS;
+}
+
+/**
+ * @brief Main application function to initialize and manage a socket server.
+ * 
+ * This function performs the essential steps to set up a socket server. 
+ * It starts by opening a data file, sets up signal handlers, and initializes the syslog.
+ * After that, the function proceeds with a series of networking steps:
+ * 1. Open the listening socket with open_socket(), or with -R receive it
+ *    from the running server instead (see aesdsocket-handoff.c).
+ * 2. Optionally start the application as a daemon if specified.
+ * 3. Setup timestamp logging.
+ * 4. Listen for client connections and offer the listener to a successor.
+ * 5. Accept and log client connections, either with a thread per client,
+ *    through the epoll reactor (shared or SO_REUSEPORT listeners), the
+ *    worker pool or the io_uring engine depending on s_config.mode.
+ * 
+ * @note The function uses global variables for sock_fd, result, s_flags, and s_config.
+ * 
+ * @return This function doesn't return a value. It performs cleanup if any operation fails.
+ */
+void main_socket_application()
+{
+    int ret_status;
+
+    // Never read: once written it stays readable for every loop polling it
+    shutdownFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdownFd == ERROR)
+    {
+        log_msg(LOG_WARNING, "No shutdown event, signals are only seen between requests");
+    }
+
+    // signal handler for SIGINT and SIGTERM
+    signal(SIGINT, handle_termination);
+    signal(SIGTERM, handle_termination);
+    
+    // Initialize syslog
+    log_msg(LOG_INFO,"AESD Socket application started");
+    if(s_flags.daemon_mode)
+    {
+        log_msg(LOG_INFO,"Started as a daemon");
+    }
+    
+    // STEP 1: Listening socket, taken over from a running server with -R
+    if (!s_config.hot_restart || (handoff_receive(&sock_fd) == ERROR))
+    {
+        if (open_socket() == ERROR)
+        {
+            cleanup_on_exit();
+            return;
+        }
+    }
     
     // STEP 2: Start as a daemon if specified by the user
     if(s_flags.daemon_mode == 1)
@@ -342,40 +811,96 @@ void main_socket_application()
         ret_status = run_daemon();
         if(ret_status == ERROR)
         {
-            syslog(LOG_ERR, "Failed to start as daemon");
+            log_msg(LOG_ERR, "Failed to start as daemon");
             cleanup_on_exit();
             return;
         }
     }
-#ifndef USE_AESD_CHAR_DEVICE
-    // Set up timestamp
-    ret_status = setup_time_logging();
-    if(ret_status == ERROR)
+
+    // Logging turns asynchronous from here; the drainer thread would not survive the fork
+    log_start(s_config.log_path);
+
+    // Open the data store once for the lifetime of the process. This starts
+    // the appender thread, so it must come after the daemon fork.
+    if(store_open() == ERROR)
     {
-        syslog(LOG_ERR, "Failed to setup timestamp");
         cleanup_on_exit();
         return;
     }
-#endif 
+
+    // A missing dump thread only loses SIGUSR1 dumps; serving continues
+    stats_start_dumper();
+
+    // Set up timestamp; the server loop waits on its timer next to the listener
+    if(store_timestamps())
+    {
+        ret_status = timestamp_open(s_config.timestamp_interval_ms);
+        if(ret_status == ERROR)
+        {
+            log_msg(LOG_ERR, "Failed to setup timestamp");
+            cleanup_on_exit();
+            return;
+        }
+    }
 
     // STEP 3: Listen for and accept connections
-    ret_status = listen(sock_fd, BACKLOG_CONNECTIONS);
+    ret_status = listen(sock_fd, s_config.backlog);
+    if(ret_status == ERROR)
+    {
+        log_msg(LOG_ERR, "Failed to listen on socket");
+        cleanup_on_exit();
+        return;
+    }
+
+    // Offer the listener to a successor; with -R this also tells the
+    // previous server to stop accepting, so it must come right before we start
+    handoff_start(sock_fd);
+    
+    // Start communication
+    if((s_config.mode == SERVER_MODE_EPOLL) || (s_config.mode == SERVER_MODE_REUSEPORT))
+    {
+        ret_status = epoll_reactor_run(sock_fd, s_config.worker_threads,
+                                       s_config.mode == SERVER_MODE_REUSEPORT);
+    }
+    else if(s_config.mode == SERVER_MODE_POOL)
+    {
+        ret_status = worker_pool_run(sock_fd, s_config.worker_threads, s_config.queue_depth);
+    }
+    else
+    {
+        if(s_config.mode == SERVER_MODE_URING)
+        {
+            if(s_config.keepalive)
+            {
+                log_msg(LOG_WARNING, "Keep-alive is not supported by the io_uring engine, ignoring -k");
+                s_config.keepalive = false;
+            }
+            ret_status = uring_server_run(sock_fd);
+            if(ret_status == URING_UNSUPPORTED)
+            {
+                log_msg(LOG_WARNING, "io_uring unavailable, falling back to thread per connection");
+                s_config.mode = SERVER_MODE_THREAD;
+            }
+        }
+        if(s_config.mode == SERVER_MODE_THREAD)
+        {
+            ret_status = accept_and_log_client(s);
+        }
+    }
     if(ret_status == ERROR)
     {
-        syslog(LOG_ERR, "Failed to listen on socket");
+        log_msg(LOG_ERR, "Failed to start communication");
         cleanup_on_exit();
         return;
     }
-    
-    // Start communication
-    ret_status = accept_and_log_client(s);
-    if(ret_status == ERROR)
+
+    if (s_flags.signal_caught)
     {
-        syslog(LOG_ERR, "Failed to start communication");
-        cleanup_on_exit();
-        return;
+        log_msg(LOG_INFO, "Signal %d received, initiating graceful shutdown.", (int)caught_signal);
     }
 
+    // Only a hot restart ends the server loop without a signal
+    s_flags.command_status_success = handoff_done();
     cleanup_on_exit();
 }
 
@@ -400,14 +925,14 @@ int run_daemon(void)
     if (forked_pid < 0)
     {
         ERROR_LOG("Failed to fork process\n");
-        syslog(LOG_ERR, "Failed to fork process");
+        log_msg(LOG_ERR, "Failed to fork process");
         return ERROR;
     }
 
     // If we got a good PID, then we can exit the parent process.
     if (forked_pid > 0)
     {
-        syslog(LOG_INFO, "Termination of parent process completed");
+        log_msg(LOG_INFO, "Termination of parent process completed");
         exit(0); // Exit the parent process
     }
 
@@ -417,14 +942,14 @@ int run_daemon(void)
     // Create a new session ID
     if (setsid() < 0)
     {
-        syslog(LOG_ERR, "setsid failed");
+        log_msg(LOG_ERR, "setsid failed");
         return -1;
     }
 
     // Change the current working directory to root
     if (chdir("/") == -1)
     {
-        syslog(LOG_ERR, "chdir failed");
+        log_msg(LOG_ERR, "chdir failed");
         return -1;
     }
 
@@ -437,25 +962,25 @@ int run_daemon(void)
     fd = open("/dev/null", O_RDWR);
     if (fd == -1)
     {
-        syslog(LOG_ERR, "/dev/null open failed");
+        log_msg(LOG_ERR, "/dev/null open failed");
         return -1;
     }
 
     if (dup2(fd, STDIN_FILENO) == -1)
     {
-        syslog(LOG_ERR, "stdin redirect failed");
+        log_msg(LOG_ERR, "stdin redirect failed");
         return -1;
     }
 
     if (dup2(fd, STDOUT_FILENO) == -1)
     {
-        syslog(LOG_ERR, "stdout redirect failed");
+        log_msg(LOG_ERR, "stdout redirect failed");
         return -1;
     }
 
     if (dup2(fd, STDERR_FILENO) == -1)
     {
-        syslog(LOG_ERR, "stderr redirect failed");
+        log_msg(LOG_ERR, "stderr redirect failed");
         return -1;
     }
 
@@ -486,15 +1011,40 @@ int accept_and_log_client(char *ip_address)
     
     // Create new node in linked list
     node_t *freshNode;
+    admission_source_t *source;
+    int ret_status;
 
     while (!fatal_error_in_progress)
     {
-        clientSocketFd = accept(sock_fd, (struct sockaddr *)&clientInfo, &clientSize);
+        // Timestamps are written from here while no client is connecting
+        ret_status = handoff_wait_listener(sock_fd);
+        if (ret_status == HANDOFF_DRAINING)
+        {
+            break;
+        }
+        if (ret_status == ERROR)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            log_msg(LOG_ERR, "Failed to wait for client connection");
+            return ERROR;
+        }
+
+        // The listener is non-blocking; the client socket is not
+        clientSize = sizeof(struct sockaddr_storage);
+        clientSocketFd = accept4(sock_fd, (struct sockaddr *)&clientInfo, &clientSize, SOCK_CLOEXEC);
         if (clientSocketFd == ERROR)
         {
+            // Another process or a dropped client took the connection: poll again
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ECONNABORTED) || (errno == EINTR))
+            {
+                continue;
+            }
             if (fatal_error_in_progress == 0)
             {
-                syslog(LOG_ERR, "Failed to accept client connection");
+                log_msg(LOG_ERR, "Failed to accept client connection");
                 return ERROR;
             }
             else
@@ -503,343 +1053,644 @@ int accept_and_log_client(char *ip_address)
             }
         }
 
+        if (admission_acquire((struct sockaddr *)&clientInfo, &source) == ERROR)
+        {
+            close(clientSocketFd);
+            continue;
+        }
+
         // Allocate memory for new node
         freshNode = malloc(sizeof(node_t));
         if (freshNode == NULL)
         {
-            syslog(LOG_ERR, "Failed to allocate memory for new client node");
+            log_msg(LOG_ERR, "Failed to allocate memory for new client node");
+            admission_release(source);
             return ERROR;
         }
 
         // Populate node data
-        freshNode->thread_data.pMutex = &lock;
+        freshNode->thread_data.pLock = &lock;
         freshNode->thread_data.isThreadComplete = false;
         freshNode->thread_data.clientSocketFd = clientSocketFd;
-        freshNode->thread_data.pClientAddr = (struct sockaddr_storage *)&clientInfo;
+        freshNode->thread_data.clientAddr = clientInfo;
+        freshNode->thread_data.pClientAddr = &freshNode->thread_data.clientAddr;
+        freshNode->thread_data.pSource = source;
 
         // Create a new thread for the connection
         if (pthread_create(&(freshNode->thread_data.threadId), NULL, 
-                           client_data_handler, &(freshNode->thread_data)) == ERROR)
+                           client_data_handler, &(freshNode->thread_data)) != 0)
         {
-            syslog(LOG_ERR, "Thread creation for new client failed");
+            log_msg(LOG_ERR, "Thread creation for new client failed");
+            admission_release(source);
+            close(clientSocketFd);
             free(freshNode);
             return ERROR;
         }
 
         // Insert node into list
         SLIST_INSERT_HEAD(&head, freshNode, nodes);
-        freshNode = NULL;
 
-        // Check for thread completion and join them
-        SLIST_FOREACH(freshNode, &head, nodes)
+        // Join completed threads and drop their nodes; a thread is joined exactly once
+        while ((freshNode != NULL) && (SLIST_NEXT(freshNode, nodes) != NULL))
         {
-            if (freshNode->thread_data.isThreadComplete)
+            node_t *done = SLIST_NEXT(freshNode, nodes);
+
+            if (!done->thread_data.isThreadComplete)
             {
-                if (pthread_join(freshNode->thread_data.threadId, &threadRetVal) == ERROR)
-                {
-                    syslog(LOG_ERR, "Failed to join completed thread");
-                    return ERROR;
-                }
-                if (threadRetVal == NULL)
-                {
-                    return ERROR;
-                }
-                syslog(LOG_INFO, "Successfully joined thread %ld", freshNode->thread_data.threadId);
+                freshNode = done;
+                continue;
+            }
+            if (pthread_join(done->thread_data.threadId, &threadRetVal) != 0)
+            {
+                log_msg(LOG_ERR, "Failed to join completed thread");
+                return ERROR;
+            }
+            if (threadRetVal == NULL)
+            {
+                log_msg(LOG_ERR, "Client thread %ld ended with an error", done->thread_data.threadId);
             }
+            else
+            {
+                log_msg(LOG_INFO, "Successfully joined thread %ld", done->thread_data.threadId);
+            }
+            SLIST_NEXT(freshNode, nodes) = SLIST_NEXT(done, nodes);
+            free(done);
         }
+        freshNode = NULL;
+    }
+
+    // The listener went to a successor: let every open connection finish
+    while (handoff_done() && !SLIST_EMPTY(&head))
+    {
+        freshNode = SLIST_FIRST(&head);
+        SLIST_REMOVE_HEAD(&head, nodes);
+        pthread_join(freshNode->thread_data.threadId, NULL);
+        free(freshNode);
+    }
+    if (handoff_done())
+    {
+        log_msg(LOG_INFO, "Connections drained after hot restart");
     }
 
     return SUCCESS;
 }
 
 /**
- * @brief Function to handle both receiving and sending data through a client socket.
- * 
- * This function does the following:
- * 1. Receives data from the client and writes it to the file /dev/aesdchar.
- * 2. Reads the content from the same file and sends it back to the client.
- * 
- * @param thread_param Pointer to the thread data structure
- * @return Returns the pointer to the thread data structure
+ * @brief Applies one received packet to the store.
+ *
+ * A packet starting with "AESDCHAR_IOCSEEKTO:" is turned into the seek
+ * ioctl and moves *reply_offset; anything else is appended as one write.
+ * The statistics and read-from commands are answered without touching
+ * the store. The time spent telling them apart is STAT_PHASE_PARSE, to
+ * compare against the framed requests of aesdsocket-frame.c.
+ *
+ * @param packet Packet bytes, not necessarily NUL terminated.
+ * @param length Number of bytes in packet.
+ * @param[in,out] reply_offset Store offset the reply should start from,
+ *        or the cursor of a read-from command.
+ * @param source Admission entry of the sender, charged for appends.
+ * @param async Request an event loop queues the append on instead of
+ *        waiting for it (see store_append_async()), NULL to wait.
+ * @return SUCCESS, PACKET_STATS, PACKET_READFROM, PACKET_COMPRESS,
+ *         PACKET_APPENDING, or ERROR if the append failed or was over the
+ *         sender's rate limit.
  */
-void* client_data_handler(void *thread_param)
+int handle_packet(const char *packet, size_t length, off_t *reply_offset, admission_source_t *source,
+                  append_request_t *async)
 {
-    int result;
-    int ioctl_check;
-    // variables for receiving data
-    ssize_t bytes_received = 0;
-    char receive_buffer[BUF_LEN];
-
-    // variables for sending data
-    ssize_t bytes_sent = 0;
-    char send_buffer[BUF_LEN];
-    ssize_t bytes_from_file = 1;
-
-    memset(receive_buffer, 0, BUF_LEN);
-    memset(send_buffer, 0, BUF_LEN);
-
-    ClientThreadData_t *thread_data_ptr = (ClientThreadData_t*)thread_param;
+    size_t cmd_len = strlen(ioctl_str);
+    char command[64];
+    struct aesd_seekto aesd_seekto_data;
+    uint64_t start = stats_now();
+    bool compress;
+    int parsed;
+
+    if (stats_is_command(packet, length))
+    {
+        stats_record(STAT_PHASE_PARSE, start);
+        return PACKET_STATS;
+    }
 
-    inet_ntop(thread_data_ptr->pClientAddr->ss_family,
-              get_in_addr((struct sockaddr *)&(thread_data_ptr->pClientAddr)),
-              s, sizeof s);
-    
-    syslog(LOG_INFO, "New connection established: %s", s);
-    syslog(LOG_INFO, "Thread %ld initialized", thread_data_ptr->threadId);
+    if (history_is_readfrom(packet, length, reply_offset))
+    {
+        stats_record(STAT_PHASE_PARSE, start);
+        return PACKET_READFROM;
+    }
 
-    // Initialize the condition variable
-    void *newline_found = NULL;
+    if (compress_is_command(packet, length, &compress))
+    {
+        *reply_offset = compress ? 1 : 0;
+        stats_record(STAT_PHASE_PARSE, start);
+        return PACKET_COMPRESS;
+    }
 
-    // Execute loop as long as the condition variable is NULL
-    while (newline_found == NULL)
+    if ((length >= cmd_len) && (memcmp(packet, ioctl_str, cmd_len) == 0))
     {
-        bytes_received = recv(thread_data_ptr->clientSocketFd, receive_buffer, BUF_LEN, 0);
-        if (bytes_received == ERROR)
+        // Parse from a bounded, terminated copy of the command
+        length = (length < sizeof(command)) ? length : sizeof(command) - 1;
+        memcpy(command, packet, length);
+        command[length] = '\0';
+
+        parsed = sscanf(command, "AESDCHAR_IOCSEEKTO:%u,%u", &aesd_seekto_data.write_cmd,
+                        &aesd_seekto_data.write_cmd_offset);
+        stats_record(STAT_PHASE_PARSE, start);
+        if ((parsed != 2) || (store_seek(&aesd_seekto_data, reply_offset) == ERROR))
         {
-            syslog(LOG_ERR, "Data reception unsuccessful");
-            return NULL;
+            log_msg(LOG_ERR, "Seek command rejected");
+            *reply_offset = 0;
         }
+        return SUCCESS;
+    }
 
-        // Check if the received string starts with "AESDCHAR_IOCSEEKTO:"
-        ioctl_check = strncmp(receive_buffer, ioctl_str, strlen(ioctl_str));
-        
-        if (ioctl_check == 0)
-        {
-            struct aesd_seekto aesd_seekto_data;
-            sscanf(receive_buffer, "AESDCHAR_IOCSEEKTO:%d,%d", &aesd_seekto_data.write_cmd, &aesd_seekto_data.write_cmd_offset); 
-            
-            dataFileDescriptor = open(DATA_FILE, O_RDWR | O_CREAT | O_APPEND, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
-            if(dataFileDescriptor == ERROR)
-            {
-                syslog(LOG_ERR,"Data file open failed");
-                DEBUG_LOG("Application Failure\n");
-                DEBUG_LOG("Check logs\n");
-                return NULL;
-            }
-        
-            if(ioctl(dataFileDescriptor, AESDCHAR_IOCSEEKTO, &aesd_seekto_data) != 0)
-            {
-                perror("ioctl failed");
-                syslog(LOG_ERR,"ioctl failed");
-            }
+    stats_record(STAT_PHASE_PARSE, start);
+    if (admission_charge(source, 1, length) == ERROR)
+    {
+        return ERROR;
+    }
 
-            // No need to close the file descriptor here as it will be reused for reading.
-        }
-        else
+    if (async != NULL)
+    {
+        if (store_append_async(async, packet, length))
         {
-            // Open the file in write mode
-            dataFileDescriptor = open(DATA_FILE, O_RDWR | O_CREAT | O_APPEND, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
-            if (ERROR == dataFileDescriptor)
-            {
-                perror("File open");
-                syslog(LOG_ERR, "File Open");
-            }
-
-            // Lock mutex to protect file
-            result = pthread_mutex_lock(thread_data_ptr->pMutex);
-            if (result == ERROR)
-            {
-                syslog(LOG_ERR, "Failed to acquire mutex");
-                return NULL;
-            }
+            return PACKET_APPENDING;
+        }
+        return (async->result == ERROR) ? ERROR : SUCCESS;
+    }
+    return (store_append(packet, length) == ERROR) ? ERROR : SUCCESS;
+}
 
-            // Write received data to the file
-            result = write(dataFileDescriptor, receive_buffer, bytes_received);
-            if (result == ERROR)
-            {
-                syslog(LOG_ERR, "Unsuccessful file write operation");
-                return NULL;
-            }
+/**
+ * @brief Takes the snapshot that answers a handled packet.
+ *
+ * Shared by every server mode so they all reply the same way.
+ *
+ * @param[out] snap Snapshot to send; release it with history_release().
+ * @param packet_status Result of handle_packet().
+ * @param[in,out] reply_offset Offset from handle_packet(); set to where
+ *        sending the snapshot starts.
+ * @param compressed The connection asked for compressed history replies.
+ * @return SUCCESS or ERROR.
+ */
+int reply_acquire(history_snapshot_t *snap, int packet_status, off_t *reply_offset, bool compressed)
+{
+    off_t cursor = *reply_offset;
 
-            // Unlock mutex
-            result = pthread_mutex_unlock(thread_data_ptr->pMutex);
-            if (result == ERROR)
-            {
-                syslog(LOG_ERR, "Failed to release mutex");
-                return NULL;
-            }
+    switch (packet_status)
+    {
+    case PACKET_STATS:
+        *reply_offset = 0;
+        return stats_acquire(snap);
 
-            // Close the file descriptor after writing
-            close(dataFileDescriptor);
-        }
+    case PACKET_READFROM:
+        *reply_offset = 0;
+        return history_acquire_since(snap, cursor);
 
-        // Update the condition variable
-        newline_found = memchr(receive_buffer, '\n', bytes_received);
-    }
+    case PACKET_COMPRESS:
+        *reply_offset = 0;
+        return compress_acquire_ack(snap, cursor != 0);
 
-    if(ioctl_check != 0)
-    {
-        // Open the file in read-only mode
-        dataFileDescriptor = open(DATA_FILE, O_RDONLY, 0444);
-        if (ERROR == dataFileDescriptor)
+    default:
+        if (compressed)
         {
-            syslog(LOG_ERR,"Data file open failed");
-            DEBUG_LOG("Application Failure\n");
-            DEBUG_LOG("Check logs\n");
-            return NULL;
+            *reply_offset = 0;
+            return compress_acquire(snap, cursor);
         }
+        history_acquire(snap);
+        return SUCCESS;
     }
+}
+
+/**
+ * @brief Applies the slow-client limits to a reply the socket cannot take.
+ *
+ * A reply is given up once the client has taken none of it for
+ * s_config.write_timeout_secs, or once it has run that long and still has
+ * more than s_config.max_output_bytes unsent. Shared by every server mode.
+ *
+ * @param unsent Reply bytes the kernel has not accepted yet.
+ * @param reply_start stats_now() when the reply started.
+ * @param last_progress stats_now() when the kernel last accepted reply bytes.
+ * @return Milliseconds the reply may still wait, 0 to evict the client,
+ *         or -1 when there is no write timeout.
+ */
+int reply_wait_ms(size_t unsent, uint64_t reply_start, uint64_t last_progress)
+{
+    uint64_t limit = (uint64_t)s_config.write_timeout_secs * 1000000000ull;
+    uint64_t deadline = last_progress + limit;
+    uint64_t now;
 
-#ifndef USE_AESD_CHAR_DEVICE
+    if (s_config.write_timeout_secs == 0)
+    {
+        return -1;
+    }
 
-    // Seek to the beginning of the file (if not using AESD_CHAR_DEVICE)
-    off_t seek_result = lseek(dataFileDescriptor, 0, SEEK_SET);
-    if (seek_result == ERROR)
+    if ((s_config.max_output_bytes > 0) && (unsent > s_config.max_output_bytes) &&
+        (reply_start + limit < deadline))
     {
-        syslog(LOG_ERR, "Failed to seek in the file");
-        return NULL;
+        deadline = reply_start + limit;
     }
 
-#endif
+    now = stats_now();
+    if (now >= deadline)
+    {
+        return 0;
+    }
+    return (int)((deadline - now + 999999) / 1000000);
+}
 
-    // Loop as long as bytes_from_file is greater than 0
-    while (bytes_from_file > 0)
+/**
+ * @brief Streams a snapshot from reply_offset to its end.
+ *
+ * Sends never block: while the socket is full the thread waits in poll()
+ * for as long as reply_wait_ms() allows and evicts the client after that.
+ * The snapshot is released in any case.
+ *
+ * @param socket_fd Client socket.
+ * @param client_ip Printable peer address, for the eviction log.
+ * @param snapshot Reply to send.
+ * @param reply_offset Offset in the snapshot to start from.
+ * @param prefix Frame header to send first, NULL on text connections.
+ * @return SUCCESS or ERROR.
+ */
+static int send_snapshot(int socket_fd, const char *client_ip, history_snapshot_t *snapshot, off_t reply_offset,
+                         frame_prefix_t *prefix)
+{
+    struct pollfd writable = { .fd = socket_fd, .events = POLLOUT };
+    uint64_t start = stats_now();
+    uint64_t last_progress = start;
+    ssize_t bytes_sent;
+    int wait_ms;
+    int ret_status = SUCCESS;
+
+    // Stream the prefix, then the snapshot, to the client until all of it is sent
+    while (((prefix != NULL) && ((bytes_sent = frame_prefix_send(socket_fd, prefix)) != 0)) ||
+           ((bytes_sent = history_send(socket_fd, snapshot, &reply_offset)) != 0))
     {
-        // Lock mutex to protect file
-        result = pthread_mutex_lock(thread_data_ptr->pMutex);
-        if (result == ERROR)
+        if (bytes_sent > 0)
         {
-            syslog(LOG_ERR, "Failed to acquire mutex");
-            return NULL;
+            last_progress = stats_now();
+            continue;
         }
-
-        // Read data from the file
-        bytes_from_file = read(dataFileDescriptor, send_buffer, BUF_LEN);
-        if (bytes_from_file == ERROR)
+        if (errno == EINTR)
         {
-            syslog(LOG_ERR, "Failed to read file");
-            return NULL;
+            continue;
         }
-
-        // Unlock mutex
-        result = pthread_mutex_unlock(thread_data_ptr->pMutex);
-        if (result == ERROR)
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
         {
-            syslog(LOG_ERR, "Failed to release mutex");
-            return NULL;
+            log_msg(LOG_ERR, "Data transmission unsuccessful");
+            ret_status = ERROR;
+            break;
         }
 
-        // Send the read data back to the client
-        bytes_sent = send(thread_data_ptr->clientSocketFd, send_buffer, bytes_from_file, 0);
-        if (bytes_sent == ERROR)
-        {  
-            syslog(LOG_ERR, "Data transmission unsuccessful");
-            return NULL;
+        wait_ms = reply_wait_ms(snapshot->length - reply_offset, start, last_progress);
+        if (wait_ms == 0)
+        {
+            log_msg(LOG_INFO, "Evicted slow client: %s", client_ip);
+            stats_add(STAT_CONN_EVICTED, 1);
+            ret_status = ERROR;
+            break;
         }
+        poll(&writable, 1, wait_ms);
     }
 
-    // Close the client socket and log the termination of the connection
-    close(thread_data_ptr->clientSocketFd);
-    syslog(LOG_INFO, "Terminated connection: %s", s);
-
-    // Set the thread completion status to true
-    thread_data_ptr->isThreadComplete = true;
-
-    // Close the data file descriptor
-    close(dataFileDescriptor);
-
-    return thread_param;
+    history_release(snapshot);
+    stats_record(STAT_PHASE_REPLY, start);
+    return ret_status;
 }
 
-#ifndef USE_AESD_CHAR_DEVICE
 /**
- * @brief Initializes the timestamp structure and creates a thread for logging timestamps.
- * 
- * This function sets up the mutex and time interval for the timestamp structure, 
- * and creates a new thread to handle timestamp logging.
- * 
- * @return 0 on success, -1 on failure
+ * @brief Sends the history from reply_offset up to its current end.
+ *
+ * The reply comes from a snapshot of the in-memory mirror; the lock is
+ * only held, shared with other repliers, while the snapshot is taken.
+ *
+ * @param socket_fd Client socket.
+ * @param client_ip Printable peer address, for the eviction log.
+ * @param reply_offset Store offset to start from.
+ * @param packet_status Result of handle_packet(), selects the reply.
+ * @param compressed Send history replies as LZ4 frames.
+ * @return SUCCESS or ERROR.
  */
-int setup_time_logging(void)
+static int send_reply(int socket_fd, const char *client_ip, off_t reply_offset, int packet_status, bool compressed)
 {
-    // Initialize TS_data with mutex and time interval
-    TS_data.pMutex = &lock;
-    TS_data.timeIntervalSecs = 10;
+    history_snapshot_t snapshot;
 
-    // Create and start the timestamp logging thread
-    if(pthread_create(&(TS_data.threadId), NULL, 
-                      log_timestamps, &(TS_data)) == ERROR)
+    if (reply_acquire(&snapshot, packet_status, &reply_offset, compressed) == ERROR)
     {
-        syslog(LOG_ERR, "Failed to create the Timestamp Logging thread");
-        return -1;
+        return ERROR;
     }
-
-    return 0;
+    return send_snapshot(socket_fd, client_ip, &snapshot, reply_offset, NULL);
 }
 
+/**
+ * @brief Serves a connection that opened with FRAME_MAGIC.
+ *
+ * Each request header says how long its payload is, so the buffer is
+ * grown to the whole frame once and recv() fills exactly that; nothing
+ * is scanned. Framed connections always stay open for the next request,
+ * until the client closes, idles for s_config.idle_timeout_secs or, once
+ * a hot restart has handed the listener off, HANDOFF_DRAIN_IDLE_SECS.
+ *
+ * @param thread_data_ptr Connection being served.
+ * @param client_ip Printable peer address.
+ * @param assembler Received bytes, starting right after the magic byte.
+ * @return SUCCESS when the connection ended cleanly, ERROR otherwise.
+ */
+static int frame_session(ClientThreadData_t *thread_data_ptr, const char *client_ip, line_assembler_t *assembler)
+{
+    struct timeval idle_timeout = { .tv_sec = s_config.idle_timeout_secs, .tv_usec = 0 };
+    history_snapshot_t snapshot;
+    frame_header_t header;
+    frame_prefix_t prefix;
+    off_t reply_offset;
+    ssize_t bytes_received;
+    uint64_t receive_start = stats_now();
+    bool draining = false;
+    int complete;
+
+    setsockopt(thread_data_ptr->clientSocketFd, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, sizeof(idle_timeout));
+
+    for (;;)
+    {
+        while ((complete = frame_complete(assembler, &header)) != FRAME_COMPLETE)
+        {
+            if (complete == ERROR)
+            {
+                log_msg(LOG_ERR, "Malformed frame: %s", client_ip);
+                return ERROR;
+            }
+
+            // Room for the rest of the frame once its header is known, a header otherwise
+            if (assembler_reserve(assembler, (assembler->len >= FRAME_HEADER_LEN) ?
+                                  frame_size(&header) - assembler->len : BUF_LEN) == ERROR)
+            {
+                return ERROR;
+            }
+
+            if (!draining && handoff_done())
+            {
+                idle_timeout.tv_sec = HANDOFF_DRAIN_IDLE_SECS;
+                setsockopt(thread_data_ptr->clientSocketFd, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, sizeof(idle_timeout));
+                draining = true;
+            }
+
+            bytes_received = recv(thread_data_ptr->clientSocketFd, assembler->buf + assembler->len,
+                                  assembler->cap - assembler->len, 0);
+            if ((bytes_received == ERROR) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (assembler->len == 0))
+            {
+                log_msg(LOG_INFO, "Idle timeout: %s", client_ip);
+                return SUCCESS;
+            }
+            if (bytes_received == ERROR)
+            {
+                log_msg(LOG_ERR, "Data reception unsuccessful");
+                return ERROR;
+            }
+            if (bytes_received == 0)
+            {
+                // A frame cut short is dropped, never stored in part
+                return (assembler->len == 0) ? SUCCESS : ERROR;
+            }
+
+            stats_add(STAT_BYTES_IN, bytes_received);
+            if (receive_start == 0)
+            {
+                receive_start = stats_now();
+            }
+            assembler_commit(assembler, bytes_received);
+        }
+
+        if (receive_start != 0)
+        {
+            stats_record(STAT_PHASE_RECEIVE, receive_start);
+            receive_start = 0;
+        }
+
+        if (frame_request(&header, assembler->buf + FRAME_HEADER_LEN, thread_data_ptr->pSource,
+                          &snapshot, &reply_offset, &prefix, NULL) == ERROR)
+        {
+            return ERROR;
+        }
+        assembler_consume(assembler, frame_size(&header));
+
+        if (send_snapshot(thread_data_ptr->clientSocketFd, client_ip, &snapshot, reply_offset, &prefix) == ERROR)
+        {
+            return ERROR;
+        }
+    }
+}
 
 /**
- * @brief Logs timestamps at intervals.
+ * @brief Function to handle both receiving and sending data through a client socket.
  * 
- * This thread function logs time stamps at regular intervals.
- * It sleeps for a given time interval, then logs the current
- * time to a file. The file write is synchronized using mutex.
+ * This function does the following:
+ * 1. Receives data from the client until a newline (or end of stream) and
+ *    commits it to the data store with a single append.
+ * 2. Reads the content back from the store, from the start or from the
+ *    position selected by an AESDCHAR_IOCSEEKTO command, and sends it to
+ *    the client. A STATS_COMMAND packet is answered with the statistics
+ *    report instead and is not stored.
+ *
+ * With keep-alive (-k) the connection stays open after the reply: further
+ * packets, including ones pipelined behind the first, are committed and
+ * answered one at a time in order, until the client closes its side or
+ * stays idle for s_config.idle_timeout_secs, HANDOFF_DRAIN_IDLE_SECS once
+ * a hot restart has handed the listener off.
  *
- * @param arg Pointer to thread parameter of type ThreadTimestampData_t.
- * @return void* NULL on success or if any operation fails.
+ * The store is a single process-wide descriptor (see aesdsocket-store.c);
+ * this connection only tracks its own reply offset. The reply is sent
+ * from a snapshot of the in-memory history (see aesdsocket-history.c).
+ * 
+ * @param thread_param Pointer to the thread data structure
+ * @return Returns the pointer to the thread data structure
  */
-void *log_timestamps(void *arg)
+static void* client_session(void *thread_param)
 {
-    // Cast thread parameter to appropriate type
-    ThreadTimestampData_t *param_data = (ThreadTimestampData_t *)arg;
+    char client_ip[INET6_ADDRSTRLEN];
+    // variables for receiving data
+    ssize_t bytes_received = 0;
+    line_assembler_t assembler;
+    size_t record_length;
+    size_t packet_length;
+    bool end_of_stream = false;
+    bool idle_timed_out = false;
+    bool compress_replies = false;
+    bool draining = false;
+    int packets_served = 0;
+    int packet_status = SUCCESS;
+    uint64_t receive_start = 0;
+
+    // Store offset the reply starts from, moved by the seek command
+    off_t reply_offset;
+
+    assembler_init(&assembler);
+
+    ClientThreadData_t *thread_data_ptr = (ClientThreadData_t*)thread_param;
 
-    // Local variables
-    time_t curr_time;
-    struct tm *local_time_info;
-    char formatted_timestamp[TIMESTAMP_STRING_LENGTH];
-    struct timespec time_spec;
+    inet_ntop(thread_data_ptr->pClientAddr->ss_family,
+              get_in_addr((struct sockaddr *)thread_data_ptr->pClientAddr),
+              client_ip, sizeof client_ip);
+    
+    log_msg(LOG_INFO, "New connection established: %s", client_ip);
+    log_msg(LOG_INFO, "Thread %ld initialized", thread_data_ptr->threadId);
 
-    // Log that the thread has started
-    syslog(LOG_INFO, "Time logging thread activated.");
+    if (s_config.keepalive)
+    {
+        // An idle persistent connection surfaces as EAGAIN from recv()
+        struct timeval idle_timeout = { .tv_sec = s_config.idle_timeout_secs, .tv_usec = 0 };
+        setsockopt(thread_data_ptr->clientSocketFd, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, sizeof(idle_timeout));
+    }
 
-    // Infinite loop to log timestamps
-    while (1)
+    do
     {
-        // Get current time in monotonic mode
-        if (clock_gettime(CLOCK_MONOTONIC, &time_spec))
+        // Gather the whole packet before touching the store
+        while ((record_length = assembler_record_length(&assembler)) == 0)
         {
-            syslog(LOG_ERR, "Failed to get current time.");
-            return NULL;
-        }
+            if (assembler_reserve(&assembler, BUF_LEN) == ERROR)
+            {
+                assembler_release(&assembler);
+                return NULL;
+            }
+
+            // Shorten the idle timeout so a draining server is not held up by idle clients
+            if (s_config.keepalive && !draining && handoff_done())
+            {
+                struct timeval drain_timeout = { .tv_sec = HANDOFF_DRAIN_IDLE_SECS, .tv_usec = 0 };
+                setsockopt(thread_data_ptr->clientSocketFd, SOL_SOCKET, SO_RCVTIMEO, &drain_timeout, sizeof(drain_timeout));
+                draining = true;
+            }
+
+            bytes_received = recv(thread_data_ptr->clientSocketFd, assembler.buf + assembler.len,
+                                  assembler.cap - assembler.len, 0);
+            if ((bytes_received == ERROR) && s_config.keepalive &&
+                ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            {
+                log_msg(LOG_INFO, "Idle timeout: %s", client_ip);
+                idle_timed_out = true;
+                break;
+            }
+            if (bytes_received == ERROR)
+            {
+                log_msg(LOG_ERR, "Data reception unsuccessful");
+                assembler_release(&assembler);
+                return NULL;
+            }
+
+            // Peer closed without a newline: commit what we have as the packet
+            if (bytes_received == 0)
+            {
+                end_of_stream = true;
+                break;
+            }
+
+            stats_add(STAT_BYTES_IN, bytes_received);
+            if (receive_start == 0)
+            {
+                receive_start = stats_now();
+            }
+
+            // The first byte of the connection selects binary framing over text lines
+            if ((packets_served == 0) && (assembler.len == 0) && ((uint8_t)assembler.buf[0] == FRAME_MAGIC))
+            {
+                assembler_commit(&assembler, bytes_received);
+                assembler_consume(&assembler, 1);
+                packet_status = frame_session(thread_data_ptr, client_ip, &assembler);
+                assembler_release(&assembler);
+                if (packet_status == ERROR)
+                {
+                    return NULL;
+                }
+                close(thread_data_ptr->clientSocketFd);
+                log_msg(LOG_INFO, "Terminated connection: %s", client_ip);
+                return thread_param;
+            }
+            assembler_commit(&assembler, bytes_received);
 
-        // Increment time by the interval
-        time_spec.tv_sec += param_data->timeIntervalSecs;
+            // Bound memory for a packet that never ends
+            if ((assembler_record_length(&assembler) == 0) && (assembler.len >= ASSEMBLER_MAX_PENDING))
+            {
+                if ((admission_charge(thread_data_ptr->pSource, 0, assembler.len) == ERROR) ||
+                    (store_append(assembler.buf, assembler.len) == ERROR))
+                {
+                    assembler_release(&assembler);
+                    return NULL;
+                }
+                assembler_consume(&assembler, assembler.len);
+            }
+        }
 
-        // Sleep for the time interval
-        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time_spec, NULL))
+        // A persistent connection that idles or ends between packets has nothing left to answer
+        if (idle_timed_out || (end_of_stream && (assembler.len == 0) && (packets_served > 0)))
         {
-            syslog(LOG_ERR, "Sleep operation unsuccessful.");
-            return NULL;
+            break;
         }
 
-        // Get and format current time
-        time(&curr_time);
-        local_time_info = localtime(&curr_time);
-        int length_of_timestamp = strftime(formatted_timestamp, sizeof(formatted_timestamp), "timestamp: %Y, %b %d, %H:%M:%S\n", local_time_info);
+        // Persistent connections commit one record at a time; otherwise everything received
+        packet_length = (s_config.keepalive && (record_length > 0)) ? record_length : assembler.len;
 
-        // Lock mutex
-        if (pthread_mutex_lock(param_data->pMutex) == ERROR)
+        if (receive_start != 0)
         {
-            syslog(LOG_ERR, "Failed to lock mutex.");
-            return NULL;
+            stats_record(STAT_PHASE_RECEIVE, receive_start);
+            receive_start = 0;
         }
 
-        // Write the timestamp to file
-        if (write(dataFileDescriptor, formatted_timestamp, length_of_timestamp) == ERROR)
+        reply_offset = 0;
+        packet_status = (packet_length > 0) ? handle_packet(assembler.buf, packet_length, &reply_offset, thread_data_ptr->pSource, NULL) : SUCCESS;
+        if (packet_status == ERROR)
         {
-            syslog(LOG_ERR, "Failed to write timestamp to file.");
+            assembler_release(&assembler);
             return NULL;
         }
+        assembler_consume(&assembler, packet_length);
+        if (packet_status == PACKET_COMPRESS)
+        {
+            compress_replies = (reply_offset != 0);
+        }
 
-        // Unlock mutex
-        if (pthread_mutex_unlock(param_data->pMutex) == ERROR)
+        if (send_reply(thread_data_ptr->clientSocketFd, client_ip, reply_offset, packet_status, compress_replies) == ERROR)
         {
-            syslog(LOG_ERR, "Failed to unlock mutex.");
+            assembler_release(&assembler);
             return NULL;
         }
-    }
+        packets_served++;
+    } while (s_config.keepalive && !end_of_stream);
+
+    assembler_release(&assembler);
+
+    // Close the client socket and log the termination of the connection
+    close(thread_data_ptr->clientSocketFd);
+    log_msg(LOG_INFO, "Terminated connection: %s", client_ip);
 
-    return NULL; // Return NULL for good measure, though we never actually get here
+    return thread_param;
 }
 
-#endif
\ No newline at end of file
+/**
+ * @brief Thread entry point serving one client; see client_session().
+ *
+ * Counts the connection in the statistics around the session itself.
+ *
+ * @param thread_param Pointer to the thread data structure
+ * @return Returns the pointer to the thread data structure, or NULL on error
+ */
+void* client_data_handler(void *thread_param)
+{
+    void *ret;
+
+    ClientThreadData_t *thread_data_ptr = (ClientThreadData_t*)thread_param;
+
+    stats_add(STAT_CONN_ACCEPTED, 1);
+    ret = client_session(thread_param);
+    stats_add(STAT_CONN_CLOSED, 1);
+    admission_release(thread_data_ptr->pSource);
+
+    // The error paths leave the socket open
+    if (ret == NULL)
+    {
+        close(thread_data_ptr->clientSocketFd);
+    }
+
+    // Set the thread completion status to true; the accept loop joins it
+    thread_data_ptr->isThreadComplete = true;
+
+    return ret;
+}
@@ -24,9 +24,21 @@
 #include <pthread.h>
 #include <sys/queue.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
 
 /****************   Macros     ***************/ 
+#define USE_AESD_CHAR_DEVICE
+
+// Store backend used without -s
+#ifdef USE_AESD_CHAR_DEVICE
+	#define DEFAULT_STORE_BACKEND "chardev"
+#else
+	#define DEFAULT_STORE_BACKEND "file"
+#endif
 
 #define DEBUG_LOG(msg,...) printf("INFO: " msg "\n" , ##__VA_ARGS__)
 
@@ -36,11 +48,74 @@
 #define ERROR 		(-1)
 
 #define BACKLOG_CONNECTIONS	(10)
+#define MAX_BACKLOG_CONNECTIONS (65535)
 
 #define BUF_LEN		(1024)
 
 #define TIMESTAMP_STRING_LENGTH     100
 
+#define DEFAULT_WORKER_THREADS      (2)
+#define MAX_WORKER_THREADS          (64)
+#define DEFAULT_QUEUE_DEPTH         (64)
+#define MAX_QUEUE_DEPTH             (4096)
+#define DEFAULT_IDLE_TIMEOUT_SECS   (30)
+#define DEFAULT_TIMESTAMP_MS        (10000)
+#define DEFAULT_WRITE_TIMEOUT_SECS  (30)
+#define DEFAULT_MAX_OUTPUT_BYTES    (16 * 1024 * 1024)
+#define DEFAULT_SYNC_INTERVAL_MS    (100)
+
+/**
+ * @enum durability_t
+ * @brief When appended records are synced to stable storage.
+ */
+typedef enum
+{
+    DURABILITY_NONE,        /**< Never; the kernel writes back on its own schedule (default) */
+    DURABILITY_INTERVAL,    /**< One sync for everything appended, every sync_interval_ms */
+    DURABILITY_STRICT,      /**< Each batch is synced before its writers are released */
+} durability_t;
+
+/**
+ * @enum server_mode_t
+ * @brief Selects how accepted client connections are serviced.
+ */
+typedef enum
+{
+    SERVER_MODE_THREAD,     /**< One pthread per accepted connection (default) */
+    SERVER_MODE_EPOLL,      /**< Edge-triggered epoll reactor on a fixed set of threads */
+    SERVER_MODE_POOL,       /**< Pre-spawned worker pool fed by a bounded queue */
+    SERVER_MODE_URING,      /**< io_uring engine, falls back to SERVER_MODE_THREAD if unavailable */
+    SERVER_MODE_REUSEPORT,  /**< epoll loops pinned per CPU, each with its own SO_REUSEPORT listener */
+} server_mode_t;
+
+/**
+ * @struct server_config_t
+ * @brief Runtime configuration parsed from the command line.
+ */
+typedef struct
+{
+    server_mode_t mode;     /**< Connection handling model, set with -m */
+    int worker_threads;     /**< Number of event loop / worker threads, set with -t */
+    int queue_depth;        /**< Pending connections the pool queues before blocking accept, set with -q */
+    bool keepalive;         /**< Serve many packets per connection, set with -k */
+    int idle_timeout_secs;  /**< Close kept-alive connections idle this long, set with -i */
+    durability_t durability;    /**< When appends are synced, set with -D (-S for strict) */
+    long sync_interval_ms;  /**< Sync period of DURABILITY_INTERVAL, set with -D interval:ms */
+    int backlog;            /**< listen() backlog of every listener, set with -b */
+    long timestamp_interval_ms; /**< Period of timestamp records (file backend), set with -T */
+    int write_timeout_secs; /**< Evict a client that takes no reply bytes this long, 0 never, set with -w */
+    size_t max_output_bytes;    /**< Unsent reply bytes a client may still hold after -w seconds, 0 no limit, set with -o */
+    int max_conns_per_ip;   /**< Concurrent connections per peer address, 0 no limit, set with -c */
+    double records_per_sec; /**< Appended records per second per peer address, 0 no limit, set with -r */
+    double bytes_per_sec;   /**< Appended bytes per second per peer address, 0 no limit, set with -B */
+    bool hot_restart;       /**< Take the listener over from a running server, set with -R */
+    int log_level;          /**< Least severe syslog priority logged, set with -v */
+    const char *log_path;   /**< Log to this file instead of syslog, set with -L */
+    const char *store_name; /**< Storage backend, set with -s */
+    size_t store_capacity;  /**< Bytes the backend keeps at most, 0 its own limit, set with -s name:bytes */
+    size_t store_records;   /**< Records the backend keeps at most, 0 no limit, set with -n */
+} server_config_t;
+
 /**
  * @struct status_flags
  * @brief Struct to hold various status flags.
@@ -91,10 +166,12 @@ typedef struct
 typedef struct
 {
     pthread_t threadId;                     /**< Thread identifier */
-    pthread_mutex_t *pMutex;                /**< Pointer to mutex for synchronization */
-    bool isThreadComplete;                  /**< Flag to indicate if the thread has completed its task */
+    pthread_rwlock_t *pLock;                /**< Pointer to the store lock */
+    atomic_bool isThreadComplete;           /**< Flag to indicate if the thread has completed its task */
     int clientSocketFd;                     /**< File descriptor for the client socket */
     struct sockaddr_storage *pClientAddr;   /**< Pointer to client address information */
+    struct sockaddr_storage clientAddr;     /**< Client address, owned by the node so accept() can reuse its buffer */
+    struct admission_source *pSource;       /**< Admission entry of the peer address, NULL if untracked */
 } ClientThreadData_t;
 
 /**
@@ -111,19 +188,40 @@ typedef struct node
     SLIST_ENTRY(node) nodes;
 }node_t;
 
+/****************   Shared State     ***************/ 
+extern const char *ioctl_str;
+extern sig_atomic_t fatal_error_in_progress;
+extern pthread_rwlock_t lock;
+extern server_config_t s_config;
+
 /**
- * @struct ThreadTimestampData
- * @brief Holds information related to timestamping for each thread.
- * 
- * This structure is designed to manage timestamping details within
- * multi-threaded applications.
+ * @brief eventfd that turns readable once SIGINT or SIGTERM arrived.
+ *
+ * Never read, so every loop polling it wakes and then sees
+ * fatal_error_in_progress.
+ *
+ * @return Descriptor, or ERROR if it could not be created.
  */
-typedef struct
-{
-    pthread_t threadId;          /**< Thread identifier */
-    pthread_mutex_t *pMutex;     /**< Pointer to mutex for synchronization */
-    int timeIntervalSecs;        /**< Time interval for timestamps in seconds */
-} ThreadTimestampData_t;
-
+int shutdown_fd(void);
+
+void *get_in_addr(struct sockaddr *sa);
+void *client_data_handler(void *thread_param);
+struct admission_source;
+struct append_request;
+int handle_packet(const char *packet, size_t length, off_t *reply_offset, struct admission_source *source,
+                  struct append_request *async);
+
+// handle_packet() result: reply with the statistics report, not the history
+#define PACKET_STATS                (1)
+// handle_packet() result: reply with the bytes after the cursor left in *reply_offset
+#define PACKET_READFROM             (2)
+// handle_packet() result: *reply_offset is 1 to compress further replies, 0 to stop
+#define PACKET_COMPRESS             (3)
+// handle_packet() result: the append was queued; reply once the request is handed back
+#define PACKET_APPENDING            (4)
+
+struct history_snapshot;
+int reply_acquire(struct history_snapshot *snap, int packet_status, off_t *reply_offset, bool compressed);
+int reply_wait_ms(size_t unsent, uint64_t reply_start, uint64_t last_progress);
 
 #endif // AESDSOCKET_H
@@ -0,0 +1,162 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/aesdsocket-lz4.h"
+
+/**
+* Compresses len bytes of src, checks the block fits lz4_compress_bound() and
+* decompresses it back into a buffer of exactly len bytes.
+*/
+static void lz4_round_trip(const uint8_t *src, size_t len)
+{
+    size_t bound = lz4_compress_bound(len);
+    uint8_t *compressed = malloc(bound);
+    uint8_t *restored = malloc(len + 1);
+    size_t compressed_len;
+
+    TEST_ASSERT_NOT_NULL(compressed);
+    TEST_ASSERT_NOT_NULL(restored);
+
+    compressed_len = lz4_compress(src, len, compressed, bound);
+    TEST_ASSERT_TRUE_MESSAGE(compressed_len > 0, "Block did not fit lz4_compress_bound()");
+    TEST_ASSERT_TRUE(compressed_len <= bound);
+    TEST_ASSERT_EQUAL_INT(len, lz4_decompress(compressed, compressed_len, restored, len));
+    if(len > 0)
+    {
+        TEST_ASSERT_EQUAL_MEMORY(src, restored, len);
+    }
+
+    free(compressed);
+    free(restored);
+}
+
+void test_lz4_round_trip_short_inputs()
+{
+    const uint8_t text[] = "aesdsocket\n";
+    size_t len;
+
+    // Everything up to the match finder limit is stored as literals
+    for(len = 0; len < sizeof(text); len++)
+    {
+        lz4_round_trip(text, len);
+    }
+}
+
+void test_lz4_round_trip_records()
+{
+    const char *record = "timestamp:Sat, 17 Oct 2026 10:00:00 +0000\n";
+    size_t record_len = strlen(record);
+    size_t len = 0;
+    uint8_t *src = malloc(LZ4_FRAME_BLOCK);
+    uint8_t compressed[1024];
+    size_t compressed_len;
+
+    TEST_ASSERT_NOT_NULL(src);
+    while(len + record_len <= LZ4_FRAME_BLOCK)
+    {
+        memcpy(src + len, record, record_len);
+        len += record_len;
+    }
+    lz4_round_trip(src, len);
+
+    /**
+     * Repeated records must actually compress, or replies would be sent
+     * uncompressed; a block this repetitive ends up far below 1 KiB.
+     */
+    compressed_len = lz4_compress(src, len, compressed, sizeof(compressed));
+    TEST_ASSERT_TRUE(compressed_len > 0);
+    TEST_ASSERT_TRUE(compressed_len < len / 16);
+    free(src);
+}
+
+void test_lz4_round_trip_overlapping_match()
+{
+    uint8_t src[4096];
+
+    // A run is encoded as a match overlapping the bytes it produces
+    memset(src, 'a', sizeof(src));
+    src[sizeof(src) - 1] = '\n';
+    lz4_round_trip(src, sizeof(src));
+}
+
+void test_lz4_round_trip_long_lengths()
+{
+    size_t len = 3 * 255 + 40;
+    uint8_t *src = malloc(LZ4_FRAME_BLOCK);
+    uint32_t state = 1;
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL(src);
+
+    // Literal and match lengths past 15 + 255 need 255-run continuations
+    for(i = 0; i < len; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        src[i] = (uint8_t)(state >> 16);
+    }
+    memcpy(src + len, src, len);
+    lz4_round_trip(src, 2 * len);
+
+    // Noise does not compress; the block still has to fit the bound
+    for(i = 0; i < LZ4_FRAME_BLOCK; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        src[i] = (uint8_t)(state >> 16);
+    }
+    lz4_round_trip(src, LZ4_FRAME_BLOCK);
+    free(src);
+}
+
+void test_lz4_compress_reports_full_output()
+{
+    uint8_t src[256];
+    uint8_t dst[16];
+    size_t i;
+
+    for(i = 0; i < sizeof(src); i++)
+    {
+        src[i] = (uint8_t)(i * 7);
+    }
+    TEST_ASSERT_EQUAL_INT(0, lz4_compress(src, sizeof(src), dst, sizeof(dst)));
+}
+
+void test_lz4_decompress_rejects_malformed_blocks()
+{
+    const uint8_t src[] = "abcdabcdabcdabcdabcdabcdabcd\n";
+    uint8_t compressed[64];
+    uint8_t restored[64];
+    size_t compressed_len;
+    // Token asking for 4 literals followed by a match, but only 2 literals
+    const uint8_t truncated[] = { 0x40, 'a', 'b' };
+    // One literal then a match reaching back before the start of the output
+    const uint8_t bad_offset[] = { 0x10, 'a', 0x02, 0x00, 'b' };
+
+    TEST_ASSERT_EQUAL_INT((size_t)-1, lz4_decompress(truncated, sizeof(truncated), restored, sizeof(restored)));
+    TEST_ASSERT_EQUAL_INT((size_t)-1, lz4_decompress(bad_offset, sizeof(bad_offset), restored, sizeof(restored)));
+
+    // A valid block that does not fit the output buffer
+    compressed_len = lz4_compress(src, sizeof(src) - 1, compressed, sizeof(compressed));
+    TEST_ASSERT_TRUE(compressed_len > 0);
+    TEST_ASSERT_EQUAL_INT((size_t)-1, lz4_decompress(compressed, compressed_len, restored, sizeof(src) - 2));
+    TEST_ASSERT_EQUAL_INT(sizeof(src) - 1, lz4_decompress(compressed, compressed_len, restored, sizeof(restored)));
+}
+
+void test_lz4_frame_header_round_trip()
+{
+    uint8_t header[LZ4_FRAME_HEADER];
+    uint32_t raw_len;
+    uint32_t payload_len;
+
+    lz4_frame_put(header, LZ4_FRAME_BLOCK, 0x01020304u);
+    // Little-endian on the wire whatever the host byte order
+    TEST_ASSERT_EQUAL_UINT32(0x00, header[0]);
+    TEST_ASSERT_EQUAL_UINT32(0x00, header[1]);
+    TEST_ASSERT_EQUAL_UINT32(0x01, header[2]);
+    TEST_ASSERT_EQUAL_UINT32(0x04, header[4]);
+    TEST_ASSERT_EQUAL_UINT32(0x01, header[7]);
+
+    lz4_frame_get(header, &raw_len, &payload_len);
+    TEST_ASSERT_EQUAL_UINT32(LZ4_FRAME_BLOCK, raw_len);
+    TEST_ASSERT_EQUAL_UINT32(0x01020304u, payload_len);
+}
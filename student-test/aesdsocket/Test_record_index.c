@@ -0,0 +1,220 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/aesdsocket-index.h"
+
+/****************   Global Variables     ***************/
+static char data_path[] = "/tmp/aesdsocket-index-test-XXXXXX";
+static char index_path[sizeof(data_path) + 4];
+static int data_fd = ERROR;
+
+/**
+* Creates a store file holding contents, with the index path next to it.
+*/
+static void index_test_create_store(const char *contents)
+{
+    strcpy(data_path + sizeof(data_path) - 7, "XXXXXX");
+    data_fd = mkstemp(data_path);
+    TEST_ASSERT_TRUE(data_fd != ERROR);
+    snprintf(index_path, sizeof(index_path), "%s.idx", data_path);
+    TEST_ASSERT_EQUAL_INT(strlen(contents), write(data_fd, contents, strlen(contents)));
+}
+
+static void index_test_remove_store(void)
+{
+    record_index_close(false);
+    unlink(index_path);
+    close(data_fd);
+    unlink(data_path);
+    data_fd = ERROR;
+}
+
+/**
+* Appends buf to the store as another process would, without indexing it.
+*/
+static off_t index_test_write(const char *buf)
+{
+    off_t end = lseek(data_fd, 0, SEEK_END);
+
+    TEST_ASSERT_EQUAL_INT(strlen(buf), pwrite(data_fd, buf, strlen(buf), end));
+    return end + strlen(buf);
+}
+
+/**
+* Checks record is stored between start and end.
+*/
+static void index_test_assert_record(uint64_t record, off_t start, off_t end)
+{
+    off_t found_start;
+    off_t found_end;
+
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_find(record, &found_start, &found_end));
+    TEST_ASSERT_EQUAL_INT(start, found_start);
+    TEST_ASSERT_EQUAL_INT(end, found_end);
+}
+
+/**
+* Reads the header of the index file as a successor would find it.
+*/
+static void index_test_read_header(record_index_header_t *header)
+{
+    int fd = open(index_path, O_RDONLY);
+
+    TEST_ASSERT_TRUE(fd != ERROR);
+    TEST_ASSERT_EQUAL_INT(sizeof(*header), pread(fd, header, sizeof(*header), 0));
+    close(fd);
+}
+
+void test_record_index_scans_existing_store()
+{
+    off_t start;
+    off_t end;
+
+    // The partial write at the end is not a record yet
+    index_test_create_store("a\nbb\nccc\ndd");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    TEST_ASSERT_EQUAL_INT(3, record_index_count());
+    index_test_assert_record(0, 0, 2);
+    index_test_assert_record(1, 2, 5);
+    index_test_assert_record(2, 5, 9);
+    TEST_ASSERT_EQUAL_INT(ERROR, record_index_find(3, &start, &end));
+
+    record_index_close(true);
+    TEST_ASSERT_EQUAL_INT(ERROR, access(index_path, F_OK));
+    index_test_remove_store();
+}
+
+void test_record_index_append_indexes_written_bytes()
+{
+    struct iovec iov[3];
+    off_t end;
+
+    index_test_create_store("");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    TEST_ASSERT_EQUAL_INT(0, record_index_count());
+
+    // Newlines are taken from the buffers; only the accepted bytes count
+    iov[0].iov_base = "one\ntw";
+    iov[0].iov_len = strlen("one\ntw");
+    iov[1].iov_base = "o\nthr";
+    iov[1].iov_len = strlen("o\nthr");
+    iov[2].iov_base = "ee\n";
+    iov[2].iov_len = strlen("ee\n");
+    end = index_test_write("one\ntwo\nthr");
+    record_index_append(iov, strlen("one\ntwo\nthr"), end);
+    TEST_ASSERT_EQUAL_INT(2, record_index_count());
+    index_test_assert_record(1, 4, 8);
+
+    // The rest of the short write completes the third record
+    iov[0].iov_base = "ee\n";
+    iov[0].iov_len = strlen("ee\n");
+    end = index_test_write("ee\n");
+    record_index_append(iov, strlen("ee\n"), end);
+    TEST_ASSERT_EQUAL_INT(3, record_index_count());
+    index_test_assert_record(2, 8, 14);
+    index_test_remove_store();
+}
+
+void test_record_index_catches_up_with_other_writers()
+{
+    struct iovec iov = { .iov_base = "mine\n", .iov_len = strlen("mine\n") };
+    off_t end;
+
+    index_test_create_store("first\n");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+
+    // A hot restart peer appended without this process indexing it
+    index_test_write("peer\n");
+    index_test_assert_record(1, 6, 11);
+
+    index_test_write("peer again\n");
+    end = index_test_write("mine\n");
+    record_index_append(&iov, iov.iov_len, end);
+    TEST_ASSERT_EQUAL_INT(4, record_index_count());
+    index_test_assert_record(2, 11, 22);
+    index_test_assert_record(3, 22, 27);
+    index_test_remove_store();
+}
+
+void test_record_index_reused_by_successor()
+{
+    record_index_header_t header;
+    uint64_t marker = 1;
+    int fd;
+
+    index_test_create_store("a\nbb\n");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    record_index_close(false);
+
+    index_test_read_header(&header);
+    TEST_ASSERT_EQUAL_INT(INDEX_MAGIC, header.magic);
+    TEST_ASSERT_EQUAL_INT(2, header.count);
+    TEST_ASSERT_EQUAL_INT(5, header.indexed_end);
+
+    /**
+     * Mark the first entry: a reused index keeps it, a rescan would put
+     * back 2. Only the last entry is checked against the store.
+     */
+    fd = open(index_path, O_WRONLY);
+    TEST_ASSERT_TRUE(fd != ERROR);
+    TEST_ASSERT_EQUAL_INT(sizeof(marker), pwrite(fd, &marker, sizeof(marker), sizeof(header)));
+    close(fd);
+
+    // Bytes written while no index was open are scanned on reopen
+    index_test_write("ccc\n");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    TEST_ASSERT_EQUAL_INT(3, record_index_count());
+    index_test_assert_record(0, 0, 1);
+    index_test_assert_record(2, 5, 9);
+    index_test_remove_store();
+}
+
+void test_record_index_rebuilt_when_store_changed()
+{
+    record_index_header_t header;
+
+    index_test_create_store("a\nbb\nccc\n");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    record_index_close(false);
+
+    // The store shrank below the indexed bytes
+    TEST_ASSERT_EQUAL_INT(0, ftruncate(data_fd, 0));
+    index_test_write("xyz\n");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    TEST_ASSERT_EQUAL_INT(1, record_index_count());
+    index_test_assert_record(0, 0, 4);
+    record_index_close(false);
+
+    // The last indexed record no longer ends on a newline
+    TEST_ASSERT_EQUAL_INT(0, ftruncate(data_fd, 0));
+    index_test_write("xy z\n");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    TEST_ASSERT_EQUAL_INT(1, record_index_count());
+    index_test_assert_record(0, 0, 5);
+    record_index_close(false);
+
+    index_test_read_header(&header);
+    TEST_ASSERT_EQUAL_INT(1, header.count);
+    TEST_ASSERT_EQUAL_INT(5, header.indexed_end);
+    index_test_remove_store();
+}
+
+void test_record_index_grows_past_first_allocation()
+{
+    struct iovec iov = { .iov_base = "\n", .iov_len = 1 };
+    off_t end = 0;
+    uint64_t i;
+
+    index_test_create_store("");
+    TEST_ASSERT_EQUAL_INT(SUCCESS, record_index_open(index_path, data_fd));
+    for(i = 0; i < INDEX_GROW_ENTRIES + 10; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(1, pwrite(data_fd, "\n", 1, end));
+        end++;
+        record_index_append(&iov, 1, end);
+    }
+    TEST_ASSERT_EQUAL_INT(INDEX_GROW_ENTRIES + 10, record_index_count());
+    index_test_assert_record(INDEX_GROW_ENTRIES + 9, INDEX_GROW_ENTRIES + 9, INDEX_GROW_ENTRIES + 10);
+    index_test_remove_store();
+}
@@ -0,0 +1,191 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/aesdsocket-ring.h"
+#include "../../server/aesdsocket-history.h"
+
+/**
+* Opens the ring backend and a mirror set up the way store_open() does for it.
+*/
+static void ring_history_open(size_t capacity)
+{
+    TEST_ASSERT_EQUAL_INT(SUCCESS, ring_backend.open(capacity, 0));
+    TEST_ASSERT_TRUE(ring_backend.bounded);
+    history_init(ring_backend.bounded, capacity);
+}
+
+static void ring_history_close(void)
+{
+    ring_backend.close(true);
+    history_destroy();
+}
+
+/**
+* Appends buf to the ring and mirrors what it accepted, as store_append() does.
+*/
+static void ring_history_append(const char *buf)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = strlen(buf) };
+
+    TEST_ASSERT_EQUAL_INT(iov.iov_len, ring_backend.append(&iov, 1));
+    TEST_ASSERT_EQUAL_INT(SUCCESS, history_append(buf, iov.iov_len));
+}
+
+/**
+* Checks the mirror holds exactly the bytes the ring returns, and that its
+* stream positions end at written, the bytes of completed writes so far.
+*/
+static void ring_history_assert_match(size_t written)
+{
+    char ring_bytes[1024];
+    history_snapshot_t snap;
+    ssize_t bytes_read;
+    off_t length = 0;
+
+    while((bytes_read = ring_backend.read(ring_bytes + length, sizeof(ring_bytes) - length, length)) > 0)
+    {
+        length += bytes_read;
+    }
+    TEST_ASSERT_EQUAL_INT(0, bytes_read);
+    TEST_ASSERT_EQUAL_INT(ring_backend.length(), length);
+
+    history_acquire(&snap);
+    TEST_ASSERT_EQUAL_INT(length, snap.length);
+    TEST_ASSERT_EQUAL_INT(written, snap.origin + snap.length);
+    if(length > 0)
+    {
+        TEST_ASSERT_EQUAL_MEMORY(ring_bytes, snap.block->data + snap.base, length);
+    }
+    history_release(&snap);
+}
+
+void test_ring_history_evicts_oldest_entries()
+{
+    char record[32];
+    size_t written = 0;
+    int i;
+
+    ring_history_open(0);
+    for(i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 5; i++)
+    {
+        snprintf(record, sizeof(record), "record %d\n", i);
+        ring_history_append(record);
+        written += strlen(record);
+        ring_history_assert_match(written);
+    }
+    TEST_ASSERT_EQUAL_INT(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, ring_backend.record_count());
+
+    // The first five records went, from both
+    TEST_ASSERT_EQUAL_INT(5 * strlen("record 0\n"), written - ring_backend.length());
+    ring_history_close();
+}
+
+void test_ring_history_partial_writes_wait_for_newline()
+{
+    size_t written = 0;
+
+    ring_history_open(0);
+    ring_history_append("first\n");
+    written += strlen("first\n");
+
+    // Neither store shows a write until its newline arrives
+    ring_history_append("par");
+    ring_history_assert_match(written);
+    ring_history_append("tial");
+    ring_history_assert_match(written);
+    ring_history_append(" write\nnext");
+    written += strlen("partial write\n");
+    ring_history_assert_match(written);
+    TEST_ASSERT_EQUAL_INT(2, ring_backend.record_count());
+
+    // Several writes in one append each become an entry
+    ring_history_append(" one\na\nb\nc\nd\ne\nf\ng\nh\ni\n");
+    written += strlen("next one\na\nb\nc\nd\ne\nf\ng\nh\ni\n");
+    ring_history_assert_match(written);
+    TEST_ASSERT_EQUAL_INT(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, ring_backend.record_count());
+    ring_history_close();
+}
+
+void test_ring_history_capacity_evicts_but_keeps_newest()
+{
+    const char *records[] = {
+        "0123456789\n",
+        "abcdefghij\n",
+        "short\n",
+        // Larger than the whole capacity: kept on its own
+        "a record longer than the thirty two byte capacity\n",
+        "x\n",
+        "y\n",
+    };
+    size_t written = 0;
+    size_t i;
+
+    ring_history_open(32);
+    for(i = 0; i < sizeof(records) / sizeof(records[0]); i++)
+    {
+        ring_history_append(records[i]);
+        written += strlen(records[i]);
+        ring_history_assert_match(written);
+        TEST_ASSERT_TRUE((ring_backend.length() <= 32) || (ring_backend.record_count() == 1));
+    }
+    // The long record went as soon as a newer one arrived
+    TEST_ASSERT_EQUAL_INT(2, ring_backend.record_count());
+    TEST_ASSERT_EQUAL_INT(strlen("x\ny\n"), ring_backend.length());
+    ring_history_close();
+}
+
+void test_ring_history_load_keeps_positions_and_partial_write()
+{
+    char record[32];
+    size_t written = 0;
+    int i;
+
+    ring_history_open(0);
+    for(i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3; i++)
+    {
+        snprintf(record, sizeof(record), "entry %02d\n", i);
+        ring_history_append(record);
+        written += strlen(record);
+    }
+    ring_history_append("pending");
+
+    // A seek rebuilds the mirror from the store; nothing may shift
+    TEST_ASSERT_EQUAL_INT(SUCCESS, history_load(&ring_backend));
+    ring_history_assert_match(written);
+
+    ring_history_append(" done\n");
+    written += strlen("pending done\n");
+    ring_history_assert_match(written);
+    ring_history_close();
+}
+
+void test_ring_history_seek_matches_mirror_positions()
+{
+    struct aesd_seekto seekto = { .write_cmd = 2, .write_cmd_offset = 3 };
+    history_snapshot_t snap;
+    off_t offset;
+    char byte;
+    int i;
+
+    ring_history_open(0);
+    for(i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; i++)
+    {
+        ring_history_append((i % 2 == 0) ? "even\n" : "odd record\n");
+    }
+
+    // Entry 2 is the third record still held, counted from the oldest
+    TEST_ASSERT_EQUAL_INT(SUCCESS, ring_backend.seek(&seekto, &offset));
+    TEST_ASSERT_EQUAL_INT(1, ring_backend.read(&byte, 1, offset));
+    history_acquire(&snap);
+    TEST_ASSERT_EQUAL_INT(byte, snap.block->data[snap.base + offset]);
+    TEST_ASSERT_EQUAL_INT('n', byte);
+    history_release(&snap);
+
+    seekto.write_cmd = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    TEST_ASSERT_EQUAL_INT(ERROR, ring_backend.seek(&seekto, &offset));
+    seekto.write_cmd = 0;
+    seekto.write_cmd_offset = strlen("even\n");
+    TEST_ASSERT_EQUAL_INT(ERROR, ring_backend.seek(&seekto, &offset));
+    ring_history_close();
+}
@@ -0,0 +1,26 @@
+/****************************************************************
+ * @file      		aesdsocket-test-stubs.c
+ * @brief		    Server globals the unit tested aesdsocket modules use
+ *
+ * The modules under test are linked without aesdsocket.c, which has its
+ * own main(), and without the log drainer and statistics threads.
+*****************************************************************/
+/****************   Includes    ***************/
+#include "../../server/aesdsocket.h"
+#include "../../server/aesdsocket-log.h"
+#include "../../server/aesdsocket-stats.h"
+
+/****************   Global Variables     ***************/
+pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+void log_msg(int priority, const char *format, ...)
+{
+    (void)priority;
+    (void)format;
+}
+
+void stats_add(stat_counter_t counter, uint64_t value)
+{
+    (void)counter;
+    (void)value;
+}